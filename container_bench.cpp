@@ -0,0 +1,289 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2019 Kuberan Naganathan
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Measures the basic operations of container and snapshot against std::vector and std::deque: sequential scan, random
+// access, push_back, insertion in the middle, range erase, snapshot creation and a write after each snapshot. The
+// snapshot of a std sequence is a copy of it. Reports the best time of several runs in ns per operation, millions of
+// operations per second and the time relative to std::vector for elements of 8, 64 and 256 bytes. Sequence sizes
+// default to 1000 and 100000 elements and may be given as arguments.
+
+#include "snapshot_container.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+
+static const size_t repetitions = 3;
+static const size_t num_random_indices = 1 << 16;
+static const size_t erase_length = 16;
+
+// Results are accumulated here so the compiler cannot drop the work being timed.
+static volatile uint64_t sink;
+
+
+template <size_t Size>
+struct element
+{
+    element(uint64_t value = 0)
+    {
+        m_words.fill(value);
+    }
+
+    uint64_t key() const
+    {
+        return m_words[0];
+    }
+
+    std::array<uint64_t, Size / 8> m_words;
+};
+
+
+struct result
+{
+    std::string m_operation;
+    std::string m_sequence;
+    double m_ns_per_op;
+};
+
+
+template <typename T>
+std::vector<T> take_snapshot(const std::vector<T>& sequence)
+{
+    return sequence;
+}
+
+template <typename T>
+std::deque<T> take_snapshot(const std::deque<T>& sequence)
+{
+    return sequence;
+}
+
+template <typename T>
+typename snapshot_container::container<T>::snapshot_t take_snapshot(snapshot_container::container<T>& sequence)
+{
+    return sequence.create_snapshot();
+}
+
+
+template <typename Sequence>
+Sequence make_sequence(size_t size)
+{
+    typedef typename Sequence::value_type value_type;
+    Sequence result;
+    for (size_t i = 0; i < size; ++i)
+        result.push_back(value_type(i));
+    return result;
+}
+
+
+// The best time per operation in ns. Each run times op(state) for a state returned by setup, which is not timed.
+template <typename Setup, typename Op>
+double ns_per_op(size_t num_ops, Setup&& setup, Op&& op)
+{
+    double best = 0;
+    for (size_t i = 0; i < repetitions; ++i)
+    {
+        auto state = setup();
+        auto start = std::chrono::steady_clock::now();
+        op(state);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+    return best * 1e9 / num_ops;
+}
+
+
+// The number of operations to run of those whose cost for std::vector grows with the size of the sequence.
+template <typename T>
+size_t bounded_ops(size_t size)
+{
+    return std::max<size_t>(16, std::min<size_t>(4096, (size_t(1) << 28) / (size * sizeof(T) + 1)));
+}
+
+
+template <typename Sequence>
+void bench_sequence(const std::string& name, size_t size, const std::vector<size_t>& indices,
+                    std::vector<result>& results)
+{
+    typedef typename Sequence::value_type value_type;
+    auto setup = [size]() {return make_sequence<Sequence>(size);};
+    auto num_ops = bounded_ops<value_type>(size);
+
+    results.push_back({"scan", name, ns_per_op(size, setup, [](Sequence& sequence) {
+        uint64_t sum = 0;
+        for (auto& value: static_cast<const Sequence&>(sequence))
+            sum += value.key();
+        sink = sum;
+    })});
+
+    results.push_back({"random access", name, ns_per_op(indices.size(), setup, [&indices](Sequence& sequence) {
+        uint64_t sum = 0;
+        for (auto index: indices)
+            sum += sequence[index].key();
+        sink = sum;
+    })});
+
+    results.push_back({"push_back", name, ns_per_op(size, []() {return Sequence();}, [size](Sequence& sequence) {
+        for (size_t i = 0; i < size; ++i)
+            sequence.push_back(value_type(i));
+        sink = sequence.size();
+    })});
+
+    results.push_back({"mid insert", name, ns_per_op(num_ops, setup, [num_ops](Sequence& sequence) {
+        for (size_t i = 0; i < num_ops; ++i)
+            sequence.insert(sequence.cbegin() + sequence.size() / 2, value_type(i));
+        sink = sequence.size();
+    })});
+
+    auto num_erases = std::min(num_ops, size / (2 * erase_length));
+    results.push_back({"range erase", name, ns_per_op(num_erases, setup, [&indices, num_erases](Sequence& sequence) {
+        for (size_t i = 0; i < num_erases; ++i)
+        {
+            auto start = indices[i] % (sequence.size() - erase_length);
+            sequence.erase(sequence.cbegin() + start, sequence.cbegin() + start + erase_length);
+        }
+        sink = sequence.size();
+    })});
+
+    results.push_back({"snapshot", name, ns_per_op(num_ops, setup, [num_ops](Sequence& sequence) {
+        size_t total = 0;
+        for (size_t i = 0; i < num_ops; ++i)
+            total += take_snapshot(sequence).size();
+        sink = total;
+    })});
+
+    // The previous snapshot is retained until the next one is taken, as a reader would.
+    results.push_back({"write after snapshot", name, ns_per_op(num_ops, setup, [&indices, num_ops](Sequence& sequence) {
+        decltype(take_snapshot(sequence)) retained;
+        for (size_t i = 0; i < num_ops; ++i)
+        {
+            retained = take_snapshot(sequence);
+            sequence[indices[i % indices.size()]] = value_type(i);
+        }
+        sink = retained.size();
+    })});
+}
+
+
+// Reads of a snapshot of a container.
+template <typename T>
+void bench_snapshot(size_t size, const std::vector<size_t>& indices, std::vector<result>& results)
+{
+    auto setup = [size]() {
+        auto container = make_sequence<snapshot_container::container<T>>(size);
+        return container.create_snapshot();
+    };
+
+    typedef decltype(setup()) snapshot_t;
+    results.push_back({"scan", "snapshot", ns_per_op(size, setup, [](snapshot_t& snapshot) {
+        uint64_t sum = 0;
+        for (auto& value: snapshot)
+            sum += value.key();
+        sink = sum;
+    })});
+
+    results.push_back({"random access", "snapshot", ns_per_op(indices.size(), setup, [&indices](snapshot_t& snapshot) {
+        uint64_t sum = 0;
+        for (auto index: indices)
+            sum += snapshot[index].key();
+        sink = sum;
+    })});
+}
+
+
+template <size_t ElementSize>
+void run(size_t size)
+{
+    typedef element<ElementSize> value_type;
+    std::mt19937_64 random;
+    std::vector<size_t> indices(num_random_indices);
+    for (auto& index: indices)
+        index = random() % size;
+
+    std::vector<result> results;
+    bench_sequence<std::vector<value_type>>("vector", size, indices, results);
+    bench_sequence<std::deque<value_type>>("deque", size, indices, results);
+    bench_sequence<snapshot_container::container<value_type>>("container", size, indices, results);
+    bench_snapshot<value_type>(size, indices, results);
+
+    // Results are printed by operation, each relative to std::vector.
+    std::vector<std::string> operations;
+    for (auto& result: results)
+    {
+        if (std::find(operations.begin(), operations.end(), result.m_operation) == operations.end())
+            operations.push_back(result.m_operation);
+    }
+
+    for (auto& operation: operations)
+    {
+        double baseline = 0;
+        for (auto& result: results)
+        {
+            if (result.m_operation == operation && result.m_sequence == "vector")
+                baseline = result.m_ns_per_op;
+        }
+
+        for (auto& result: results)
+        {
+            if (result.m_operation != operation)
+                continue;
+
+            std::cout << operation << "\t" << ElementSize << "\t" << size << "\t" << result.m_sequence << "\t"
+                      << result.m_ns_per_op << "\t" << 1e3 / result.m_ns_per_op << "\t"
+                      << result.m_ns_per_op / baseline << std::endl;
+        }
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {1000, 100000};
+
+    std::cout << "operation\telement size\tsize\tsequence\tns/op\tMops/s\tvs vector" << std::endl;
+    for (auto size: sizes)
+    {
+        if (size < 4 * erase_length)
+        {
+            std::cerr << "Sizes must be at least " << 4 * erase_length << std::endl;
+            return 1;
+        }
+        run<8>(size);
+        run<64>(size);
+        run<256>(size);
+    }
+    return 0;
+}
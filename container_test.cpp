@@ -24,8 +24,18 @@
 #define CATCH_CONFIG_MAIN
 #include <vector>
 #include "snapshot_container.h"
+#include "snapshot_checkpoint.h"
+#include "snapshot_compactor.h"
+#include "snapshot_mmap_storage.h"
+#include "snapshot_parallel.h"
+#include "snapshot_publisher.h"
 #include "catch.hpp"
 #include <algorithm>
+#include <numeric>
+#include <string>
+#include <cstdio>
+#include <thread>
+#include <dirent.h>
 
 
 template <typename T>
@@ -65,3 +75,862 @@ TEST_CASE("Container ops", "[container]")
 }
 
 
+
+template <typename ContainerType>
+void check_snapshot_isolation_on_write()
+{
+    auto vec = std::vector<int>(1024, 0xdeadbeef);
+    auto container = ContainerType(vec.begin(), vec.begin() + 512);
+    auto unused_snapshot = container.create_snapshot();
+    container.insert(container.begin() + 256, vec.begin() + 512, vec.end());
+
+    // The iterator writes to the container before the snapshot is taken and continues to write afterwards
+    auto itr = container.begin();
+    *itr = 1;
+    ++itr;
+    vec[0] = 1;
+    auto snapshot = container.create_snapshot();
+    for (; itr != container.end(); ++itr)
+        *itr = 2;
+
+    REQUIRE(std::equal(snapshot.begin(), snapshot.end(), vec.begin()));
+    REQUIRE(container[0] == 1);
+    REQUIRE(std::all_of(container.begin() + 1, container.end(), [](int value) {return value == 2;}));
+
+    // Snapshots of snapshots share the slice table until the container changes
+    auto snapshot2 = container.create_snapshot();
+    container[512] = 3;
+    REQUIRE(snapshot2[512] == 2);
+    REQUIRE(snapshot[512] == static_cast<int>(0xdeadbeef));
+    REQUIRE(container[512] == 3);
+}
+
+
+TEST_CASE("Snapshot does not change when container is written through an iterator", "[container]")
+{
+    check_snapshot_isolation_on_write<container_t<int>>();
+    check_snapshot_isolation_on_write<snapshot_container::container<int, snapshot_container::deque_storage_creator<int>,
+        snapshot_container::_btree_iterator_kernel_config_traits>>();
+    check_snapshot_isolation_on_write<snapshot_container::container<int, snapshot_container::deque_storage_creator<int>,
+        snapshot_container::_single_threaded_config_traits<>>>();
+    check_snapshot_isolation_on_write<snapshot_container::container<int, snapshot_container::deque_storage_creator<int>,
+        snapshot_container::_single_threaded_config_traits<snapshot_container::_btree_iterator_kernel_config_traits>>>();
+}
+
+
+TEST_CASE("Single threaded kernel handles", "[container]")
+{
+    using traits_t = snapshot_container::_single_threaded_config_traits<>;
+    using local_container_t = snapshot_container::container<int, snapshot_container::deque_storage_creator<int>, traits_t>;
+    using slice_t = local_container_t::kernel_t::slice_t;
+    static_assert(std::is_same<local_container_t::shared_kernel_t,
+                               snapshot_container::_local_shared_ptr<local_container_t::kernel_t>>::value, "");
+    static_assert(std::is_same<slice_t::shared_base_t,
+                               snapshot_container::_local_storage_ptr<slice_t::storage_t>>::value, "");
+
+    auto vec = std::vector<int>(1024);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto container = local_container_t(vec.begin(), vec.end());
+    auto kernel = snapshot_container::_extract_kernel(container.begin());
+    REQUIRE(kernel.use_count() == 2);
+    {
+        auto itr = container.begin();
+        auto itr2 = itr + 10;
+        REQUIRE(kernel.use_count() == 4);
+        REQUIRE(*itr2 == 10);
+    }
+    REQUIRE(kernel.use_count() == 2);
+
+    auto snapshot = container.create_snapshot();
+    for (auto itr = container.begin(); itr != container.end(); ++itr)
+        *itr += 1;
+    REQUIRE(std::equal(snapshot.begin(), snapshot.end(), vec.begin()));
+    REQUIRE(container[1023] == 1024);
+    kernel.reset();
+    REQUIRE(kernel.use_count() == 0);
+
+    // Storage handles count the slices and caches referring to the storage. Storage pinned by a cache is not
+    // modified in place.
+    snapshot = local_container_t::snapshot_t();
+    REQUIRE(container.memory_usage().m_shared_bytes == 0);
+    snapshot_container::aggregate_cache<int, snapshot_container::sum_monoid<int>> sums;
+    auto sum = container.reduce(sums);
+    REQUIRE(sum == std::accumulate(vec.begin(), vec.end(), 0) + 1024);
+    REQUIRE(container.memory_usage().m_shared_bytes == container.memory_usage().m_total_bytes);
+    container[0] += 1;
+    container.erase(container.cbegin() + 10);
+    REQUIRE(container.reduce(sums) == sum + 1 - 11);
+    sums.clear();
+    REQUIRE(container.memory_usage().m_shared_bytes == 0);
+}
+
+
+TEST_CASE("Borrowed iterators", "[container]")
+{
+    auto vec = std::vector<int>(4096);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto container = container_t<int>(vec.begin(), vec.end());
+    container.insert(container.begin() + 1000, vec.begin(), vec.begin() + 100);
+    container.erase(container.begin() + 1000, container.begin() + 1100);
+    REQUIRE(std::equal(container.borrowed_begin(), container.borrowed_end(), vec.begin()));
+
+    auto snapshot = container.create_snapshot();
+    auto found = std::lower_bound(snapshot.borrowed_begin(), snapshot.borrowed_end(), 2500);
+    REQUIRE(found - snapshot.borrowed_begin() == 2500);
+    REQUIRE(*found == 2500);
+
+    // Writes through borrowed iterators are copy on write
+    for (auto itr = container.borrowed_begin(); itr != container.borrowed_end(); ++itr)
+        *itr += 1;
+    REQUIRE(std::equal(snapshot.begin(), snapshot.end(), vec.begin()));
+    REQUIRE(std::equal(snapshot.borrowed_begin(), snapshot.borrowed_end(), container.cbegin(),
+                       [](int lhs, int rhs) {return lhs + 1 == rhs;}));
+
+    // Snapshot iterators remain valid when the container changes
+    auto itr = snapshot.end();
+    container.clear();
+    size_t count = 0;
+    while (itr != snapshot.begin())
+    {
+        --itr;
+        REQUIRE(*itr == static_cast<int>(vec.size() - ++count));
+    }
+    REQUIRE(count == vec.size());
+}
+
+
+TEST_CASE("Aggregate cache", "[container]")
+{
+    auto vec = std::vector<long>(20000);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto container = container_t<long>(vec.begin(), vec.end());
+    snapshot_container::aggregate_cache<long, snapshot_container::sum_monoid<long>> sums;
+    snapshot_container::aggregate_cache<long, snapshot_container::max_monoid<long>> maxima;
+
+    auto snapshot = container.create_snapshot();
+    REQUIRE(snapshot.reduce(sums) == std::accumulate(vec.begin(), vec.end(), 0L));
+    REQUIRE(snapshot.reduce(sums, 100, 12345) == std::accumulate(vec.begin() + 100, vec.begin() + 12345, 0L));
+    REQUIRE(snapshot.reduce(sums, 500, 500) == 0);
+    REQUIRE(snapshot.reduce(maxima, 0, 777) == 776);
+    REQUIRE(sums.size() == 1);
+
+    // Container changes made after reducing it are not visible in cached summaries of the old elements
+    REQUIRE(container.reduce(sums) == std::accumulate(vec.begin(), vec.end(), 0L));
+    for (auto itr = container.begin() + 5000; itr != container.begin() + 5100; ++itr)
+        *itr = 0;
+    container.erase(container.begin() + 15000, container.begin() + 15100);
+    container.insert(container.begin() + 100, vec.begin(), vec.begin() + 10);
+    container.push_back(1000000);
+
+    auto expected = std::vector<long>(container.begin(), container.end());
+    for (size_t first: {0, 99, 5050, 14000})
+    {
+        for (size_t last: {first + 1, first + 3000, expected.size()})
+        {
+            REQUIRE(container.reduce(sums, first, last) ==
+                    std::accumulate(expected.begin() + first, expected.begin() + last, 0L));
+            REQUIRE(container.reduce(maxima, first, last) ==
+                    *std::max_element(expected.begin() + first, expected.begin() + last));
+        }
+    }
+    REQUIRE(snapshot.reduce(sums) == std::accumulate(vec.begin(), vec.end(), 0L));
+
+    // Storage referenced only by the cache is released by trim
+    snapshot = container.create_snapshot();
+    container.clear();
+    REQUIRE(sums.size() > 1);
+    snapshot = decltype(snapshot)();
+    maxima.clear();
+    REQUIRE(sums.trim() == 0);
+}
+
+
+TEST_CASE("Parallel algorithms", "[container]")
+{
+    snapshot_container::work_stealing_pool pool(4);
+    auto vec = std::vector<long>(100000);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto container = container_t<long>(vec.begin(), vec.end());
+    for (size_t i = 0; i < 20; ++i)
+        container.insert(container.begin() + i * 4000, vec.begin(), vec.begin() + 100);
+    auto snapshot = container.create_snapshot();
+    auto expected = std::vector<long>(snapshot.begin(), snapshot.end());
+
+    for (size_t grain: {0, 1000, 1000000})
+    {
+        std::atomic<long> sum(0);
+        snapshot_container::parallel_for_each(pool, snapshot, [&sum](long value) {sum += value;}, grain);
+        REQUIRE(sum == std::accumulate(expected.begin(), expected.end(), 0L));
+
+        auto squares = snapshot_container::parallel_transform_reduce(pool, snapshot, 7L, std::plus<long>(),
+                                                                     [](long value) {return value * value;}, grain);
+        REQUIRE(squares == std::accumulate(expected.begin(), expected.end(), 7L,
+                                           [](long lhs, long rhs) {return lhs + rhs * rhs;}));
+
+        auto is_even = [](long value) {return value % 2 == 0;};
+        REQUIRE(snapshot_container::parallel_count_if(pool, snapshot, is_even, grain) ==
+                static_cast<size_t>(std::count_if(expected.begin(), expected.end(), is_even)));
+
+        for (long value: {0L, 99L, 50000L, 99999L, -1L})
+        {
+            auto found = snapshot_container::parallel_find_if(pool, snapshot, [value](long element) {return element == value;}, grain);
+            REQUIRE(found - snapshot.begin() == std::find(expected.begin(), expected.end(), value) - expected.begin());
+        }
+    }
+
+    // Exceptions thrown by tasks are rethrown to the caller
+    REQUIRE_THROWS_AS(snapshot_container::parallel_for_each(pool, snapshot, [](long value) {
+        if (value == 12345)
+            throw std::runtime_error("found");
+    }), std::runtime_error);
+
+    auto empty = container_t<long>().create_snapshot();
+    REQUIRE(snapshot_container::parallel_count_if(pool, empty, [](long) {return true;}) == 0);
+    REQUIRE(snapshot_container::parallel_find_if(pool, empty, [](long) {return true;}) == empty.end());
+}
+
+
+TEST_CASE("Background compaction", "[container]")
+{
+    // Groups of 50 small slices separated by large slices. Appends following a snapshot go to new storage.
+    auto container = container_t<int>();
+    container.set_append_in_place(false);
+    std::vector<container_t<int>::snapshot_t> snapshots;
+    std::vector<int> expected;
+    for (size_t group = 0; group < 6; ++group)
+    {
+        for (size_t slice = 0; slice < 50; ++slice)
+        {
+            snapshots.push_back(container.create_snapshot());
+            for (int i = 0; i < 10; ++i)
+            {
+                container.push_back(i);
+                expected.push_back(i);
+            }
+        }
+        snapshots.push_back(container.create_snapshot());
+        for (int i = 0; i < 3000; ++i)
+        {
+            container.push_back(7);
+            expected.push_back(7);
+        }
+    }
+    auto snapshot = container.create_snapshot();
+    auto snapshot_values = expected;
+    snapshots.clear();
+    REQUIRE(std::equal(container.cbegin(), container.cend(), expected.begin(), expected.end()));
+    REQUIRE(container.num_slices() == 306);
+
+    // The first group is modified while the compaction is in progress so it is not replaced.
+    snapshot_container::background_compactor<container_t<int>> compactor(8);
+    REQUIRE(compactor.poll(container) == 0);
+    container[5] = -1;
+    expected[5] = -1;
+    container.push_back(42);
+    expected.push_back(42);
+    REQUIRE(compactor.wait(container) == 5 * 49);
+    REQUIRE(!container.append_in_place());
+    REQUIRE(std::equal(container.cbegin(), container.cend(), expected.begin(), expected.end()));
+    REQUIRE(std::equal(snapshot.begin(), snapshot.end(), snapshot_values.begin(), snapshot_values.end()));
+
+    auto num_slices = container.num_slices();
+    compactor.poll(container);
+    auto removed = compactor.wait(container);
+    REQUIRE(removed >= 49);
+    REQUIRE(container.num_slices() == num_slices - removed);
+    REQUIRE(std::equal(container.cbegin(), container.cend(), expected.begin(), expected.end()));
+
+    // Nothing left to merge
+    num_slices = container.num_slices();
+    compactor.poll(container);
+    REQUIRE(compactor.wait(container) == 0);
+    REQUIRE(compactor.poll(container) == 0);
+    REQUIRE(compactor.wait(container) == 0);
+    REQUIRE(container.num_slices() == num_slices);
+}
+
+
+TEST_CASE("Background compaction with a concurrent writer", "[container]")
+{
+    // The writer keeps modifying the container while compactions run. The snapshots taken by the compactor cause cow
+    // ops which create small slices to merge. Storage released by the compactor is modified in place afterwards.
+    auto container = container_t<int>();
+    std::vector<int> expected;
+    for (int i = 0; i < 2000; ++i)
+    {
+        container.push_back(i);
+        expected.push_back(i);
+    }
+    snapshot_container::background_compactor<container_t<int>> compactor(4, 1.0);
+    for (int op = 0; op < 20000; ++op)
+    {
+        auto size = expected.size();
+        auto index = size ? (op * 7919) % size : 0;
+        switch (op % 4)
+        {
+        case 0:
+            container.insert(container.cbegin() + index, op);
+            expected.insert(expected.begin() + index, op);
+            break;
+        case 1:
+            if (size)
+            {
+                container[index] = -op;
+                expected[index] = -op;
+            }
+            break;
+        case 2:
+            if (size)
+            {
+                container.erase(container.cbegin() + index / 2, container.cbegin() + index / 2 + 1);
+                expected.erase(expected.begin() + index / 2, expected.begin() + index / 2 + 1);
+            }
+            break;
+        default:
+            container.push_back(op);
+            expected.push_back(op);
+        }
+
+        if (op % 7 == 0)
+        {
+            compactor.poll(container);
+            // Lets the background thread run between polls on machines with few cores.
+            std::this_thread::yield();
+        }
+    }
+    compactor.wait(container);
+    REQUIRE(std::equal(container.cbegin(), container.cend(), expected.begin(), expected.end()));
+}
+
+
+struct registered_traits: public snapshot_container::_iterator_kernel_config_traits
+{
+    static constexpr bool register_kernels = true;
+};
+
+TEST_CASE("Memory usage", "[container]")
+{
+    auto container = container_t<int>();
+    for (int i = 0; i < 1000; ++i)
+        container.push_back(i);
+    auto usage = container.memory_usage();
+    REQUIRE(usage.m_total_bytes == 1000 * sizeof(int));
+    REQUIRE(usage.m_exclusive_bytes == usage.m_total_bytes);
+    REQUIRE(usage.m_dead_bytes == 0);
+    REQUIRE(usage.m_num_storages == 1);
+
+    // The snapshot shares everything until the container is written. The write copies the first 135 elements to new
+    // storage, leaving the originals reachable only through the snapshot.
+    auto snapshot = container.create_snapshot();
+    REQUIRE(container.memory_usage().m_shared_bytes == 1000 * sizeof(int));
+    container[10] = -1;
+    usage = container.memory_usage();
+    REQUIRE(usage.m_num_storages == 2);
+    REQUIRE(usage.m_total_bytes == 1135 * sizeof(int));
+    REQUIRE(usage.m_shared_bytes == 1000 * sizeof(int));
+    REQUIRE(usage.m_exclusive_bytes == 135 * sizeof(int));
+    REQUIRE(usage.m_dead_bytes == 135 * sizeof(int));
+    auto snapshot_usage = snapshot.memory_usage();
+    REQUIRE(snapshot_usage.m_total_bytes == 1000 * sizeof(int));
+    REQUIRE(snapshot_usage.m_exclusive_bytes == 0);
+    REQUIRE(snapshot_usage.m_dead_bytes == 0);
+
+    snapshot = container_t<int>::snapshot_t();
+    usage = container.memory_usage();
+    REQUIRE(usage.m_exclusive_bytes == 1135 * sizeof(int));
+    REQUIRE(usage.m_dead_bytes == 135 * sizeof(int));
+
+    // Across kernels storage is exclusive when a single kernel references it and dead bytes are those no kernel reaches
+    typedef snapshot_container::container<int, snapshot_container::deque_storage_creator<int>, registered_traits> registered_t;
+    {
+        registered_t registered;
+        for (int i = 0; i < 1000; ++i)
+            registered.push_back(i);
+        auto registered_snapshot = registered.create_snapshot();
+        registered[10] = -1;
+        auto report = registered_t::registered_memory_usage();
+        REQUIRE(report.m_num_kernels == 2);
+        REQUIRE(report.m_total.m_total_bytes == 1135 * sizeof(int));
+        REQUIRE(report.m_total.m_exclusive_bytes == 135 * sizeof(int));
+        REQUIRE(report.m_total.m_shared_bytes == 1000 * sizeof(int));
+        REQUIRE(report.m_total.m_dead_bytes == 0);
+    }
+    REQUIRE(registered_t::registered_memory_usage().m_num_kernels == 0);
+}
+
+
+// Number of files open in this process, or 0 if they cannot be listed.
+static size_t open_files()
+{
+    size_t count = 0;
+    if (auto dir = opendir("/proc/self/fd"))
+    {
+        while (readdir(dir))
+            ++count;
+        closedir(dir);
+    }
+    return count;
+}
+
+
+TEST_CASE("Memory mapped storage", "[container]")
+{
+    typedef snapshot_container::mmap_storage_creator<int> creator_t;
+    typedef snapshot_container::container<int, creator_t> mmap_container_t;
+    char directory_template[] = "/tmp/snapshot_mmap_container_XXXXXX";
+    std::string directory = mkdtemp(directory_template);
+    auto files = open_files();
+    {
+        mmap_container_t container(creator_t{directory});
+        std::vector<int> expected;
+        for (int i = 0; i < 10000; ++i)
+        {
+            container.push_back(i);
+            expected.push_back(i);
+        }
+
+        // Writes following the snapshot copy parts of the container to new storage files.
+        auto snapshot = container.create_snapshot();
+        auto snapshot_values = expected;
+        for (int i = 0; i < 200; ++i)
+        {
+            auto index = (i * 997) % expected.size();
+            container[index] = -i;
+            expected[index] = -i;
+            container.insert(container.cbegin() + index / 2, i);
+            expected.insert(expected.begin() + index / 2, i);
+        }
+
+        REQUIRE(container.memory_usage().m_num_storages > 32);
+        REQUIRE(open_files() == files);    // storage files are only open while they are resized
+        REQUIRE(std::equal(container.cbegin(), container.cend(), expected.begin(), expected.end()));
+        REQUIRE(std::equal(snapshot.begin(), snapshot.end(), snapshot_values.begin(), snapshot_values.end()));
+    }
+
+    // Appending an element of the container itself when the storage is full. Growing the storage remaps it, which
+    // invalidates the element appended.
+    {
+        mmap_container_t container(creator_t{directory});
+        for (int i = 0; i < 1024; ++i)
+            container.push_back(i);
+        container.push_back(container[0]);
+        container.push_back(container[1024]);
+        REQUIRE(container.size() == 1026);
+        REQUIRE(container[1024] == 0);
+        REQUIRE(container[1025] == 0);
+    }
+
+    // Files of non persistent storage are removed along with the container.
+    REQUIRE(rmdir(directory.c_str()) == 0);
+}
+
+
+TEST_CASE("Dead storage trimming", "[container]")
+{
+    // Two storage elements. Writes following a snapshot cut 135 elements off the front of the first and 100
+    // elements off the back of the second.
+    auto container = container_t<int>();
+    std::vector<int> expected;
+    for (int i = 0; i < 2000; ++i)
+    {
+        if (i == 1000)
+        {
+            container.set_append_in_place(false);
+            auto snapshot = container.create_snapshot();
+            container.push_back(i);
+            container.set_append_in_place(true);
+        }
+        else
+        {
+            container.push_back(i);
+        }
+        expected.push_back(i);
+    }
+    auto snapshot = container.create_snapshot();
+    container[10] = -1;
+    container[1900] = -2;
+    expected[10] = -1;
+    expected[1900] = -2;
+
+    // Storage shared with a snapshot is not trimmed
+    REQUIRE(container.memory_usage().m_dead_bytes == 235 * sizeof(int));
+    REQUIRE(container.trim_dead_storage(1.0) == 0);
+
+    snapshot = container_t<int>::snapshot_t();
+    REQUIRE(container.trim_dead_storage(0.5) == 0);
+    REQUIRE(container.trim_dead_storage(1.0, 1) == 135 * sizeof(int));
+    REQUIRE(container.memory_usage().m_dead_bytes == 100 * sizeof(int));
+    REQUIRE(container.trim_dead_storage(1.0) == 100 * sizeof(int));
+
+    auto usage = container.memory_usage();
+    REQUIRE(usage.m_dead_bytes == 0);
+    REQUIRE(usage.m_total_bytes == 2000 * sizeof(int));
+    REQUIRE(std::equal(container.cbegin(), container.cend(), expected.begin(), expected.end()));
+
+    container[500] = 7;
+    container.push_back(2000);
+    expected[500] = 7;
+    expected.push_back(2000);
+    REQUIRE(std::equal(container.cbegin(), container.cend(), expected.begin(), expected.end()));
+}
+
+
+TEST_CASE("Segmented iteration", "[container]")
+{
+    auto vec = std::vector<int>(4096);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto container = container_t<int>(vec.begin(), vec.end());
+    auto snapshot = container.create_snapshot();
+    container.insert(container.begin() + 1000, vec.begin(), vec.begin() + 100);
+    container.erase(container.begin() + 3000, container.begin() + 3100);
+
+    std::vector<int> result;
+    size_t num_segments = 0;
+    container.for_each_segment([&](const auto& segment) {
+        result.insert(result.end(), segment.begin(), segment.end());
+        ++num_segments;
+    });
+    REQUIRE(num_segments > 1);
+    REQUIRE(std::equal(container.cbegin(), container.cend(), result.begin(), result.end()));
+
+    long long sum = 0;
+    snapshot.for_each_segment([&](const auto& segment) {
+        for (auto value : segment)
+            sum += value;
+    });
+    REQUIRE(sum == std::accumulate(vec.begin(), vec.end(), 0LL));
+
+    // Partial ranges and early termination
+    result.clear();
+    container.for_each_segment(500, 1500, [&](const auto& segment) {
+        result.insert(result.end(), segment.begin(), segment.end());
+    });
+    REQUIRE(std::equal(container.cbegin() + 500, container.cbegin() + 1500, result.begin(), result.end()));
+
+    size_t seen = 0;
+    bool completed = snapshot.for_each_segment([&](const auto& segment) {
+        seen += segment.size();
+        return seen < 1000;
+    });
+    REQUIRE(!completed);
+    REQUIRE(seen >= 1000);
+    REQUIRE(seen < vec.size());
+}
+
+
+TEST_CASE("Push back after erasing the end of the container", "[container]")
+{
+    // The write following the snapshot moves the back half of the container to new storage, leaving the front half
+    // at [0, 500) of the original storage. The erase then narrows that to [0, 400). Once the snapshot is gone the
+    // storage is no longer shared but the slice still ends before the end of the storage.
+    auto container = container_t<int>();
+    std::vector<int> expected;
+    for (int i = 0; i < 1000; ++i)
+    {
+        container.push_back(i);
+        expected.push_back(i);
+    }
+    {
+        auto snapshot = container.create_snapshot();
+        *(container.begin() + 500) = -1;
+        expected[500] = -1;
+    }
+    container.erase(container.cbegin() + 400, container.cend());
+    expected.erase(expected.begin() + 400, expected.end());
+
+    container.push_back(100000);
+    expected.push_back(100000);
+    REQUIRE(container[400] == 100000);
+    REQUIRE(container.emplace_back(100001) == 100001);
+    expected.push_back(100001);
+    REQUIRE(std::equal(container.cbegin(), container.cend(), expected.begin(), expected.end()));
+}
+
+
+TEST_CASE("Move and emplace", "[container]")
+{
+    using string_container_t = container_t<std::string>;
+    const std::string long_value(64, 'x');
+    auto container = string_container_t();
+    for (size_t i = 0; i < 64; ++i)
+    {
+        auto value = long_value + std::to_string(i);
+        auto data = value.data();
+        container.push_back(std::move(value));
+        // The string buffer is moved rather than copied into the container
+        REQUIRE((*(container.cbegin() + i)).data() == data);
+    }
+    container.emplace_back(3, 'y');
+    REQUIRE(container[64] == "yyy");
+
+    auto snapshot = container.create_snapshot();
+    container.emplace(container.cbegin() + 10, "emplaced");
+    container.insert(container.cbegin() + 20, std::string("inserted"));
+
+    std::vector<std::string> values {"a", "b", "c"};
+    container.insert(container.cbegin() + 30, std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+    REQUIRE(container.size() == 65 + 2 + 3);
+    REQUIRE(container[10] == "emplaced");
+    REQUIRE(container[20] == "inserted");
+    REQUIRE(container[30] == "a");
+    REQUIRE(container[32] == "c");
+    REQUIRE(container[33] == long_value + "28");
+
+    // Writes through an iterator cow the moved-from slice pieces without disturbing the snapshot
+    for (auto itr = container.begin(); itr != container.end(); ++itr)
+        *itr += "!";
+    REQUIRE(snapshot.size() == 65);
+    for (size_t i = 0; i < 64; ++i)
+        REQUIRE(snapshot[i] == long_value + std::to_string(i));
+    REQUIRE(container[0] == long_value + "0!");
+    REQUIRE(container[31] == "b!");
+}
+
+
+// In memory sink and source for serialization.
+struct buffer_stream
+{
+    void write(const iovec* iov, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto data = static_cast<const char*>(iov[i].iov_base);
+            m_buffer.insert(m_buffer.end(), data, data + iov[i].iov_len);
+        }
+    }
+
+    size_t read(void* data, size_t size)
+    {
+        size = std::min(size, m_buffer.size() - m_read_pos);
+        std::copy(m_buffer.begin() + m_read_pos, m_buffer.begin() + m_read_pos + size, static_cast<char*>(data));
+        m_read_pos += size;
+        return size;
+    }
+
+    std::vector<char> m_buffer;
+    size_t m_read_pos = 0;
+};
+
+
+TEST_CASE("Serialization", "[container]")
+{
+    using snapshot_t = container_t<int>::snapshot_t;
+    auto vec = std::vector<int>(10000);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto container = container_t<int>(vec.begin(), vec.end());
+    std::vector<snapshot_t> snapshots {container.create_snapshot()};
+    for (int i = 0; i < 1000; ++i)
+        container.push_back(-i);
+    container.insert(container.begin() + 5000, vec.begin(), vec.begin() + 10);
+    container.erase(container.begin() + 100, container.begin() + 200);
+    snapshots.push_back(container.create_snapshot());
+    container[0] = -1;
+    snapshots.push_back(container.create_snapshot());
+
+    FILE* file = tmpfile();
+    snapshot_container::fd_sink sink(fileno(file));
+    snapshot_container::snapshot_writer<snapshot_t, snapshot_container::fd_sink> writer(sink);
+    size_t total_size = 0;
+    for (auto& snapshot : snapshots)
+    {
+        writer.write(snapshot);
+        total_size += snapshot.size();
+        if (total_size == vec.size())
+            REQUIRE(writer.elements_written() == vec.size());
+    }
+    // Shared elements are only written once
+    auto elements_written = writer.elements_written();
+    REQUIRE(elements_written < total_size * 0.6);
+    writer.write(snapshots.back());
+    REQUIRE(writer.elements_written() == elements_written);
+    snapshots.push_back(snapshots.back());
+
+    lseek(fileno(file), 0, SEEK_SET);
+    snapshot_container::fd_source source(fileno(file));
+    snapshot_container::snapshot_reader<snapshot_t, snapshot_container::fd_source> reader(source);
+    for (auto& snapshot : snapshots)
+    {
+        snapshot_t result;
+        REQUIRE(reader.read(result));
+        REQUIRE(result.size() == snapshot.size());
+        REQUIRE(std::equal(result.begin(), result.end(), snapshot.begin(), snapshot.end()));
+    }
+    snapshot_t result;
+    REQUIRE(!reader.read(result));
+    fclose(file);
+
+    buffer_stream stream;
+    snapshots[1].serialize(stream);
+    auto deserialized = snapshot_t::deserialize(stream);
+    REQUIRE(std::equal(deserialized.begin(), deserialized.end(), snapshots[1].begin(), snapshots[1].end()));
+    REQUIRE_THROWS(snapshot_t::deserialize(stream));
+
+    stream.m_buffer.resize(stream.m_buffer.size() - 1);
+    stream.m_read_pos = 0;
+    REQUIRE_THROWS(snapshot_t::deserialize(stream));
+}
+
+
+TEST_CASE("Incremental checkpoints", "[container]")
+{
+    using snapshot_t = container_t<int>::snapshot_t;
+    char directory_template[] = "/tmp/snapshot_checkpoint_test_XXXXXX";
+    std::string directory = mkdtemp(directory_template);
+
+    auto vec = std::vector<int>(100000);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto container = container_t<int>(vec.begin(), vec.end());
+    std::vector<snapshot_t> snapshots;
+    {
+        snapshot_container::checkpoint_writer<snapshot_t> writer(directory);
+        for (int i = 0; i < 5; ++i)
+        {
+            auto elements_written = writer.elements_written();
+            snapshots.push_back(container.create_snapshot());
+            REQUIRE(writer.checkpoint(snapshots.back()) == i);
+            // Only the changes since the last checkpoint are written
+            if (i > 0)
+                REQUIRE(writer.elements_written() - elements_written < vec.size() / 4);
+
+            for (int j = 0; j < 100; ++j)
+                container.push_back(i * 100 + j);
+            container[i * 1000] = -i;
+        }
+    }
+
+    // A new writer starts a new chain following the existing checkpoints
+    {
+        snapshot_container::checkpoint_writer<snapshot_t> writer(directory);
+        snapshots.push_back(container.create_snapshot());
+        REQUIRE(writer.checkpoint(snapshots.back()) == 5);
+        REQUIRE(writer.elements_written() >= container.size());
+    }
+
+    snapshot_container::checkpoint_loader<snapshot_t> loader(directory);
+    REQUIRE(loader.size() == snapshots.size());
+    for (size_t i = snapshots.size(); i > 0; --i)
+    {
+        auto snapshot = loader.load(i - 1);
+        REQUIRE(std::equal(snapshot.begin(), snapshot.end(), snapshots[i - 1].begin(), snapshots[i - 1].end()));
+    }
+    REQUIRE_THROWS(loader.load(snapshots.size()));
+
+    for (size_t i = 0; i < snapshots.size(); ++i)
+        unlink((directory + "/checkpoint_" + std::to_string(i)).c_str());
+    REQUIRE(rmdir(directory.c_str()) == 0);
+}
+
+
+TEST_CASE("Snapshot diff", "[container]")
+{
+    using snapshot_container::snapshot_edit;
+    auto vec = std::vector<int>(10000);
+    std::iota(vec.begin(), vec.end(), 0);
+    auto container = container_t<int>(vec.begin(), vec.end());
+    auto older = container.create_snapshot();
+    REQUIRE(diff(older, container.create_snapshot()).empty());
+
+    // Applying the edits to the older snapshot gives the newer one
+    auto apply = [](const auto& older, const auto& newer, const std::vector<snapshot_edit>& edits) {
+        std::vector<int> result(older.begin(), older.end());
+        for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit)
+        {
+            result.erase(result.begin() + edit->m_old_start, result.begin() + edit->m_old_end);
+            result.insert(result.begin() + edit->m_old_start, newer.begin() + edit->m_new_start,
+                          newer.begin() + edit->m_new_end);
+        }
+        return std::equal(result.begin(), result.end(), newer.begin(), newer.end());
+    };
+
+    for (int i = 0; i < 10; ++i)
+        container.push_back(-i);
+    auto newer = container.create_snapshot();
+    auto edits = diff(older, newer);
+    REQUIRE(edits.size() == 1);
+    REQUIRE(edits[0] == snapshot_edit(10000, 10000, 10000, 10010, snapshot_edit::inserted));
+    edits = diff(newer, older);
+    REQUIRE(edits.size() == 1);
+    REQUIRE(edits[0] == snapshot_edit(10000, 10010, 10000, 10000, snapshot_edit::erased));
+
+    // Writes through an iterator are reported as a replaced range covering the element written. The cow op copies
+    // only part of the slice so the rest is found to be unchanged.
+    container[7000] = -1;
+    auto newest = container.create_snapshot();
+    edits = diff(newer, newest);
+    REQUIRE(edits.size() == 1);
+    REQUIRE(edits[0].m_kind == snapshot_edit::replaced);
+    REQUIRE(edits[0].m_new_start <= 7000);
+    REQUIRE(edits[0].m_new_end > 7000);
+    REQUIRE(edits[0].m_new_end - edits[0].m_new_start < newest.size() / 2);
+    REQUIRE(apply(newer, newest, edits));
+
+    container.insert(container.begin() + 5000, vec.begin(), vec.begin() + 10);
+    container.erase(container.begin() + 100, container.begin() + 200);
+    auto latest = container.create_snapshot();
+    REQUIRE(apply(newest, latest, diff(newest, latest)));
+    REQUIRE(apply(older, latest, diff(older, latest)));
+    REQUIRE(apply(latest, older, diff(latest, older)));
+
+    auto unrelated = container_t<int>(vec.begin(), vec.end()).create_snapshot();
+    edits = diff(older, unrelated);
+    REQUIRE(edits.size() == 1);
+    REQUIRE(edits[0] == snapshot_edit(0, 10000, 0, 10000, snapshot_edit::replaced));
+}
+
+
+TEST_CASE("Snapshot publisher", "[container]")
+{
+    using snapshot_t = container_t<int>::snapshot_t;
+    auto container = container_t<int>();
+    snapshot_container::snapshot_publisher<snapshot_t, 8> publisher;
+    std::atomic<bool> done {false};
+    std::atomic<size_t> inconsistent {0};
+    std::atomic<size_t> acquired {0};
+
+    // Readers check that each snapshot acquired is a consistent prefix of the sequence written and that they
+    // never go back in time.
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]() {
+            auto reader = publisher.reader();
+            size_t last_size = 0;
+            while (!done.load())
+            {
+                auto snapshot = reader.acquire();
+                if (snapshot.size() < last_size)
+                    ++inconsistent;
+                last_size = snapshot.size();
+                size_t index = 0;
+                snapshot.for_each_segment([&](const auto& segment) {
+                    for (auto value : segment)
+                        if (value != int(index++))
+                            ++inconsistent;
+                });
+                ++acquired;
+            }
+        });
+    }
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        container.push_back(i);
+        if (i % 100 == 99)
+            publisher.publish(container);
+    }
+    while (acquired.load() < 100)
+        std::this_thread::yield();
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+
+    REQUIRE(inconsistent.load() == 0);
+    REQUIRE(publisher.latest().size() == 20000);
+    REQUIRE(publisher.reclaim() == 0);
+    REQUIRE(std::equal(container.cbegin(), container.cend(), publisher.reader().acquire().begin()));
+
+    std::vector<decltype(publisher.reader())> handles;
+    for (int i = 0; i < 8; ++i)
+        handles.push_back(publisher.reader());
+    REQUIRE_THROWS(publisher.reader());
+}
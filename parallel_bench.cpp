@@ -0,0 +1,108 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2019 Kuberan Naganathan
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Measures scaling of the parallel snapshot algorithms. Sums the elements of a snapshot (parallel_transform_reduce)
+// and searches for a value found only in its last element (parallel_find_if) with pools of 1, 2, 4, ... up to the number of hardware
+// threads and reports the speedup over a sequential pass with for_each_segment. The number of elements defaults to
+// 100M and may be given as the first argument.
+
+#include "snapshot_container.h"
+#include "snapshot_parallel.h"
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+
+using container_t = snapshot_container::container<int>;
+using snapshot_t = container_t::snapshot_t;
+
+static const size_t repetitions = 5;
+
+
+template <typename Function>
+double best_time(Function&& f)
+{
+    double best = 0;
+    for (size_t i = 0; i < repetitions; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+
+int main(int argc, char* argv[])
+{
+    size_t num_elements = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000000;
+    container_t container;
+    for (size_t i = 0; i < num_elements; ++i)
+        container.push_back(static_cast<int>(i % 1000));
+    // Edits spread over the container so the snapshot has slices of differing sizes.
+    for (size_t i = 1; i < 64; ++i)
+        container[i * (num_elements / 64)] = -1;
+    container[num_elements - 1] = -2;
+    auto snapshot = container.create_snapshot();
+    auto last = -2;
+
+    long expected = 0;
+    auto sequential = best_time([&]() {
+        expected = 0;
+        snapshot.for_each_segment([&](const auto& segment) {
+            for (auto value: segment)
+                expected += value;
+        });
+    });
+
+    std::cout << "elements: " << num_elements << std::endl;
+    std::cout << "threads\treduce s\treduce speedup\tfind s\tfind speedup" << std::endl;
+    std::cout << "seq\t" << sequential << "\t1\t-\t-" << std::endl;
+
+    size_t max_threads = std::max(2u, std::thread::hardware_concurrency());
+    for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    {
+        snapshot_container::work_stealing_pool pool(num_threads);
+        long sum = 0;
+        auto reduce = best_time([&]() {
+            sum = snapshot_container::parallel_transform_reduce(pool, snapshot, 0L, std::plus<long>(),
+                                                                [](int value) {return static_cast<long>(value);});
+        });
+        size_t found = 0;
+        auto find = best_time([&]() {
+            found = snapshot_container::parallel_find_if(pool, snapshot, [last](int value) {return value == last;}) -
+                    snapshot.begin();
+        });
+
+        if (sum != expected || snapshot[found] != last)
+            std::cerr << "Mismatched results" << std::endl;
+        std::cout << num_threads << "\t" << reduce << "\t" << sequential / reduce << "\t" << find << "\t"
+                  << sequential / find << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2019 Kuberan Naganathan
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+// Measures reader scalability of snapshot_publisher against a mutex protected snapshot. A writer thread appends to a
+// container and publishes a snapshot every publish_interval appends while reader threads acquire the latest snapshot
+// in a loop. Reports acquisitions per second per reader for 1, 2, 4, ... up to the number of hardware threads.
+
+#include "snapshot_container.h"
+#include "snapshot_publisher.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+using container_t = snapshot_container::container<int>;
+using snapshot_t = container_t::snapshot_t;
+
+static const size_t publish_interval = 1000;
+static const auto run_time = std::chrono::milliseconds(500);
+
+
+// Readers coordinating with the writer via a mutex, which is what snapshot_publisher replaces.
+struct locked_publisher
+{
+    struct reader_handle
+    {
+        snapshot_t acquire() const
+        {
+            std::lock_guard<std::mutex> lock(m_publisher.m_mutex);
+            return m_publisher.m_current;
+        }
+
+        locked_publisher& m_publisher;
+    };
+
+    reader_handle reader()
+    {
+        return reader_handle{*this};
+    }
+
+    void publish(container_t& container)
+    {
+        container.set_append_in_place(false);
+        auto snapshot = container.create_snapshot();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_current = snapshot;
+    }
+
+    std::mutex m_mutex;
+    snapshot_t m_current;
+};
+
+
+template <typename Publisher>
+double run(size_t num_readers)
+{
+    Publisher publisher;
+    container_t container;
+    std::atomic<bool> done {false};
+    std::atomic<size_t> total_acquired {0};
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < num_readers; ++i)
+    {
+        readers.emplace_back([&]() {
+            auto reader = publisher.reader();
+            size_t acquired = 0;
+            size_t observed = 0;
+            while (!done.load(std::memory_order_relaxed))
+            {
+                observed += reader.acquire().size();
+                ++acquired;
+            }
+            total_acquired += acquired;
+            if (observed == 0)
+                std::cerr << "No snapshots observed" << std::endl;
+        });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int value = 0;
+    while (std::chrono::steady_clock::now() - start < run_time)
+    {
+        for (size_t i = 0; i < publish_interval; ++i)
+            container.push_back(value++);
+        publisher.publish(container);
+    }
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return total_acquired.load() / seconds / num_readers;
+}
+
+
+int main()
+{
+    size_t max_readers = std::max(2u, std::thread::hardware_concurrency());
+    std::cout << "readers\tpublisher acquires/s/reader\tmutex acquires/s/reader" << std::endl;
+    for (size_t num_readers = 1; num_readers <= max_readers; num_readers *= 2)
+    {
+        auto lock_free = run<snapshot_container::snapshot_publisher<snapshot_t>>(num_readers);
+        auto locked = run<locked_publisher>(num_readers);
+        std::cout << num_readers << "\t" << lock_free << "\t" << locked << std::endl;
+    }
+    return 0;
+}
@@ -22,10 +22,21 @@
  * THE SOFTWARE.
  */
 
+// Simulates workloads against the iterator kernel of a container with a snapshot and reports slice counts, cow
+// statistics and the latency of each type of operation. Workloads are random mixes of operations given by a profile
+// (see profiles below). The operations run may be recorded to a trace file and replayed exactly.
+//
+// Usage: slice_simulation [btree] [--profile name] [--ops n] [--seed n] [--record file] [--replay file] [--profiles]
+
 #include "snapshot_storage.h"
 #include "snapshot_iterator.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <memory>
 #include <map>
+#include <string>
 #include <vector>
 #include <iostream>
 #include <random>
@@ -34,16 +45,26 @@
 
 using snapshot_container::_iterator_kernel;
 using snapshot_container::deque_storage_creator;
-using snapshot_container::_iterator;
-typedef _iterator_kernel<int, deque_storage_creator<int>> ikernel;
+
+template <typename BaseTraits>
+struct sim_config_traits : public BaseTraits
+{
+    static constexpr bool collect_stats = true;
+};
+
+typedef _iterator_kernel<int, deque_storage_creator<int>,
+                         sim_config_traits<snapshot_container::_iterator_kernel_config_traits>> ikernel;
+typedef _iterator_kernel<int, deque_storage_creator<int>,
+                         sim_config_traits<snapshot_container::_btree_iterator_kernel_config_traits>> btree_ikernel;
 
 
+template <typename Kernel>
 auto test_ik_creator(size_t num_slices, size_t num_values_per_slice)
 {
     deque_storage_creator<int> storage_creator;
     std::vector<int> test_values(num_values_per_slice * num_slices);
     std::iota(test_values.begin(), test_values.end(), 0);    
-    auto ik = ikernel::create(storage_creator);
+    auto ik = Kernel::create(storage_creator);
     
     
     for (auto i = 0; i < num_slices; ++i)
@@ -56,7 +77,8 @@ auto test_ik_creator(size_t num_slices, size_t num_values_per_slice)
 
 struct slice_stats
 {
-    slice_stats(const std::shared_ptr<ikernel>& ik):
+    template <typename Kernel>
+    slice_stats(const std::shared_ptr<Kernel>& ik):
     m_min(ik->num_slices()),
     m_max(ik->num_slices()),
     m_total(0),
@@ -65,7 +87,8 @@ struct slice_stats
         
     }
     
-    void record(const std::shared_ptr<ikernel>& ik)
+    template <typename Kernel>
+    void record(const std::shared_ptr<Kernel>& ik)
     {
         m_count += 1;
         auto current_num_slices = ik->num_slices();
@@ -104,119 +127,463 @@ struct slice_stats
 };
 
 
+enum sim_op
+{
+    op_insert,      // insert a block of values
+    op_remove,      // remove a range
+    op_iterate,     // dereference a range with a non-const iterator
+    op_read,        // read a range with a const iterator
+    op_write,       // assign a range through a non-const iterator
+    op_append,      // push_back a block of values
+    op_trim,        // remove a range from the front
+    op_snapshot,    // replace the latest snapshot
+    num_sim_ops
+};
+
+static const char* const sim_op_names[num_sim_ops] = {
+    "insert", "remove", "iterate", "read", "write", "append", "trim", "snapshot"
+};
+
+
+// A single operation. Positions and counts are computed when the operation is generated so that traces replay exactly.
+struct sim_action
+{
+    sim_op m_op;
+    size_t m_position;
+    size_t m_count;
+};
+
+
+struct workload_profile
+{
+    const char* m_name;
+    const char* m_description;
+    double m_weights[num_sim_ops];  // relative frequencies of the operations
+    size_t m_snapshot_interval;     // a snapshot is taken every this many operations. 0 for none
+    double m_hotspot_size;          // fraction of the container in its middle which receives
+    double m_hotspot_share;         // this fraction of the positioned operations
+};
+
+static const workload_profile profiles[] = {
+    {"uniform", "inserts, removes and iteration at uniformly random positions",
+     {1, 1, 1, 0, 0, 0, 0, 0}, 0, 1.0, 1.0},
+    {"append_log", "push_back heavy log with occasional scans and frequent snapshots",
+     {0, 0, 0, 1, 0, 8, 0, 0}, 100, 1.0, 1.0},
+    {"hotspot", "inserts, removes and writes concentrated in 5% of the container",
+     {2, 2, 0, 0, 1, 0, 0, 0}, 1000, 0.05, 0.9},
+    {"window", "sliding window: push_back at the back and trimming from the front",
+     {0, 0, 0, 1, 0, 4, 2, 0}, 50, 1.0, 1.0},
+    {"snapshot_every_n", "the uniform mix with a snapshot every 10 operations",
+     {1, 1, 1, 0, 0, 0, 0, 0}, 10, 1.0, 1.0},
+    {"write_through", "writes through iterators with some inserts and removes",
+     {1, 1, 0, 0, 4, 0, 0, 0}, 100, 1.0, 1.0},
+};
+
+
+const workload_profile* find_profile(const std::string& name)
+{
+    for (auto& profile: profiles)
+    {
+        if (name == profile.m_name)
+            return &profile;
+    }
+    return nullptr;
+}
+
+
+// Generates the operations of a profile.
+class action_generator
+{
+public:
+
+    action_generator(const workload_profile& profile, unsigned seed):
+    m_profile(profile),
+    m_generator(seed),
+    m_op_distribution(std::begin(profile.m_weights), std::end(profile.m_weights))
+    {
+    }
+
+    sim_action next(size_t ik_size)
+    {
+        m_count += 1;
+        if (m_profile.m_snapshot_interval && m_count % (m_profile.m_snapshot_interval + 1) == 0)
+            return sim_action{op_snapshot, 0, 0};
+
+        auto op = static_cast<sim_op>(m_op_distribution(m_generator));
+        if (ik_size == 0 && op != op_insert && op != op_append)
+            op = op_append;
+
+        switch (op)
+        {
+        case op_insert:
+            return sim_action{op, ik_size ? position(ik_size) : 0, ik_size > 1000 ? ik_size / 100 : 10};
+        case op_remove:
+            // This removes on average less than the insertions so the container's size should increase
+            return ranged_action(op, ik_size, ik_size > 1000 ? ik_size / 110 : 5);
+        case op_iterate:
+        case op_read:
+            return ranged_action(op, ik_size, ik_size > 1000 ? ik_size / 5 : 200);
+        case op_write:
+            return ranged_action(op, ik_size, ik_size > 1000 ? ik_size / 50 : 20);
+        case op_append:
+            return sim_action{op, ik_size, 64};
+        case op_trim:
+            return sim_action{op, 0, std::min<size_t>(ik_size, ik_size > 1000 ? ik_size / 400 : 1)};
+        default:
+            return sim_action{op_snapshot, 0, 0};
+        }
+    }
+
+private:
+
+    sim_action ranged_action(sim_op op, size_t ik_size, size_t max_count)
+    {
+        auto start = position(ik_size);
+        return sim_action{op, start, std::min(max_count, ik_size - start)};
+    }
+
+    size_t position(size_t ik_size)
+    {
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        if (m_profile.m_hotspot_size < 1.0 && unit(m_generator) < m_profile.m_hotspot_share)
+        {
+            auto hotspot_size = std::max<size_t>(size_t(ik_size * m_profile.m_hotspot_size), 1);
+            auto hotspot_start = (ik_size - hotspot_size) / 2;
+            return hotspot_start + m_generator() % hotspot_size;
+        }
+        return m_generator() % ik_size;
+    }
+
+    const workload_profile& m_profile;
+    std::default_random_engine m_generator;
+    std::discrete_distribution<size_t> m_op_distribution;
+    size_t m_count = 0;
+};
+
+
+// Trace files hold a header line with the initial kernel layout followed by one line per operation:
+//   slice_simulation_trace <slice size> <num slices>
+//   <op name> <position> <count>
+void write_trace_header(std::ostream& trace, size_t slice_size, size_t num_slices)
+{
+    trace << "slice_simulation_trace " << slice_size << " " << num_slices << "\n";
+}
+
+void write_trace_action(std::ostream& trace, const sim_action& action)
+{
+    trace << sim_op_names[action.m_op] << " " << action.m_position << " " << action.m_count << "\n";
+}
+
+bool read_trace_action(std::istream& trace, sim_action& action)
+{
+    std::string name;
+    if (!(trace >> name >> action.m_position >> action.m_count))
+        return false;
+
+    auto op = std::find(std::begin(sim_op_names), std::end(sim_op_names), name);
+    if (op == std::end(sim_op_names))
+    {
+        std::cerr << "Unknown operation in trace: " << name << std::endl;
+        std::terminate();
+    }
+    action.m_op = static_cast<sim_op>(op - std::begin(sim_op_names));
+    return true;
+}
+
+
+struct latency_stats
+{
+    void record(sim_op op, uint64_t nanoseconds)
+    {
+        m_latencies[op].push_back(nanoseconds);
+    }
+
+    void display_stats()
+    {
+        std::cout << "Latency (ns):" << std::endl;
+        std::cout << "op\tcount\tp50\tp90\tp99\tp99.9\tmax" << std::endl;
+        for (size_t op = 0; op < num_sim_ops; ++op)
+        {
+            auto& latencies = m_latencies[op];
+            if (latencies.empty())
+                continue;
+
+            std::sort(latencies.begin(), latencies.end());
+            auto percentile = [&latencies](double fraction) {
+                return latencies[std::min(latencies.size() - 1, size_t(fraction * latencies.size()))];
+            };
+            std::cout << sim_op_names[op] << "\t" << latencies.size() << "\t" << percentile(0.5) << "\t"
+                      << percentile(0.9) << "\t" << percentile(0.99) << "\t" << percentile(0.999) << "\t"
+                      << latencies.back() << std::endl;
+        }
+    }
+
+    std::vector<uint64_t> m_latencies[num_sim_ops];
+};
+
+
+void display_kernel_stats(const snapshot_container::kernel_stats& stats)
+{
+    auto display_copies = [](const char* path, const snapshot_container::cow_copy_stats& copies) {
+        std::cout << path << " cow copies: " << copies.m_copies << " elements: " << copies.m_elements
+                  << " bytes: " << copies.m_bytes << std::endl;
+    };
+    display_copies("Iteration", stats.m_iteration_copies);
+    display_copies("Insert", stats.m_insert_copies);
+    display_copies("Remove", stats.m_remove_copies);
+    std::cout << "Slices created: " << stats.m_slices_created << " merged: " << stats.m_slices_merged
+              << " dropped: " << stats.m_slices_dropped << std::endl;
+    std::cout << "Lookups fast: " << stats.m_fast_lookups << " binary: " << stats.m_binary_lookups << std::endl;
+    std::cout << "Storage allocations: " << stats.m_storage_allocations << std::endl;
+}
+
+
+template <typename Kernel>
 struct IKSimRunner
-{            
-    void insert_action(std::shared_ptr<ikernel>& ik, 
-                       std::default_random_engine& generator,
-                       std::uniform_int_distribution<size_t>& distrib)
-    {
-        auto ik_size = ik->size();
-        auto num_items_to_insert = ik_size > 1000 ? ik_size / 100 : 10;        
-        if (m_items_to_insert.size() < num_items_to_insert)
+{
+    IKSimRunner(size_t slice_size, size_t num_slices):
+    m_ik(test_ik_creator<Kernel>(num_slices, slice_size)),
+    m_initial_snapshot(Kernel::create(m_ik)), // this is a snapshot. This turns on the copy on write logic.
+    m_stats(m_ik)
+    {
+    }
+
+    void insert_action(const sim_action& action)
+    {
+        if (m_items_to_insert.size() < action.m_count)
         {
-            m_items_to_insert.resize(num_items_to_insert, 0xdeadbeef);
+            m_items_to_insert.resize(action.m_count, 0xdeadbeef);
         }
-        
+
         auto impl = virtual_iter::std_iter_impl_creator::create(m_items_to_insert);
         virtual_iter::rand_iter<int, 48> itr (impl, m_items_to_insert.begin());
-        virtual_iter::rand_iter<int, 48> end_itr (impl, m_items_to_insert.end());
-        auto insert_index = distrib(generator) % ik_size;
-        if (std::distance(itr, end_itr) != m_items_to_insert.size())
+        virtual_iter::rand_iter<int, 48> end_itr (impl, m_items_to_insert.begin() + action.m_count);
+        if (std::distance(itr, end_itr) != action.m_count)
         {
             std::cerr << "Detected problem w/ forward iterator: " << end_itr - itr << std::endl;
             std::terminate();
         }
-        
-        auto insert_slice_point = ik->slice_index(insert_index);
-        ik->insert(insert_slice_point, itr, end_itr);
+
+        auto insert_slice_point = m_ik->slice_index(std::min(action.m_position, m_ik->size()));
+        m_ik->insert(insert_slice_point, itr, end_itr);
     }
-    
-    void remove_action(std::shared_ptr<ikernel>& ik, 
-                       std::default_random_engine& generator,
-                       std::uniform_int_distribution<size_t>& distrib)
-    {
-        auto ik_size = ik->size();
-        // This removes on average less than the insertions so the container's size should increase
-        auto max_items_to_remove = ik_size > 1000 ? ik_size / 110 : 5;
-        size_t remove_start = distrib(generator) % ik_size;
-        size_t remove_end = (remove_start + max_items_to_remove) < ik_size ? (max_items_to_remove + remove_start) : ik_size;
-        if (remove_end > ik_size)
-        {
-            std::cerr << "Invalid endpos: items to remove " << max_items_to_remove << " index: " << remove_start << std::endl;
-        }
-        ik->remove(ik->slice_index(remove_start), ik->slice_index(remove_end));
+
+    void remove_action(const sim_action& action)
+    {
+        auto range = clamp(action);
+        m_ik->remove(m_ik->slice_index(range.first), m_ik->slice_index(range.second));
     }
-    
-    void iter_action(std::shared_ptr<ikernel>& ik, 
-                     std::default_random_engine& generator,
-                     std::uniform_int_distribution<size_t>& distrib)
-    {
-        auto ik_size = ik->size();        
-        auto max_iteration_length = ik_size > 1000 ? ik_size / 5 : 200;
-        auto iter_start = distrib(generator) % ik_size;
-        auto iter_end = iter_start + max_iteration_length < ik_size ? iter_start + max_iteration_length : ik_size;        
-        // std::cerr << "Iterating from " << iter_start << " to " << iter_end << " total size: " << ik_size << std::endl;
-        
-        _iterator<int, deque_storage_creator<int>> current_pos(ik, iter_start);
-        _iterator<int, deque_storage_creator<int>> end_pos(ik, iter_end);
+
+    void iter_action(const sim_action& action)
+    {
+        auto range = clamp(action);
+        typename Kernel::iterator current_pos(m_ik, range.first);
+        typename Kernel::iterator end_pos(m_ik, range.second);
         for(; current_pos < end_pos; ++current_pos)
-            *current_pos;        
+            *current_pos;
     }
-    
-    typedef void (IKSimRunner::*action_functions)(std::shared_ptr<ikernel>&, std::default_random_engine&, 
-                  std::uniform_int_distribution<size_t>&);
-    
-    // TODO: Add more plausible action types
-    slice_stats run(size_t slice_size=2048, size_t num_slices=1, size_t num_iterations=1000000);
 
-    std::vector<int> m_items_to_insert;
-};
+    void read_action(const sim_action& action)
+    {
+        auto range = clamp(action);
+        typename Kernel::const_iterator current_pos(m_ik, range.first);
+        typename Kernel::const_iterator end_pos(m_ik, range.second);
+        for(; current_pos < end_pos; ++current_pos)
+            m_checksum += *current_pos;
+    }
 
+    void write_action(const sim_action& action)
+    {
+        auto range = clamp(action);
+        typename Kernel::iterator current_pos(m_ik, range.first);
+        typename Kernel::iterator end_pos(m_ik, range.second);
+        for(; current_pos < end_pos; ++current_pos)
+            *current_pos = static_cast<int>(action.m_position);
+    }
 
-slice_stats IKSimRunner::run(size_t slice_size, size_t num_slices, size_t num_iterations)
-{
-    if (slice_size < 500)
-        slice_size = 500;
+    void append_action(const sim_action& action)
+    {
+        for (size_t i = 0; i < action.m_count; ++i)
+            m_ik->push_back(static_cast<int>(i));
+    }
 
-    auto ik = test_ik_creator(num_slices, slice_size);
-    auto ik2 = ikernel::create(ik); // this is a snapshot. This turns on the copy on write logic.
-    auto stats = slice_stats(ik);
+    void trim_action(const sim_action& action)
+    {
+        auto range = clamp(sim_action{op_trim, 0, action.m_count});
+        m_ik->remove(m_ik->slice_index(range.first), m_ik->slice_index(range.second));
+    }
 
-    std::default_random_engine generator;
-    generator.seed(std::time(nullptr));        
-    std::uniform_int_distribution<size_t> distribution(0,2);
-    std::uniform_int_distribution<size_t> action_distribution(0, 4294967295);
+    void snapshot_action(const sim_action&)
+    {
+        m_latest_snapshot = Kernel::create(m_ik);
+    }
 
-    IKSimRunner::action_functions action_table[] = {&IKSimRunner::insert_action, &IKSimRunner::remove_action, &IKSimRunner::iter_action};
+    typedef void (IKSimRunner::*action_functions)(const sim_action&);
 
-    for(auto i = 0; i < num_iterations; ++i)
+    // Runs action, timing it, and checks the kernel's integrity every 1000 actions.
+    void apply(const sim_action& action)
     {
-        auto action = distribution(generator);
-        (this->*action_table[action])(ik, generator, action_distribution);
+        static const action_functions action_table[num_sim_ops] = {
+            &IKSimRunner::insert_action, &IKSimRunner::remove_action, &IKSimRunner::iter_action,
+            &IKSimRunner::read_action, &IKSimRunner::write_action, &IKSimRunner::append_action,
+            &IKSimRunner::trim_action, &IKSimRunner::snapshot_action};
 
-        
-        stats.record(ik);
-                   
-        if ((i + 1) % 1000 == 0)
+        auto start = std::chrono::steady_clock::now();
+        (this->*action_table[action.m_op])(action);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        m_latency.record(action.m_op, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+
+        m_stats.record(m_ik);
+        if (++m_num_actions % 1000 == 0)
         {
-            if (!ik->integrity_check())
+            if (!m_ik->integrity_check())
             {
-                std::cerr << "Integrity check failed after " << i << " iterations at op type " << action << std::endl;
+                std::cerr << "Integrity check failed after " << m_num_actions << " iterations at op type "
+                          << sim_op_names[action.m_op] << std::endl;
                 std::terminate();
             }
-            
-            std::cerr << "Size = " << ik->size() << " num slices: " << ik->m_slices.size() << std::endl;
+
+            std::cerr << "Size = " << m_ik->size() << " num slices: " << m_ik->num_slices() << std::endl;
         }
     }
 
-    return stats;
-}
+    void run(const workload_profile& profile, size_t num_iterations, unsigned seed, std::ostream* trace)
+    {
+        action_generator generator(profile, seed);
+        for (size_t i = 0; i < num_iterations; ++i)
+        {
+            auto action = generator.next(m_ik->size());
+            apply(action);
+            if (trace)
+                write_trace_action(*trace, action);
+        }
+    }
 
+    void replay(std::istream& trace)
+    {
+        sim_action action;
+        while (read_trace_action(trace, action))
+            apply(action);
+    }
 
-int main()
+    void display_stats()
+    {
+        m_stats.display_stats();
+        display_kernel_stats(m_ik->stats());
+        m_latency.display_stats();
+    }
+
+    // The range of action within the current kernel. Ranges of traces replayed against other kernel variants may
+    // extend past the end.
+    std::pair<size_t, size_t> clamp(const sim_action& action) const
+    {
+        auto size = m_ik->size();
+        auto start = std::min(action.m_position, size);
+        return std::make_pair(start, start + std::min(action.m_count, size - start));
+    }
+
+    std::shared_ptr<Kernel> m_ik;
+    std::shared_ptr<Kernel> m_initial_snapshot;
+    std::shared_ptr<Kernel> m_latest_snapshot;
+    slice_stats m_stats;
+    latency_stats m_latency;
+    std::vector<int> m_items_to_insert;
+    size_t m_num_actions = 0;
+    long m_checksum = 0;
+};
+
+
+struct sim_options
+{
+    bool m_btree = false;
+    std::string m_profile = "uniform";
+    size_t m_num_iterations = 20000;
+    unsigned m_seed = static_cast<unsigned>(std::time(nullptr));
+    std::string m_record_file;
+    std::string m_replay_file;
+    size_t m_slice_size = 2048;
+    size_t m_num_slices = 2;
+};
+
+
+template <typename Kernel>
+int simulate(const sim_options& options)
 {
-    IKSimRunner runner;
-    auto results = runner.run(2048, 2, 20000);    
-    results.display_stats();    
+    if (!options.m_replay_file.empty())
+    {
+        std::ifstream trace(options.m_replay_file);
+        std::string header;
+        size_t slice_size = 0;
+        size_t num_slices = 0;
+        if (!(trace >> header >> slice_size >> num_slices) || header != "slice_simulation_trace")
+        {
+            std::cerr << "Not a slice_simulation trace: " << options.m_replay_file << std::endl;
+            return 1;
+        }
+
+        IKSimRunner<Kernel> runner(slice_size, num_slices);
+        runner.replay(trace);
+        runner.display_stats();
+        return 0;
+    }
+
+    auto profile = find_profile(options.m_profile);
+    if (!profile)
+    {
+        std::cerr << "Unknown profile: " << options.m_profile << std::endl;
+        return 1;
+    }
+
+    std::ofstream trace;
+    if (!options.m_record_file.empty())
+    {
+        trace.open(options.m_record_file);
+        write_trace_header(trace, options.m_slice_size, options.m_num_slices);
+    }
+
+    std::cout << "Profile: " << profile->m_name << " seed: " << options.m_seed << std::endl;
+    IKSimRunner<Kernel> runner(options.m_slice_size, options.m_num_slices);
+    runner.run(*profile, options.m_num_iterations, options.m_seed, trace.is_open() ? &trace : nullptr);
+    runner.display_stats();
     return 0;
 }
+
+
+int main(int argc, char** argv)
+{
+    sim_options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto has_value = i + 1 < argc;
+        // Pass "btree" to run the simulation against the B+tree slice table variant of the kernel.
+        if (arg == "btree")
+            options.m_btree = true;
+        else if (arg == "--profile" && has_value)
+            options.m_profile = argv[++i];
+        else if (arg == "--ops" && has_value)
+            options.m_num_iterations = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--seed" && has_value)
+            options.m_seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--record" && has_value)
+            options.m_record_file = argv[++i];
+        else if (arg == "--replay" && has_value)
+            options.m_replay_file = argv[++i];
+        else if (arg == "--profiles")
+        {
+            for (auto& profile: profiles)
+                std::cout << profile.m_name << ": " << profile.m_description << std::endl;
+            return 0;
+        }
+        else
+        {
+            std::cerr << "Usage: slice_simulation [btree] [--profile name] [--ops n] [--seed n] [--record file] "
+                         "[--replay file] [--profiles]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.m_btree)
+        return simulate<btree_ikernel>(options);
+    return simulate<ikernel>(options);
+}
@@ -0,0 +1,274 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "snapshot_storage.h"
+
+
+namespace snapshot_container
+{
+    // Monoids for aggregate_cache. A monoid provides
+    //   typedef ... value_type;
+    //   value_type identity() const;
+    //   value_type operator()(const value_type& lhs, const value_type& rhs) const;   // associative
+    //   value_type operator()(const segment<T>& elements) const;                     // summary of contiguous elements
+    template <typename T>
+    struct sum_monoid
+    {
+        typedef T value_type;
+
+        value_type identity() const {return value_type();}
+        value_type operator()(const value_type& lhs, const value_type& rhs) const {return lhs + rhs;}
+
+        value_type operator()(const segment<T>& elements) const
+        {
+            value_type result = identity();
+            for (auto& element: elements)
+                result += element;
+            return result;
+        }
+    };
+
+
+    template <typename T>
+    struct min_monoid
+    {
+        typedef T value_type;
+
+        value_type identity() const {return std::numeric_limits<T>::max();}
+        value_type operator()(const value_type& lhs, const value_type& rhs) const {return std::min(lhs, rhs);}
+
+        value_type operator()(const segment<T>& elements) const
+        {
+            return elements.empty() ? identity() : *std::min_element(elements.begin(), elements.end());
+        }
+    };
+
+
+    template <typename T>
+    struct max_monoid
+    {
+        typedef T value_type;
+
+        value_type identity() const {return std::numeric_limits<T>::lowest();}
+        value_type operator()(const value_type& lhs, const value_type& rhs) const {return std::max(lhs, rhs);}
+
+        value_type operator()(const segment<T>& elements) const
+        {
+            return elements.empty() ? identity() : *std::max_element(elements.begin(), elements.end());
+        }
+    };
+
+
+    // Memoizes summaries of ranges of storage elements so that reductions over snapshots which share most of their
+    // storage, e.g. successive snapshots of a container, only summarize elements which are new. Summaries are kept
+    // per slice and per aligned block of BlockSize elements of each storage element so they remain usable after cow
+    // ops split the slices referencing them. A reduction costs O(slices touched) when the slices have been seen
+    // before plus O(BlockSize) per new slice and O(BlockSize) at each end of a partial slice.
+    //
+    // The cache keeps a reference to each storage element it summarizes. Containers never modify shared storage in
+    // place, so the summarized elements cannot change while the cache holds them. As a consequence writes to a
+    // container after it is reduced are copy on write, with the same write amplification as following a snapshot,
+    // for as long as the cache holds the storage. Caches used to reduce containers which are then written heavily
+    // should be cleared first. trim() releases storage referenced only by the cache and runs automatically as the
+    // cache grows. Not thread safe.
+    template <typename T, typename Monoid, size_t BlockSize = 256>
+    class aggregate_cache
+    {
+    public:
+
+        typedef typename Monoid::value_type value_type;
+
+        explicit aggregate_cache(const Monoid& monoid = Monoid()):
+            m_monoid(monoid)
+        {}
+
+        // Reduces the elements [first, last) of kernel.
+        template <typename Kernel>
+        value_type reduce(const Kernel& kernel, size_t first, size_t last)
+        {
+            auto result = m_monoid.identity();
+            if (last > kernel.size())
+                last = kernel.size();
+            if (first >= last)
+                return result;
+
+            auto& slices = kernel.slices();
+            auto pos = kernel.slice_index(first);
+            size_t remaining = last - first;
+            for (size_t slice = pos.slice(), index = pos.index(); remaining > 0; ++slice, index = 0)
+            {
+                auto& current_slice = slices[slice];
+                auto length = std::min(current_slice.size() - index, remaining);
+                if (length == 0)
+                    continue;
+
+                auto whole_slice = index == 0 && length == current_slice.size();
+                auto start = current_slice.m_start_index + index;
+                result = m_monoid(result, _summarize(current_slice.m_storage, start, start + length, whole_slice));
+                remaining -= length;
+            }
+            return result;
+        }
+
+        // Releases storage elements referenced only by the cache. Returns the number still referenced.
+        size_t trim()
+        {
+            for (auto itr = m_entries.begin(); itr != m_entries.end();)
+            {
+                if (itr->second.m_storage->use_count() == 1)
+                    itr = m_entries.erase(itr);
+                else
+                    ++itr;
+            }
+            m_trim_size = std::max(_min_trim_size, 2 * m_entries.size());
+            return m_entries.size();
+        }
+
+        void clear()
+        {
+            m_entries.clear();
+            m_trim_size = _min_trim_size;
+        }
+
+        // Number of storage elements referenced by the cache.
+        size_t size() const
+        {
+            return m_entries.size();
+        }
+
+    private:
+
+        static constexpr size_t _min_trim_size = 64;
+
+        struct _range_hash
+        {
+            size_t operator()(const std::pair<size_t, size_t>& range) const
+            {
+                return std::hash<size_t>()(range.first * 31 + range.second);
+            }
+        };
+
+        // A reference to a storage element through the handle type of the slices referring to it, which depends on
+        // the config traits of the kernel reduced.
+        struct _storage_ref
+        {
+            virtual ~_storage_ref() = default;
+            virtual long use_count() const = 0;
+        };
+
+        template <typename Handle>
+        struct _storage_handle_ref final : public _storage_ref
+        {
+            explicit _storage_handle_ref(const Handle& handle):
+                m_handle(handle)
+            {}
+
+            long use_count() const override {return m_handle.use_count();}
+
+            Handle m_handle;
+        };
+
+        struct _entry
+        {
+            std::unique_ptr<_storage_ref> m_storage;
+            std::vector<value_type> m_blocks;
+            std::vector<bool> m_block_valid;
+            std::unordered_map<std::pair<size_t, size_t>, value_type, _range_hash> m_ranges;
+        };
+
+        // Summary of the elements [start, end) of storage. Memoized if memoize is set.
+        template <typename Handle>
+        value_type _summarize(const Handle& storage, size_t start, size_t end, bool memoize)
+        {
+            auto& entry = _entry_for(storage);
+            auto range = std::make_pair(start, end);
+            if (memoize)
+            {
+                auto found = entry.m_ranges.find(range);
+                if (found != entry.m_ranges.end())
+                    return found->second;
+            }
+
+            auto result = m_monoid.identity();
+            auto first_block = (start + BlockSize - 1) / BlockSize;
+            auto last_block = end / BlockSize;
+            if (first_block >= last_block)
+            {
+                result = _summarize_elements(*storage, start, end);
+            }
+            else
+            {
+                result = _summarize_elements(*storage, start, first_block * BlockSize);
+                for (auto block = first_block; block < last_block; ++block)
+                    result = m_monoid(result, _block_summary(entry, *storage, block));
+                result = m_monoid(result, _summarize_elements(*storage, last_block * BlockSize, end));
+            }
+
+            if (memoize)
+                entry.m_ranges.emplace(range, result);
+            return result;
+        }
+
+        template <typename Storage>
+        value_type _block_summary(_entry& entry, const Storage& storage, size_t block)
+        {
+            if (block >= entry.m_blocks.size())
+            {
+                entry.m_blocks.resize(block + 1, m_monoid.identity());
+                entry.m_block_valid.resize(block + 1, false);
+            }
+
+            if (!entry.m_block_valid[block])
+            {
+                entry.m_blocks[block] = _summarize_elements(storage, block * BlockSize, (block + 1) * BlockSize);
+                entry.m_block_valid[block] = true;
+            }
+            return entry.m_blocks[block];
+        }
+
+        template <typename Storage>
+        value_type _summarize_elements(const Storage& storage, size_t start, size_t end) const
+        {
+            auto result = m_monoid.identity();
+            while (start < end)
+            {
+                auto elements = storage.contiguous_segment(start, end);
+                result = m_monoid(result, m_monoid(elements));
+                start += elements.size();
+            }
+            return result;
+        }
+
+        template <typename Handle>
+        _entry& _entry_for(const Handle& storage)
+        {
+            auto found = m_entries.find(storage.get());
+            if (found != m_entries.end())
+                return found->second;
+
+            if (m_entries.size() >= m_trim_size)
+                trim();
+            auto& entry = m_entries[storage.get()];
+            entry.m_storage.reset(new _storage_handle_ref<Handle>(storage));
+            return entry;
+        }
+
+        Monoid m_monoid;
+        std::unordered_map<const void*, _entry> m_entries;
+        size_t m_trim_size = _min_trim_size;
+    };
+}
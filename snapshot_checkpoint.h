@@ -0,0 +1,242 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+#include "snapshot_serialization.h"
+
+
+namespace snapshot_container
+{
+    // Checkpoints are numbered files in a directory. A chain of checkpoints is a single snapshot_writer stream split
+    // across files, one snapshot per file, so a checkpoint only holds the elements which are new since the previous
+    // checkpoint of its chain plus the slice table of its snapshot. The first checkpoint of a chain holds the stream
+    // header. Each checkpoint_writer starts a new chain since storage ids are only unique within a process.
+    struct _checkpoint_files
+    {
+        static std::string path(const std::string& directory, size_t checkpoint)
+        {
+            return directory + "/checkpoint_" + std::to_string(checkpoint);
+        }
+
+        // Number of checkpoints in directory. Checkpoints are numbered consecutively from 0.
+        static size_t count(const std::string& directory)
+        {
+            size_t result = 0;
+            while (access(path(directory, result).c_str(), F_OK) == 0)
+                ++result;
+            return result;
+        }
+
+        // True if checkpoint starts a chain.
+        static bool starts_chain(const std::string& directory, size_t checkpoint)
+        {
+            uint64_t magic = 0;
+            int fd = ::open(path(directory, checkpoint).c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "checkpoint: could not open checkpoint");
+            auto size_read = ::read(fd, &magic, sizeof(magic));
+            close(fd);
+            return size_read == sizeof(magic) && magic == _serialization_format::magic;
+        }
+    };
+
+
+    // Writes snapshots of a container as a chain of incremental checkpoints. Storage elements and index ranges
+    // already written by a previous checkpoint are not written again so the size of a checkpoint is roughly the size
+    // of the changes since the last checkpoint. The writer retains the last snapshot checkpointed so that the
+    // elements already written remain unchanged (see snapshot_writer).
+    //
+    // Each checkpoint is written to a temporary file, synced and then renamed into place so a checkpoint is either
+    // complete or absent after a crash.
+    template <typename Snapshot>
+    class checkpoint_writer
+    {
+    public:
+
+        explicit checkpoint_writer(const std::string& directory):
+            m_directory(directory),
+            m_next_checkpoint(_checkpoint_files::count(directory)),
+            m_writer(new writer_t(m_sink))
+        {}
+
+        // Writes snapshot as the next checkpoint. Returns the checkpoint number.
+        size_t checkpoint(const Snapshot& snapshot)
+        {
+            auto path = _checkpoint_files::path(m_directory, m_next_checkpoint);
+            auto temp_path = path + ".tmp";
+            int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "checkpoint_writer: could not create " + temp_path);
+
+            try
+            {
+                m_sink.m_fd = fd;
+                m_writer->write(snapshot);
+                if (fsync(fd) != 0)
+                    throw std::system_error(errno, std::generic_category(), "checkpoint_writer: fsync failed");
+                close(fd);
+                fd = -1;
+                if (rename(temp_path.c_str(), path.c_str()) != 0)
+                    throw std::system_error(errno, std::generic_category(), "checkpoint_writer: could not rename " + temp_path);
+            }
+            catch (...)
+            {
+                // The writer may have recorded elements which were not made durable. The next checkpoint starts a
+                // new chain.
+                if (fd >= 0)
+                    close(fd);
+                unlink(temp_path.c_str());
+                m_elements_written += m_writer->elements_written();
+                m_writer.reset(new writer_t(m_sink));
+                throw;
+            }
+
+            m_last_snapshot = snapshot;
+            return m_next_checkpoint++;
+        }
+
+        // Total number of elements written by this writer.
+        size_t elements_written() const
+        {
+            return m_elements_written + m_writer->elements_written();
+        }
+
+    private:
+
+        // Writes to the file of the current checkpoint.
+        struct _sink
+        {
+            void write(const iovec* iov, size_t count)
+            {
+                fd_sink(m_fd).write(iov, count);
+            }
+
+            int m_fd = -1;
+        };
+
+        typedef snapshot_writer<Snapshot, _sink> writer_t;
+
+        std::string m_directory;
+        size_t m_next_checkpoint;
+        _sink m_sink;
+        std::unique_ptr<writer_t> m_writer;
+        size_t m_elements_written = 0;
+        Snapshot m_last_snapshot;
+    };
+
+
+    // Reconstructs checkpointed snapshots. Loading a checkpoint reads the checkpoints of its chain up to it.
+    template <typename Snapshot>
+    class checkpoint_loader
+    {
+    public:
+
+        typedef typename Snapshot::storage_creator_t storage_creator_t;
+
+        checkpoint_loader(const std::string& directory, const storage_creator_t& storage_creator = storage_creator_t()):
+            m_directory(directory),
+            m_storage_creator(storage_creator)
+        {}
+
+        size_t size() const
+        {
+            return _checkpoint_files::count(m_directory);
+        }
+
+        Snapshot load(size_t checkpoint) const
+        {
+            if (checkpoint >= size())
+                throw std::out_of_range("checkpoint_loader: no such checkpoint");
+
+            auto first = checkpoint;
+            while (!_checkpoint_files::starts_chain(m_directory, first))
+            {
+                if (first == 0)
+                    throw std::runtime_error("checkpoint_loader: checkpoint chain has no start");
+                --first;
+            }
+
+            _source source(m_directory, first);
+            snapshot_reader<Snapshot, _source> reader(source, m_storage_creator);
+            Snapshot result;
+            for (auto current = first; current <= checkpoint; ++current)
+            {
+                if (!reader.read(result))
+                    throw std::runtime_error("checkpoint_loader: checkpoint is missing a snapshot");
+            }
+            return result;
+        }
+
+    private:
+
+        // Reads the checkpoint files of a chain in sequence as a single stream.
+        class _source
+        {
+        public:
+
+            _source(const std::string& directory, size_t first):
+                m_directory(directory),
+                m_next_checkpoint(first)
+            {}
+
+            ~_source()
+            {
+                if (m_fd >= 0)
+                    close(m_fd);
+            }
+
+            size_t read(void* data, size_t size)
+            {
+                size_t total = 0;
+                while (total < size)
+                {
+                    if (m_fd < 0 && !_open_next())
+                        break;
+
+                    auto size_read = fd_source(m_fd).read(static_cast<char*>(data) + total, size - total);
+                    total += size_read;
+                    if (total < size)
+                    {
+                        close(m_fd);
+                        m_fd = -1;
+                    }
+                }
+                return total;
+            }
+
+        private:
+
+            bool _open_next()
+            {
+                auto path = _checkpoint_files::path(m_directory, m_next_checkpoint);
+                m_fd = ::open(path.c_str(), O_RDONLY);
+                if (m_fd < 0)
+                    return false;
+                ++m_next_checkpoint;
+                return true;
+            }
+
+            std::string m_directory;
+            size_t m_next_checkpoint;
+            int m_fd = -1;
+        };
+
+        std::string m_directory;
+        storage_creator_t m_storage_creator;
+    };
+}
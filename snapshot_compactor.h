@@ -0,0 +1,216 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace snapshot_container
+{
+    // Compacts a container on a background thread. The writer thread calls poll() every so often. When the container
+    // has more than slice_threshold slices or its fragmentation_index exceeds max_fragmentation, poll takes a
+    // snapshot of the container and the background thread builds merged slices for the snapshot's runs of small slices
+    // (see _iterator_kernel::compaction_runs). A later poll splices the merged slices into the container. This only
+    // replaces slices which are still as they were in the snapshot so modifications made in the meantime are never
+    // lost. Only the splice, which does not copy elements, runs on the writer thread.
+    //
+    // While a compaction is in progress, appends to the container go to new storage since the background thread reads
+    // the storage of the snapshot (see set_append_in_place), and writes to elements of the snapshot are copy on write.
+    // A compactor must only be used with a single container and by a single thread. Call wait() before destroying the
+    // compactor to restore the container's append mode.
+    template <typename Container>
+    class background_compactor
+    {
+    public:
+
+        typedef typename Container::kernel_t kernel_t;
+        typedef typename Container::snapshot_t snapshot_t;
+        typedef typename kernel_t::slice_t slice_t;
+
+        static_assert(std::is_same<typename Container::shared_kernel_t, std::shared_ptr<kernel_t>>::value &&
+                      std::is_same<typename slice_t::shared_base_t, std::shared_ptr<typename slice_t::storage_t>>::value,
+                      "background_compactor: containers must share kernels and storage via std::shared_ptr");
+
+        explicit background_compactor(size_t slice_threshold = kernel_t::config_traits::num_slices_lwm / 2,
+                                      double max_fragmentation = 4.0,
+                                      size_t budget = kernel_t::npos):
+            m_slice_threshold(slice_threshold),
+            m_max_fragmentation(max_fragmentation),
+            m_budget(budget),
+            m_thread([this]() {_worker();})
+        {}
+
+        background_compactor(const background_compactor&) = delete;
+        background_compactor& operator=(const background_compactor&) = delete;
+
+        ~background_compactor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+        }
+
+        // Splices slices merged by a completed compaction into container and starts a new compaction if one is
+        // needed. Does not wait for a compaction in progress. Costs O(number of slices). Returns the number of slices
+        // removed from container.
+        size_t poll(Container& container)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_busy && !m_complete)
+                    return 0;
+            }
+
+            auto removed = _collect(container);
+            auto& kernel = *container.m_kernel;
+            auto num_slices = kernel.num_slices();
+            if (num_slices == m_unmergeable_slices ||
+                (num_slices <= m_slice_threshold && !(kernel.fragmentation_index() > m_max_fragmentation)))
+                return removed;
+
+            m_saved_append_in_place = kernel.append_in_place();
+            kernel.set_append_in_place(false);
+            m_num_slices = num_slices;
+            std::unique_ptr<snapshot_t> input(new snapshot_t(container.create_snapshot()));
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_input = std::move(input);
+                m_busy = true;
+            }
+            m_cv.notify_all();
+            return removed;
+        }
+
+        // Waits for a compaction in progress and splices its merged slices into container. Returns the number of
+        // slices removed from container.
+        size_t wait(Container& container)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this]() {return !m_busy || m_complete;});
+            }
+            return _collect(container);
+        }
+
+    private:
+
+        // Slices starting at m_first_slice (at m_container_index) in the snapshot to replace with m_merged.
+        struct _merge
+        {
+            size_t m_first_slice;
+            size_t m_container_index;
+            std::vector<slice_t> m_expected;
+            slice_t m_merged;
+        };
+
+        size_t _collect(Container& container)
+        {
+            std::vector<_merge> merges;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_complete)
+                    return 0;
+                merges = std::move(m_output);
+                // The input snapshot is released here rather than by the background thread. Otherwise the container
+                // could see its storage and slice table unshared, and modify them in place, without synchronizing
+                // with the background thread's reads of them.
+                m_output_input.reset();
+                m_busy = false;
+                m_complete = false;
+            }
+
+            auto& kernel = *container.m_kernel;
+            kernel.set_append_in_place(m_saved_append_in_place);
+            m_unmergeable_slices = merges.empty() ? m_num_slices : kernel_t::npos;
+
+            // Merges are spliced back to front so the slice indices of the remaining merges stay valid. A merge which
+            // is not at its snapshot slice index due to modifications elsewhere is looked up by container index.
+            size_t removed = 0;
+            for (auto merge = merges.rbegin(); merge != merges.rend(); ++merge)
+            {
+                auto spliced = kernel.replace_slices(merge->m_first_slice, merge->m_expected, merge->m_merged);
+                if (!spliced)
+                {
+                    auto pos = kernel.slice_index(merge->m_container_index);
+                    spliced = pos.valid() && pos.index() == 0 &&
+                              kernel.replace_slices(pos.slice(), merge->m_expected, merge->m_merged);
+                }
+                if (spliced)
+                    removed += merge->m_expected.size() - 1;
+            }
+            return removed;
+        }
+
+        std::vector<_merge> _merge_runs(const kernel_t& kernel) const
+        {
+            std::vector<_merge> result;
+            auto& slices = kernel.slices();
+            for (auto& run: kernel.compaction_runs(m_budget))
+            {
+                _merge merge{run.m_first_slice, slices.offset(run.m_first_slice), {},
+                             kernel.merged_slice(run.m_first_slice, run.m_last_slice)};
+                for (auto slice = run.m_first_slice; slice < run.m_last_slice; ++slice)
+                    merge.m_expected.push_back(slices[slice]);
+                result.push_back(std::move(merge));
+            }
+            return result;
+        }
+
+        void _worker()
+        {
+            while (true)
+            {
+                std::unique_ptr<snapshot_t> input;
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_cv.wait(lock, [this]() {return m_stop || m_input;});
+                    if (m_stop)
+                        return;
+                    input = std::move(m_input);
+                }
+
+                auto merges = _merge_runs(*input->m_kernel);
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_output = std::move(merges);
+                    m_output_input = std::move(input);
+                    m_complete = true;
+                }
+                m_cv.notify_all();
+            }
+        }
+
+        size_t m_slice_threshold;
+        double m_max_fragmentation;
+        size_t m_budget;
+
+        // Writer thread state
+        bool m_saved_append_in_place = true;
+        size_t m_num_slices = 0;                        // slices in the container when the compaction started
+        size_t m_unmergeable_slices = kernel_t::npos;   // slices in the container when nothing could be merged
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::unique_ptr<snapshot_t> m_input;
+        std::vector<_merge> m_output;
+        std::unique_ptr<snapshot_t> m_output_input;    // the snapshot m_output was built from
+        bool m_busy = false;        // a compaction has been started and not collected
+        bool m_complete = false;    // the compaction has completed
+        bool m_stop = false;
+        std::thread m_thread;
+    };
+}
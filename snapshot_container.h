@@ -22,7 +22,10 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE.
  */
+#include "snapshot_aggregate.h"
+#include "snapshot_diff.h"
 #include "snapshot_iterator.h"
+#include "snapshot_serialization.h"
 #include "virtual_iter.h"
 #include <iterator>
 
@@ -34,18 +37,25 @@ namespace snapshot_container
     template <typename T, typename StorageCreator=deque_storage_creator<T>, typename ConfigTraits=_iterator_kernel_config_traits>
     class snapshot;
 
+    template <typename T, typename StorageCreator, typename ConfigTraits>
+    std::vector<snapshot_edit> diff(const snapshot<T, StorageCreator, ConfigTraits>& older,
+                                    const snapshot<T, StorageCreator, ConfigTraits>& newer);
+
 
     template <typename T, typename StorageCreator=deque_storage_creator<T>, typename ConfigTraits=_iterator_kernel_config_traits>
     class container
     {
     public:
+        template <typename Container> friend class background_compactor;
         typedef StorageCreator storage_creator_t;
         typedef _iterator_kernel<T, StorageCreator, ConfigTraits> kernel_t;
         typedef typename kernel_t::fwd_iter_type fwd_iter_type;
         typedef typename kernel_t::rand_iter_type rand_iter_type;
         typedef typename kernel_t::iterator iterator;
         typedef typename kernel_t::const_iterator const_iterator;
-        typedef std::shared_ptr<kernel_t> shared_kernel_t;
+        typedef typename kernel_t::borrowed_iterator borrowed_iterator;
+        typedef typename kernel_t::borrowed_const_iterator borrowed_const_iterator;
+        typedef typename kernel_t::handle_t shared_kernel_t;
         typedef size_t size_type;
         typedef ssize_t difference_type;
         typedef T* pointer;
@@ -54,6 +64,7 @@ namespace snapshot_container
 
         typedef container<T, StorageCreator, ConfigTraits> container_t;
         typedef snapshot<T, StorageCreator, ConfigTraits> snapshot_t;
+        typedef typename kernel_t::segment_t segment_t;
 
         container():
             m_kernel(kernel_t::create(storage_creator_t()))
@@ -61,7 +72,7 @@ namespace snapshot_container
         }
 
         container(const storage_creator_t& creator):
-            m_kernel(kernel_t::create(storage_creator_t()))
+            m_kernel(kernel_t::create(creator))
         {
         }
 
@@ -106,6 +117,43 @@ namespace snapshot_container
         const_iterator cbegin() const {return const_iterator(m_kernel, 0);}
         const_iterator cend() const {return const_iterator(m_kernel, size());}
 
+        // Borrowed iterators do not share ownership of the container's internals so copying them is cheaper (e.g. in
+        // std algorithms). They must not be used once the container is destroyed.
+        borrowed_iterator borrowed_begin() {return borrowed_iterator(m_kernel.get(), 0);}
+        borrowed_iterator borrowed_end() {return borrowed_iterator(m_kernel.get(), size());}
+        borrowed_const_iterator borrowed_begin() const {return borrowed_const_iterator(m_kernel.get(), 0);}
+        borrowed_const_iterator borrowed_end() const {return borrowed_const_iterator(m_kernel.get(), size());}
+
+        // Calls f with each contiguous block of elements (a segment_t) in order. Loops over segments are free of
+        // virtual calls and can be vectorized by the compiler. If f returns bool, returning false stops iteration.
+        // Returns false if iteration was stopped early.
+        template <typename Function>
+        bool for_each_segment(Function&& f) const
+        {
+            return m_kernel->for_each_segment(0, size(), std::forward<Function>(f));
+        }
+
+        template <typename Function>
+        bool for_each_segment(size_t start_index, size_t end_index, Function&& f) const
+        {
+            return m_kernel->for_each_segment(start_index, end_index, std::forward<Function>(f));
+        }
+
+        // Reduces the elements [first, last) using the summaries memoized by cache. See aggregate_cache. The cache
+        // holds the storage it summarizes until it is cleared, so, as after taking a snapshot, writes to the container
+        // copy the slices they modify and merges append to new storage rather than in place.
+        template <typename Cache>
+        typename Cache::value_type reduce(Cache& cache, size_t first, size_t last) const
+        {
+            return cache.reduce(*m_kernel, first, last);
+        }
+
+        template <typename Cache>
+        typename Cache::value_type reduce(Cache& cache) const
+        {
+            return cache.reduce(*m_kernel, 0, size());
+        }
+
         // It is unsafe to keep pointers or references to elements in container beyond
         // immediate ops. Non-updating actions can invalidate direct references and pointers to elements.
         // These are provided for convenience only. Use the iterator interface instead in order to refer back to a
@@ -121,8 +169,33 @@ namespace snapshot_container
 
         iterator insert(const_iterator insert_pos, const T& value)
         {
-            m_kernel->insert(insert_pos.pos(), value);
-            return insert_pos;
+            auto insert_point = m_kernel->insert(insert_pos.pos(), value);
+            return iterator(m_kernel, insert_point);
+        }
+
+        iterator insert(const_iterator insert_pos, T&& value)
+        {
+            auto insert_point = m_kernel->insert(insert_pos.pos(), std::move(value));
+            return iterator(m_kernel, insert_point);
+        }
+
+        template <typename... Args>
+        iterator emplace(const_iterator insert_pos, Args&&... args)
+        {
+            auto insert_point = m_kernel->emplace(insert_pos.pos(), std::forward<Args>(args)...);
+            return iterator(m_kernel, insert_point);
+        }
+
+        // Moves a range of elements into the container. The elements are moved into new storage which is then
+        // inserted as a whole without further copying.
+        template <typename IterType>
+        iterator insert(const_iterator insert_pos, std::move_iterator<IterType> start_pos, std::move_iterator<IterType> end_pos)
+        {
+            auto new_slice = m_kernel->create_slice();
+            for (; start_pos != end_pos; ++start_pos)
+                new_slice.append(*start_pos);
+            auto insert_point = m_kernel->insert_slice(insert_pos.pos(), new_slice);
+            return iterator(m_kernel, insert_point);
         }
 
         iterator insert(const_iterator insert_pos,
@@ -187,6 +260,102 @@ namespace snapshot_container
             m_kernel->push_back(value);
         }
 
+        void push_back(T&& value)
+        {
+            m_kernel->push_back(std::move(value));
+        }
+
+        template <typename... Args>
+        reference emplace_back(Args&&... args)
+        {
+            return m_kernel->emplace_back(std::forward<Args>(args)...);
+        }
+
+        // See _iterator_kernel::set_append_in_place. Snapshot publishers turn this off.
+        void set_append_in_place(bool append_in_place)
+        {
+            m_kernel->set_append_in_place(append_in_place);
+        }
+
+        bool append_in_place() const
+        {
+            return m_kernel->append_in_place();
+        }
+
+        // Replaces the thresholds used by cow ops, which default to those of ConfigTraits. E.g.
+        // cow_policy::adaptive_for_element_size<ConfigTraits>(sizeof(T)) scales copy amounts for the element size and
+        // adapts them to the mix of operations on the container.
+        void set_cow_policy(const cow_policy& policy)
+        {
+            m_kernel->set_cow_policy(policy);
+        }
+
+        const cow_policy& get_cow_policy() const
+        {
+            return m_kernel->get_cow_policy();
+        }
+
+        // Merges runs of small slices into new storage, copying at most budget elements. Returns the number of slices
+        // removed. See also background_compactor.
+        size_t compact(size_t budget = kernel_t::npos)
+        {
+            return m_kernel->compact(budget);
+        }
+
+        size_t num_slices() const
+        {
+            return m_kernel->num_slices();
+        }
+
+        double fragmentation_index() const
+        {
+            return m_kernel->fragmentation_index();
+        }
+
+        // Cow and slice statistics of the container. All zero unless ConfigTraits::collect_stats is true.
+        kernel_stats stats() const
+        {
+            return m_kernel->stats();
+        }
+
+        void reset_stats()
+        {
+            m_kernel->reset_stats();
+        }
+
+        // Bytes of storage the container references, split into storage only it references and storage shared with
+        // snapshots or caches. See storage_usage.
+        storage_usage memory_usage() const
+        {
+            return m_kernel->memory_usage();
+        }
+
+        // Copies the live elements of storage elements which only the container references and which its slices
+        // mostly no longer reach to new storage, freeing at least target_bytes if possible. See
+        // _iterator_kernel::trim_dead_storage. Returns the number of bytes freed.
+        size_t trim_dead_storage(double max_live_fraction = 0.5, size_t target_bytes = kernel_t::npos)
+        {
+            return m_kernel->trim_dead_storage(max_live_fraction, target_bytes);
+        }
+
+        // Storage used by all live containers and snapshots of this type. Requires ConfigTraits::register_kernels.
+        static storage_usage_report registered_memory_usage()
+        {
+            static_assert(ConfigTraits::register_kernels, "registered_memory_usage requires ConfigTraits::register_kernels");
+            return kernel_registry<kernel_t>::instance().report();
+        }
+
+        // Latency histograms of container operations. Empty unless ConfigTraits::collect_latencies is true.
+        kernel_latencies latencies() const
+        {
+            return m_kernel->latencies();
+        }
+
+        void reset_latencies()
+        {
+            m_kernel->reset_latencies();
+        }
+
         void swap(container_t& other) noexcept
         {
             // This is safer than std::swap(m_kernel, other.m_kernel) as
@@ -201,7 +370,7 @@ namespace snapshot_container
             return m_kernel->size() == 0;
         }
 
-        // TODO: Improve std::vector compat. Support for emplace, emplace_back etc. Will require some thought.
+        // TODO: Improve std::vector compat.
         // TODO: Reverse iterators
 
         snapshot_t create_snapshot();
@@ -216,14 +385,22 @@ namespace snapshot_container
     public:
 
         friend class container<T, StorageCreator, ConfigTraits>;
+        template <typename Snapshot, typename Sink> friend class snapshot_writer;
+        template <typename Snapshot, typename Source> friend class snapshot_reader;
+        template <typename Snapshot> friend struct _parallel_partition;
+        template <typename Container> friend class background_compactor;
+        friend std::vector<snapshot_edit> diff<>(const snapshot& older, const snapshot& newer);
         typedef container<T, StorageCreator, ConfigTraits> container_t;
 
         typedef StorageCreator storage_creator_t;
         typedef _iterator_kernel<T, StorageCreator, ConfigTraits> kernel_t;
         typedef typename kernel_t::fwd_iter_type fwd_iter_type;
         typedef typename kernel_t::rand_iter_type rand_iter_type;
-        typedef typename kernel_t::const_iterator const_iterator;
-        typedef std::shared_ptr<kernel_t> shared_kernel_t;
+        // The contents of a snapshot never change so its iterators skip checks for modifications.
+        typedef typename kernel_t::frozen_iterator const_iterator;
+        typedef typename kernel_t::borrowed_frozen_iterator borrowed_const_iterator;
+        typedef typename kernel_t::segment_t segment_t;
+        typedef typename kernel_t::handle_t shared_kernel_t;
         typedef size_t size_type;
         typedef ssize_t difference_type;
         typedef T const* pointer;
@@ -252,9 +429,49 @@ namespace snapshot_container
             return m_kernel->size() == 0;
         }
 
+        // Bytes of storage the snapshot references. Dropping the snapshot frees its exclusive bytes. See storage_usage.
+        storage_usage memory_usage() const
+        {
+            return m_kernel->memory_usage();
+        }
+
         const_iterator begin() const {return const_iterator(m_kernel, 0);}
         const_iterator end() const {return const_iterator(m_kernel, size());}
 
+        // See container::borrowed_begin. Must not be used once the snapshot is destroyed or assigned to.
+        borrowed_const_iterator borrowed_begin() const {return borrowed_const_iterator(m_kernel.get(), 0);}
+        borrowed_const_iterator borrowed_end() const {return borrowed_const_iterator(m_kernel.get(), size());}
+
+        // Calls f with each contiguous block of elements (a segment_t) in order. Loops over segments are free of
+        // virtual calls and can be vectorized by the compiler. If f returns bool, returning false stops iteration.
+        // Returns false if iteration was stopped early.
+        template <typename Function>
+        bool for_each_segment(Function&& f) const
+        {
+            return m_kernel->for_each_segment(0, size(), std::forward<Function>(f));
+        }
+
+        template <typename Function>
+        bool for_each_segment(size_t start_index, size_t end_index, Function&& f) const
+        {
+            return m_kernel->for_each_segment(start_index, end_index, std::forward<Function>(f));
+        }
+
+        // Reduces the elements [first, last) using the summaries memoized by cache. See aggregate_cache. The cache
+        // holds the storage it summarizes, so writes to the container the snapshot was taken of keep copying that
+        // storage after the snapshot is destroyed until the cache is cleared.
+        template <typename Cache>
+        typename Cache::value_type reduce(Cache& cache, size_t first, size_t last) const
+        {
+            return cache.reduce(*m_kernel, first, last);
+        }
+
+        template <typename Cache>
+        typename Cache::value_type reduce(Cache& cache) const
+        {
+            return cache.reduce(*m_kernel, 0, size());
+        }
+
         // snapshots provide access to the storage creator object and storage ids of storage
         // elements. This is to provide support for doing things like interfacing snapshots to buffer objects
         // in python efficiently. Theoretically, user code could do this without support from snapshots anyway
@@ -269,21 +486,53 @@ namespace snapshot_container
             return m_kernel->get_storage_creator();
         }
 
+        // Writes the slice table and the elements of each storage element referenced by this snapshot to sink.
+        // Use snapshot_writer to write a sequence of snapshots sharing storage such that shared elements are only
+        // written once. Elements must be trivially copyable.
+        template <typename Sink>
+        void serialize(Sink& sink) const
+        {
+            snapshot_writer<snapshot, Sink> writer(sink);
+            writer.write(*this);
+        }
+
+        // Reads a snapshot written by serialize. Storage for the snapshot is created via creator.
+        template <typename Source>
+        static snapshot deserialize(Source& source, const storage_creator_t& creator = storage_creator_t())
+        {
+            snapshot_reader<snapshot, Source> reader(source, creator);
+            snapshot result;
+            if (!reader.read(result))
+                throw std::runtime_error("snapshot::deserialize: no snapshot in source");
+            return result;
+        }
+
     protected:
 
         snapshot(const shared_kernel_t& rhs):
-        m_kernel(kernel_t::create(rhs->get_storage_creator()))
+        m_kernel(kernel_t::create(rhs))
         {
             // shallow copy. The outer shared pointers are independent but
-            // all the internal shared pointers are shared. This is how the
+            // the slice table is shared copy on write. This is how the
             // container type constructs a snapshot.
-            *m_kernel = *rhs;
         }
 
         shared_kernel_t m_kernel;
     };
 
 
+    // Returns the edits transforming older into newer in order. Unchanged ranges are found by the identity of the
+    // storage underlying the two snapshots rather than by comparing elements so this takes time proportional to the
+    // number of slices. Edits are exact for snapshots of the same container except that elements copied by cow ops
+    // are reported as replaced. Snapshots of unrelated containers differ entirely.
+    template <typename T, typename StorageCreator, typename ConfigTraits>
+    std::vector<snapshot_edit> diff(const snapshot<T, StorageCreator, ConfigTraits>& older,
+                                    const snapshot<T, StorageCreator, ConfigTraits>& newer)
+    {
+        return _diff_kernels(*older.m_kernel, *newer.m_kernel);
+    }
+
+
     template <typename T, typename StorageCreator, typename ConfigTraits>
     auto container<T, StorageCreator, ConfigTraits>::create_snapshot() -> snapshot_t
     {
@@ -0,0 +1,151 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+
+namespace snapshot_container
+{
+    // An edit transforming the range [m_old_start, m_old_end) of an older snapshot into the range
+    // [m_new_start, m_new_end) of a newer snapshot.
+    struct snapshot_edit
+    {
+        enum kind_t
+        {
+            inserted,   // the old range is empty
+            erased,     // the new range is empty
+            replaced
+        };
+
+        snapshot_edit(size_t old_start, size_t old_end, size_t new_start, size_t new_end, kind_t kind):
+            m_old_start(old_start),
+            m_old_end(old_end),
+            m_new_start(new_start),
+            m_new_end(new_end),
+            m_kind(kind)
+        {}
+
+        bool operator==(const snapshot_edit& rhs) const
+        {
+            return m_old_start == rhs.m_old_start && m_old_end == rhs.m_old_end && m_new_start == rhs.m_new_start &&
+                   m_new_end == rhs.m_new_end && m_kind == rhs.m_kind;
+        }
+
+        size_t m_old_start;
+        size_t m_old_end;
+        size_t m_new_start;
+        size_t m_new_end;
+        kind_t m_kind;
+    };
+
+
+    // Computes the edits between the slice tables of two kernels. Elements are the same in both when they are the same
+    // element of the same storage element, which is the case for elements which have not been modified between two
+    // snapshots of a container. Elements are never compared so the edits are conservative: elements copied by cow ops
+    // (e.g. the neighbours of an element written through an iterator) are reported as replaced even though their
+    // values are unchanged. Runs in O(S log S) where S is the number of slices.
+    template <typename Kernel>
+    std::vector<snapshot_edit> _diff_kernels(const Kernel& older, const Kernel& newer)
+    {
+        struct _run
+        {
+            size_t m_storage_start;
+            size_t m_storage_end;
+            size_t m_container_index;
+        };
+
+        // A range of elements common to both: old container index, new container index and length.
+        struct _match
+        {
+            size_t m_old_index;
+            size_t m_new_index;
+            size_t m_length;
+        };
+
+        std::unordered_map<const void*, std::vector<_run>> old_runs;
+        size_t container_index = 0;
+        for (auto& slice: older.slices())
+        {
+            if (slice.size() > 0)
+                old_runs[slice.m_storage.get()].push_back({slice.m_start_index, slice.m_end_index, container_index});
+            container_index += slice.size();
+        }
+
+        for (auto& runs: old_runs)
+        {
+            std::sort(runs.second.begin(), runs.second.end(),
+                      [](const _run& lhs, const _run& rhs) {return lhs.m_storage_start < rhs.m_storage_start;});
+        }
+
+        // Matches in order of new container index. Matches which would move elements backwards relative to the
+        // previous match are dropped so the edits are ordered in both snapshots.
+        std::vector<_match> matches;
+        size_t old_index_hwm = 0;
+        container_index = 0;
+        for (auto& slice: newer.slices())
+        {
+            auto found = old_runs.find(slice.m_storage.get());
+            if (found != old_runs.end())
+            {
+                auto& runs = found->second;
+                auto run = std::upper_bound(runs.begin(), runs.end(), slice.m_start_index,
+                                            [](size_t index, const _run& rhs) {return index < rhs.m_storage_start;});
+                if (run != runs.begin())
+                    --run;
+
+                for (; run != runs.end() && run->m_storage_start < slice.m_end_index; ++run)
+                {
+                    auto start = std::max(run->m_storage_start, slice.m_start_index);
+                    auto end = std::min(run->m_storage_end, slice.m_end_index);
+                    if (start >= end)
+                        continue;
+
+                    _match match{run->m_container_index + start - run->m_storage_start,
+                                 container_index + start - slice.m_start_index, end - start};
+                    if (match.m_old_index < old_index_hwm)
+                        continue;
+
+                    if (!matches.empty() &&
+                        matches.back().m_old_index + matches.back().m_length == match.m_old_index &&
+                        matches.back().m_new_index + matches.back().m_length == match.m_new_index)
+                        matches.back().m_length += match.m_length;
+                    else
+                        matches.push_back(match);
+                    old_index_hwm = match.m_old_index + match.m_length;
+                }
+            }
+            container_index += slice.size();
+        }
+
+        // The edits are the gaps between matches.
+        std::vector<snapshot_edit> result;
+        size_t old_index = 0;
+        size_t new_index = 0;
+        auto add_edit = [&result](size_t old_start, size_t old_end, size_t new_start, size_t new_end)
+        {
+            if (old_start == old_end && new_start == new_end)
+                return;
+            auto kind = old_start == old_end ? snapshot_edit::inserted :
+                        new_start == new_end ? snapshot_edit::erased : snapshot_edit::replaced;
+            result.emplace_back(old_start, old_end, new_start, new_end, kind);
+        };
+
+        for (auto& match: matches)
+        {
+            add_edit(old_index, match.m_old_index, new_index, match.m_new_index);
+            old_index = match.m_old_index + match.m_length;
+            new_index = match.m_new_index + match.m_length;
+        }
+        add_edit(old_index, older.size(), new_index, newer.size());
+        return result;
+    }
+}
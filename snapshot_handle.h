@@ -0,0 +1,265 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+
+namespace snapshot_container
+{
+    // A reference counted handle for objects which are only ever accessed from a single thread. The count is stored
+    // with the object in a single allocation and is not atomic so copying and destroying a handle is a plain
+    // increment/decrement. Supports the subset of std::shared_ptr used for kernel handles.
+    template <typename T>
+    class _local_shared_ptr
+    {
+        struct _block
+        {
+            template <typename... Args>
+            _block(Args&&... args):
+                m_value(std::forward<Args>(args)...)
+            {}
+
+            T m_value;
+            size_t m_count = 1;
+        };
+
+    public:
+
+        template <typename U, typename... Args>
+        friend _local_shared_ptr<U> _make_local_shared(Args&&... args);
+
+        _local_shared_ptr() noexcept = default;
+
+        _local_shared_ptr(std::nullptr_t) noexcept
+        {}
+
+        _local_shared_ptr(const _local_shared_ptr& rhs) noexcept:
+            m_block(rhs.m_block)
+        {
+            if (m_block)
+                ++m_block->m_count;
+        }
+
+        _local_shared_ptr(_local_shared_ptr&& rhs) noexcept:
+            m_block(rhs.m_block)
+        {
+            rhs.m_block = nullptr;
+        }
+
+        ~_local_shared_ptr()
+        {
+            _release();
+        }
+
+        _local_shared_ptr& operator=(const _local_shared_ptr& rhs) noexcept
+        {
+            _local_shared_ptr(rhs).swap(*this);
+            return *this;
+        }
+
+        _local_shared_ptr& operator=(_local_shared_ptr&& rhs) noexcept
+        {
+            _local_shared_ptr(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        void swap(_local_shared_ptr& rhs) noexcept
+        {
+            std::swap(m_block, rhs.m_block);
+        }
+
+        void reset() noexcept
+        {
+            _local_shared_ptr().swap(*this);
+        }
+
+        T* get() const noexcept
+        {
+            return m_block ? &m_block->m_value : nullptr;
+        }
+
+        T& operator*() const noexcept
+        {
+            return m_block->m_value;
+        }
+
+        T* operator->() const noexcept
+        {
+            return &m_block->m_value;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_block != nullptr;
+        }
+
+        long use_count() const noexcept
+        {
+            return m_block ? static_cast<long>(m_block->m_count) : 0;
+        }
+
+        bool operator==(const _local_shared_ptr& rhs) const noexcept
+        {
+            return m_block == rhs.m_block;
+        }
+
+        bool operator!=(const _local_shared_ptr& rhs) const noexcept
+        {
+            return m_block != rhs.m_block;
+        }
+
+    private:
+
+        explicit _local_shared_ptr(_block* block) noexcept:
+            m_block(block)
+        {}
+
+        void _release() noexcept
+        {
+            if (m_block && --m_block->m_count == 0)
+                delete m_block;
+            m_block = nullptr;
+        }
+
+        _block* m_block = nullptr;
+    };
+
+
+    template <typename T, typename... Args>
+    _local_shared_ptr<T> _make_local_shared(Args&&... args)
+    {
+        return _local_shared_ptr<T>(new typename _local_shared_ptr<T>::_block(std::forward<Args>(args)...));
+    }
+
+
+    // A reference counted handle to a storage element which is only ever accessed from a single thread. Storage
+    // creators hand out storage as std::shared_ptr. The handle takes over the shared_ptr once, and handles then share
+    // it through a count which is not atomic, so copying slices does no atomic operations. The storage is kept alive
+    // by the shared_ptr so it is released however the storage type allocates and deletes itself.
+    template <typename T>
+    class _local_storage_ptr
+    {
+        struct _block
+        {
+            std::shared_ptr<T> m_shared;
+            size_t m_count = 1;
+        };
+
+    public:
+
+        _local_storage_ptr() noexcept = default;
+
+        _local_storage_ptr(std::nullptr_t) noexcept
+        {}
+
+        template <typename U>
+        _local_storage_ptr(std::shared_ptr<U> shared)
+        {
+            if (shared)
+            {
+                m_block = new _block{std::shared_ptr<T>(std::move(shared))};
+                m_ptr = m_block->m_shared.get();
+            }
+        }
+
+        _local_storage_ptr(const _local_storage_ptr& rhs) noexcept:
+            m_block(rhs.m_block),
+            m_ptr(rhs.m_ptr)
+        {
+            if (m_block)
+                ++m_block->m_count;
+        }
+
+        _local_storage_ptr(_local_storage_ptr&& rhs) noexcept:
+            m_block(rhs.m_block),
+            m_ptr(rhs.m_ptr)
+        {
+            rhs.m_block = nullptr;
+            rhs.m_ptr = nullptr;
+        }
+
+        ~_local_storage_ptr()
+        {
+            _release();
+        }
+
+        _local_storage_ptr& operator=(const _local_storage_ptr& rhs) noexcept
+        {
+            _local_storage_ptr(rhs).swap(*this);
+            return *this;
+        }
+
+        _local_storage_ptr& operator=(_local_storage_ptr&& rhs) noexcept
+        {
+            _local_storage_ptr(std::move(rhs)).swap(*this);
+            return *this;
+        }
+
+        void swap(_local_storage_ptr& rhs) noexcept
+        {
+            std::swap(m_block, rhs.m_block);
+            std::swap(m_ptr, rhs.m_ptr);
+        }
+
+        void reset() noexcept
+        {
+            _local_storage_ptr().swap(*this);
+        }
+
+        T* get() const noexcept
+        {
+            return m_ptr;
+        }
+
+        T& operator*() const noexcept
+        {
+            return *m_ptr;
+        }
+
+        T* operator->() const noexcept
+        {
+            return m_ptr;
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return m_ptr != nullptr;
+        }
+
+        long use_count() const noexcept
+        {
+            return m_block ? static_cast<long>(m_block->m_count) : 0;
+        }
+
+        bool operator==(const _local_storage_ptr& rhs) const noexcept
+        {
+            return m_block == rhs.m_block;
+        }
+
+        bool operator!=(const _local_storage_ptr& rhs) const noexcept
+        {
+            return m_block != rhs.m_block;
+        }
+
+    private:
+
+        void _release() noexcept
+        {
+            if (m_block && --m_block->m_count == 0)
+                delete m_block;
+            m_block = nullptr;
+            m_ptr = nullptr;
+        }
+
+        _block* m_block = nullptr;
+        T* m_ptr = nullptr;
+    };
+}
@@ -1,16 +1,43 @@
 #include "snapshot_slice.h"
+#include "snapshot_slice_index.h"
+#include "snapshot_slice_btree.h"
+#include "snapshot_handle.h"
+#include "snapshot_memory.h"
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <tuple>
 #include <algorithm>
 #include <iostream>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 
 namespace snapshot_container {
 
-    template<typename T, typename Ref, typename Ptr, typename C>
+    struct _iterator_kernel_config_traits;
+
+    // Iterator variants. Owning iterators share the kernel and remain usable after the container or snapshot they
+    // were obtained from is destroyed. Borrowed iterators refer to the kernel by plain pointer, so copying one costs no
+    // reference count update, and are only valid while the container or snapshot they were obtained from lives.
+    // Frozen iterators are for kernels which are never modified (those of snapshots) and skip the checks for
+    // modifications made since the iterator position was computed.
+    enum _iterator_flags : unsigned {
+        _iterator_owning = 0,
+        _iterator_borrowed = 1,
+        _iterator_frozen = 2
+    };
+
+    template<typename T, typename Ref, typename Ptr, typename C, typename ConfigTraits = _iterator_kernel_config_traits,
+             unsigned Flags = _iterator_owning>
     class _iterator;
 
+    // The type through which an iterator with Flags refers to its kernel.
+    template <typename Kernel, unsigned Flags>
+    using _iterator_kernel_ref = std::conditional_t<(Flags & _iterator_borrowed) != 0, Kernel*, typename Kernel::handle_t>;
+
     struct _iterator_kernel_config_traits {
         // These affect how new slices are created and compacted.
         // Below lwm slices are created when convenient
@@ -41,29 +68,319 @@ namespace snapshot_container {
             // from the end of the slice will result in a copy of this many items to effect certain cow ops.
             static constexpr size_t slice_edge_offset = 4;
         };
+
+        struct compaction {
+            // Slices shorter than this are merged with neighbouring small slices by compaction.
+            static constexpr size_t small_slice_size = 2048;
+
+            // Max size of a slice created by compaction.
+            static constexpr size_t max_merged_size = 65536;
+        };
+
+        // Kernels count cow copies, slice changes, slice lookups and storage allocations (see kernel_stats) when
+        // this is true. The counters are compiled out otherwise.
+        static constexpr bool collect_stats = false;
+
+        // Kernels record the latencies of inserts, removes, writes requiring cow ops, snapshots and appends in
+        // histograms (see kernel_latencies) when this is true, timed with latency_clock. Compiled out otherwise.
+        static constexpr bool collect_latencies = false;
+        using latency_clock = std::chrono::steady_clock;
+
+        // Kernels add themselves to kernel_registry<Kernel> while they live when this is true so the memory used by
+        // all containers and snapshots of a type can be reported.
+        static constexpr bool register_kernels = false;
+
+        // The structure holding the kernel's slices along with their lengths.
+        template <typename Slice>
+        using slice_table_type = _slice_vector_table<Slice>;
+
+        // The handle through which containers, snapshots and iterators share a kernel.
+        template <typename Kernel>
+        using handle_type = std::shared_ptr<Kernel>;
+
+        template <typename Kernel, typename... Args>
+        static handle_type<Kernel> make_handle(Args&&... args) {
+            return std::make_shared<Kernel>(std::forward<Args>(args)...);
+        }
+
+        // The handle through which slices share storage elements. Must be constructible from the std::shared_ptr
+        // handed out by storage creators.
+        template <typename Storage>
+        using storage_handle_type = std::shared_ptr<Storage>;
+    };
+
+
+    // Holds slices in a B+tree so that slice lookup, insertion and removal are O(log num_slices). This
+    // makes it practical to run with a far larger number of slices before falling back to slice copies.
+    struct _btree_iterator_kernel_config_traits : public _iterator_kernel_config_traits {
+        static constexpr size_t num_slices_lwm = 16384;
+        static constexpr size_t num_slices_hwm = 131072;
+
+        template <typename Slice>
+        using slice_table_type = _slice_btree<Slice>;
+    };
+
+
+    // Counts of kernel operations which determine how much cow ops should copy. Used by adaptive cow policies.
+    struct cow_op_counts {
+        size_t m_inserts = 0;
+        size_t m_removes = 0;
+        size_t m_iteration_writes = 0;  // writes through iterators which required cow ops
+        size_t m_snapshots = 0;
+
+        size_t writes() const {
+            return m_inserts + m_removes + m_iteration_writes;
+        }
+    };
+
+
+    // The thresholds used by cow ops at run time (see _iterator_kernel_config_traits for their meaning). Each kernel
+    // holds a policy which defaults to the values of its ConfigTraits and may be replaced via set_cow_policy.
+    struct cow_policy {
+        size_t num_slices_lwm;
+        size_t num_slices_hwm;
+        size_t min_split_size;
+        size_t max_merge_size;
+        size_t copy_fraction_denominator;
+        size_t max_insertion_copy_size;
+        size_t slice_edge_offset;
+        size_t small_slice_size;
+        size_t max_merged_size;
+
+        // Adaptive policies are recomputed by the kernel every adapt_interval cow ops (see adapt).
+        bool adaptive = false;
+        static constexpr size_t adapt_interval = 1024;
+
+        // The element size the copy amounts of config traits are meant for.
+        static constexpr size_t reference_element_size = 8;
+
+        template <typename ConfigTraits>
+        static cow_policy from_traits() {
+            cow_policy result;
+            result.num_slices_lwm = ConfigTraits::num_slices_lwm;
+            result.num_slices_hwm = ConfigTraits::num_slices_hwm;
+            result.min_split_size = ConfigTraits::cow_ops::min_split_size;
+            result.max_merge_size = ConfigTraits::cow_ops::max_merge_size;
+            result.copy_fraction_denominator = ConfigTraits::cow_ops::copy_fraction_denominator;
+            result.max_insertion_copy_size = ConfigTraits::cow_ops::max_insertion_copy_size;
+            result.slice_edge_offset = ConfigTraits::cow_ops::slice_edge_offset;
+            result.small_slice_size = ConfigTraits::compaction::small_slice_size;
+            result.max_merged_size = ConfigTraits::compaction::max_merged_size;
+            return result;
+        }
+
+        // The traits' values with element counts scaled so that cow ops copy about as many bytes for elements of
+        // element_size as the traits do for elements of reference_element_size. Elements smaller than the
+        // reference size are not scaled up.
+        template <typename ConfigTraits>
+        static cow_policy for_element_size(size_t element_size) {
+            auto result = from_traits<ConfigTraits>();
+            if (element_size > reference_element_size) {
+                auto scale = [element_size](size_t count, size_t min_count) {
+                    return std::max(count * reference_element_size / element_size, min_count);
+                };
+                result.min_split_size = scale(result.min_split_size, 4 * result.slice_edge_offset);
+                result.max_merge_size = scale(result.max_merge_size, 2 * result.slice_edge_offset);
+                result.max_insertion_copy_size = scale(result.max_insertion_copy_size, result.slice_edge_offset);
+                result.small_slice_size = scale(result.small_slice_size, 2 * result.slice_edge_offset);
+                result.max_merged_size = scale(result.max_merged_size, result.small_slice_size);
+            }
+            return result;
+        }
+
+        // An adaptive policy for elements of element_size.
+        template <typename ConfigTraits>
+        static cow_policy adaptive_for_element_size(size_t element_size) {
+            auto result = for_element_size<ConfigTraits>(element_size);
+            result.adaptive = true;
+            return result;
+        }
+
+        // Adjusts the policy for the observed mix of operations starting from the base policy for the element size:
+        // - Frequent snapshots share copied elements again soon, so copy less. Rare snapshots amortize copies over many
+        //   writes, so copy more in fewer, larger slices.
+        // - Insert and remove heavy mixes split slices rather than copy them so they may keep more slices.
+        //   Iteration heavy mixes keep fewer slices.
+        template <typename ConfigTraits>
+        static cow_policy adapted(const cow_op_counts& counts, size_t element_size) {
+            auto result = adaptive_for_element_size<ConfigTraits>(element_size);
+            auto writes = std::max<size_t>(counts.writes(), 1);
+            if (counts.m_snapshots * 16 > writes) {
+                result.copy_fraction_denominator *= 2;
+                result.max_merge_size = std::max(result.max_merge_size / 2, 2 * result.slice_edge_offset);
+            } else if (counts.m_snapshots * 1024 < writes) {
+                result.copy_fraction_denominator = std::max<size_t>(result.copy_fraction_denominator / 2, 2);
+                result.max_merge_size *= 2;
+            }
+
+            if ((counts.m_inserts + counts.m_removes) * 2 > writes) {
+                result.num_slices_lwm *= 2;
+                result.num_slices_hwm *= 2;
+            } else if (counts.m_iteration_writes * 2 > writes) {
+                result.num_slices_lwm = std::max<size_t>(result.num_slices_lwm / 2, 16);
+            }
+            return result;
+        }
+    };
+
+
+    // Elements copied by cow ops on one path. m_copies counts copy operations, each of which copies m_elements /
+    // m_copies elements on average.
+    struct cow_copy_stats {
+        size_t m_copies = 0;
+        size_t m_elements = 0;
+        size_t m_bytes = 0;
+    };
+
+
+    // Kernel statistics collected when ConfigTraits::collect_stats is true. Returned by value by
+    // _iterator_kernel::stats() for export to metrics. Collecting statistics updates counters in const lookups so a
+    // kernel collecting them must not be accessed from more than one thread at a time.
+    struct kernel_stats {
+        cow_copy_stats m_iteration_copies;  // _iteration_cow_ops
+        cow_copy_stats m_insert_copies;     // _insert_cow_ops
+        cow_copy_stats m_remove_copies;     // removes from shared storage
+
+        size_t m_slices_created = 0;        // slices added by splits, appends and compaction
+        size_t m_slices_merged = 0;         // slices merged into a neighbour or compacted away
+        size_t m_slices_dropped = 0;        // slices removed because all their elements were removed
+
+        size_t m_fast_lookups = 0;          // slice_index resolved via the first or last slice
+        size_t m_binary_lookups = 0;        // slice_index resolved via a search of the slice table
+
+        size_t m_storage_allocations = 0;   // storage elements created by the storage creator or by copies
+    };
+
+
+    // Counts of latencies in power of two buckets. Bucket 0 holds latencies of 0ns and bucket i > 0 holds latencies in
+    // [2^(i-1), 2^i) ns.
+    struct latency_histogram {
+        static constexpr size_t num_buckets = 65;
+
+        size_t m_buckets[num_buckets] = {};
+        size_t m_count = 0;
+        uint64_t m_total_ns = 0;
+        uint64_t m_max_ns = 0;
+
+        void record(uint64_t nanoseconds) {
+            ++m_buckets[nanoseconds ? 64 - __builtin_clzll(nanoseconds) : 0];
+            ++m_count;
+            m_total_ns += nanoseconds;
+            m_max_ns = std::max(m_max_ns, nanoseconds);
+        }
+
+        // An upper bound of the latency below which fraction (e.g. 0.999) of the latencies fall. Exact to within
+        // a factor of 2.
+        uint64_t percentile(double fraction) const {
+            size_t rank = static_cast<size_t>(fraction * m_count);
+            size_t count = 0;
+            for (size_t bucket = 0; bucket < num_buckets; ++bucket) {
+                count += m_buckets[bucket];
+                if (count > rank)
+                    return bucket ? std::min(m_max_ns, (uint64_t(2) << (bucket - 1)) - 1) : 0;
+            }
+            return m_max_ns;
+        }
+
+        double mean() const {
+            return m_count ? double(m_total_ns) / m_count : 0.0;
+        }
+    };
+
+
+    // Kernel operation latencies collected when ConfigTraits::collect_latencies is true. Returned by value by
+    // _iterator_kernel::latencies(). Like kernel_stats, a kernel collecting them must not be accessed from more than
+    // one thread at a time.
+    struct kernel_latencies {
+        latency_histogram m_insert;
+        latency_histogram m_remove;
+        latency_histogram m_cow_write;  // cow ops of a write via operator[] or an iterator which changed slices
+        latency_histogram m_snapshot;   // recorded by the kernel the snapshot is taken of
+        latency_histogram m_append;     // push_back and append
+    };
+
+
+    // Records the time from its construction to its destruction in a latency_histogram. The disabled variant does
+    // nothing so kernels not collecting latencies do not read the clock.
+    template <bool Enabled, typename Clock>
+    class _latency_timer {
+    public:
+        explicit _latency_timer(latency_histogram& histogram) :
+            m_histogram(histogram),
+            m_start(Clock::now()) {
+        }
+
+        _latency_timer(const _latency_timer&) = delete;
+        _latency_timer& operator=(const _latency_timer&) = delete;
+
+        ~_latency_timer() {
+            m_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count());
+        }
+
+    private:
+        latency_histogram& m_histogram;
+        typename Clock::time_point m_start;
+    };
+
+    template <typename Clock>
+    class _latency_timer<false, Clock> {
+    public:
+        _latency_timer() {
+        }
+
+        ~_latency_timer() {
+        }
+    };
+
+
+    // Shares kernels and storage elements through non-atomic reference counts so copying iterators, snapshots and
+    // slices (cow ops, unsharing the slice table after a snapshot) costs no atomic operations. Only for containers
+    // whose kernels, including those of their snapshots and iterators, are never accessed from more than one thread
+    // (e.g. must not be used with snapshot_publisher or background_compactor).
+    template <typename BaseTraits = _iterator_kernel_config_traits>
+    struct _single_threaded_config_traits : public BaseTraits {
+        template <typename Kernel>
+        using handle_type = _local_shared_ptr<Kernel>;
+
+        template <typename Kernel, typename... Args>
+        static handle_type<Kernel> make_handle(Args&&... args) {
+            return _make_local_shared<Kernel>(std::forward<Args>(args)...);
+        }
+
+        template <typename Storage>
+        using storage_handle_type = _local_storage_ptr<Storage>;
     };
 
 
     template<typename T, typename StorageCreator, typename ConfigTraits = _iterator_kernel_config_traits>
-    class _iterator_kernel : public std::enable_shared_from_this<_iterator_kernel<T, StorageCreator>>
+    class _iterator_kernel
     {
         public:
 
-        friend _iterator<T, T&, T*, StorageCreator>;
-        friend _iterator<T, T const&, T const *, StorageCreator>;
+        template <typename, typename, typename, typename, typename, unsigned>
+        friend class _iterator;
 
-        typedef _iterator<T, T&, T*, StorageCreator> iterator;
-        typedef _iterator<T, T const&, T const *, StorageCreator> const_iterator;
+        typedef _iterator<T, T&, T*, StorageCreator, ConfigTraits> iterator;
+        typedef _iterator<T, T const&, T const *, StorageCreator, ConfigTraits> const_iterator;
+        typedef _iterator<T, T&, T*, StorageCreator, ConfigTraits, _iterator_borrowed> borrowed_iterator;
+        typedef _iterator<T, T const&, T const *, StorageCreator, ConfigTraits, _iterator_borrowed> borrowed_const_iterator;
+        typedef _iterator<T, T const&, T const *, StorageCreator, ConfigTraits, _iterator_frozen> frozen_iterator;
+        typedef _iterator<T, T const&, T const *, StorageCreator, ConfigTraits,
+                          _iterator_borrowed | _iterator_frozen> borrowed_frozen_iterator;
 
         // Implementation details for the iterator type for snapshot_container. Must be created via
         // shared ptr. Both the container type and iterators for the container will keep a shared ptr to iterator_kernel.
         static constexpr size_t npos = 0xFFFFFFFFFFFFFFFF;
         typedef StorageCreator storage_creator_t;
-        typedef _slice<T> slice_t;
+        typedef typename _creator_storage_type<StorageCreator, typename _slice<T>::storage_base_t>::type storage_t;
+        typedef _slice<T, storage_t, typename ConfigTraits::template storage_handle_type<storage_t>> slice_t;
         typedef typename slice_t::storage_base_t storage_base_t;
         typedef typename storage_base_t::fwd_iter_type fwd_iter_type;
         typedef typename storage_base_t::rand_iter_type rand_iter_type;
         typedef ConfigTraits config_traits;
+        typedef typename config_traits::template slice_table_type<slice_t> slice_table_t;
+        typedef typename config_traits::template handle_type<_iterator_kernel> handle_t;
+        typedef segment<T> segment_t;
 
         struct slice_point {
 
@@ -99,38 +416,55 @@ namespace snapshot_container {
 
         _iterator_kernel(const storage_creator_t & storage_creator) :
             m_storage_creator(storage_creator) {
-            m_slices.push_back(slice_t(m_storage_creator(), 0));
-            m_cum_slice_lengths.push_back(0);
+            m_slices.push_back(slice_t(_create_storage(), 0));
+            _register();
         }
 
         template <typename IteratorType >
             _iterator_kernel(const storage_creator_t& storage_creator, IteratorType begin_pos, IteratorType end_pos) :
             m_storage_creator(storage_creator) {
-            m_slices.push_back(slice_t(m_storage_creator(begin_pos, end_pos), 0));
-            m_cum_slice_lengths.push_back(m_slices[0].size());
+            m_slices.push_back(slice_t(_create_storage(begin_pos, end_pos), 0));
+            _register();
         }
 
         // Note: These functions make a shallow copy. This is useful for creating  snapshots.
-        // Use the deep_copy function to actually copy
-        _iterator_kernel(const _iterator_kernel & rhs) = default;
+        // Use the deep_copy function to actually copy. The slice table is shared copy on write so this is O(1).
+        // rhs iterators may have cached slices which are now shared, so rhs update count is incremented as well.
+        _iterator_kernel(const _iterator_kernel & rhs) :
+            m_slices(rhs.m_slices),
+            m_storage_creator(rhs.m_storage_creator),
+            m_policy(rhs.m_policy) {
+            rhs._incr_update_count();
+            ++rhs.m_op_counts.m_snapshots;
+            _register();
+        }
+
+        ~_iterator_kernel() {
+            if constexpr (config_traits::register_kernels)
+                kernel_registry<_iterator_kernel>::instance().remove(this);
+        }
 
         _iterator_kernel& operator=(const _iterator_kernel & rhs) {
             _incr_update_count();
+            rhs._incr_update_count();
             m_slices = rhs.m_slices;
-            m_cum_slice_lengths = rhs.m_cum_slice_lengths;
             return *this;
         }
 
         void deep_copy(const _iterator_kernel & rhs) {
             _incr_update_count();
-            m_cum_slice_lengths = rhs.m_cum_slice_lengths;
+            m_slices.clear();
             for (auto& slice : rhs.m_slices) {
-                m_slices.push_back(slice_t(m_storage_creator(slice.begin(), slice.end()), 0));
+                auto new_slice = slice_t(_create_storage(), 0);
+                new_slice.append(slice);
+                m_slices.push_back(new_slice);
             }
         }
 
+        // The previous slice may be in a part of the slice table which is still shared (eg another btree leaf). Its
+        // storage then looks unshared here but would be shared once the table is copied to modify the slice.
         bool _is_prev_slice_modifiable(size_t slice) const {
-            if (slice > 0 && m_slices[slice - 1].is_modifiable())
+            if (slice > 0 && m_slices.exclusive(slice - 1) && m_slices[slice - 1].is_modifiable())
                 return true;
 
             return false;
@@ -141,6 +475,10 @@ namespace snapshot_container {
         // for reverse iteration will be required when modifiable reverse iterators are supported.
 
         slice_point _iteration_cow_ops(const slice_point & iter_point) {
+            // Unsharing the slice table moves the slice which invalidates slices cached by iterators.
+            if (!m_slices.exclusive(iter_point.slice()))
+                _incr_update_count();
+
             auto& slice = m_slices[iter_point.slice()];
 
             // edge case issues
@@ -151,42 +489,52 @@ namespace snapshot_container {
                     return iter_point;
             }
 
-            if (slice.is_modifiable() && m_slices.size() <= config_traits::num_slices_lwm)
+            if (slice.is_modifiable() && m_slices.size() <= m_policy.num_slices_lwm)
                 return iter_point;
 
+            _count_op(m_op_counts.m_iteration_writes);
+            auto timer = _time_op(&kernel_latencies::m_cow_write);
+
+            // Everything below changes the slice structure which invalidates slice_points cached by iterators.
+            _incr_update_count();
+
             if (_is_prev_slice_modifiable(iter_point.slice())) {
-                if (slice.size() <= config_traits::cow_ops::max_merge_size) {
+                if (slice.size() <= m_policy.max_merge_size) {
                     auto& prev_slice = m_slices[iter_point.slice() - 1];
                     auto prev_slice_size = prev_slice.size();
-                    prev_slice.append(slice.begin(), slice.end());
-                    m_cum_slice_lengths[iter_point.slice() - 1] = m_cum_slice_lengths[iter_point.slice()];
-                    m_cum_slice_lengths.erase(m_cum_slice_lengths.begin() + iter_point.slice());
-                    m_slices.erase(m_slices.begin() + iter_point.slice());
+                    prev_slice.append_extract(slice);
+                    _record_copy(&kernel_stats::m_iteration_copies, slice.size(), false);
+                    _record_stat(&kernel_stats::m_slices_merged);
+                    _update_slice_lengths(iter_point.slice() - 1, slice.size());
+                    m_slices.erase(iter_point.slice());
                     return slice_point(iter_point.slice() - 1, prev_slice_size + iter_point.index());
-                } else if (iter_point.index() <= slice.size() / config_traits::cow_ops::copy_fraction_denominator) {
-                    auto items_to_copy = slice.size() / config_traits::cow_ops::copy_fraction_denominator + 1;
+                } else if (iter_point.index() <= slice.size() / m_policy.copy_fraction_denominator) {
+                    auto items_to_copy = slice.size() / m_policy.copy_fraction_denominator + 1;
                     if (items_to_copy + iter_point.index() >= slice.size())
                         items_to_copy = slice.size() - iter_point.index();
 
                     auto& prev_slice = m_slices[iter_point.slice() - 1];
                     auto prev_slice_size = prev_slice.size();
-                    prev_slice.append(slice.begin(), slice.begin() + (iter_point.index() + items_to_copy));
-                    m_cum_slice_lengths[iter_point.slice() - 1] += items_to_copy + iter_point.index();
-                    if (m_cum_slice_lengths[iter_point.slice() - 1] == m_cum_slice_lengths[iter_point.slice()]) {
+                    prev_slice.append_extract(slice, 0, iter_point.index() + items_to_copy);
+                    _record_copy(&kernel_stats::m_iteration_copies, iter_point.index() + items_to_copy, false);
+                    _update_slice_lengths(iter_point.slice() - 1, items_to_copy + iter_point.index());
+                    if (items_to_copy + iter_point.index() == slice.size()) {
                         // no elems left in element cow_point.slice so remove it
-                        m_cum_slice_lengths.erase(m_cum_slice_lengths.begin() + iter_point.slice());
-                        m_slices.erase(m_slices.begin() + iter_point.slice());
+                        _record_stat(&kernel_stats::m_slices_merged);
+                        m_slices.erase(iter_point.slice());
                     } else {
                         m_slices[iter_point.slice()].m_start_index += iter_point.index() + items_to_copy;
+                        _update_slice_lengths(iter_point.slice(), -1 * (items_to_copy + iter_point.index()));
                     }
                     return slice_point(iter_point.slice() - 1, prev_slice_size + iter_point.index());
                 }
             }
 
             // slice is not modifiable. If num slices is above hwm or slice is small enough, just copy it
-            if (m_slices.size() > config_traits::num_slices_hwm || slice.size() <= config_traits::cow_ops::max_insertion_copy_size) {
+            if (m_slices.size() > m_policy.num_slices_hwm || slice.size() <= m_policy.max_insertion_copy_size) {
                 // make a copy of the slice
-                auto new_slice = slice.copy(0);
+                auto new_slice = slice.extract(0);
+                _record_copy(&kernel_stats::m_iteration_copies, new_slice.size(), true);
                 m_slices[iter_point.slice()] = new_slice;
                 return iter_point;
             }
@@ -194,25 +542,27 @@ namespace snapshot_container {
             // Copy out a range of elements into a new slice to allow for writable iteration over the copied slice
             if (iter_point.index() < slice.size() / 2) {
                 // TODO: Improve this logic to copy less.
-                auto extra_items_to_copy = slice.size() / config_traits::cow_ops::copy_fraction_denominator;
-                auto new_slice = slice.copy(0, iter_point.index() + extra_items_to_copy);
-                auto cum_slice_length = iter_point.slice() == 0 ? new_slice.size() : m_cum_slice_lengths[iter_point.slice() - 1] + new_slice.size();
-                m_cum_slice_lengths.insert(m_cum_slice_lengths.begin() + iter_point.slice(), cum_slice_length);
+                auto extra_items_to_copy = slice.size() / m_policy.copy_fraction_denominator;
+                auto new_slice = slice.extract(0, iter_point.index() + extra_items_to_copy);
+                _record_copy(&kernel_stats::m_iteration_copies, new_slice.size(), true);
+                _update_slice_lengths(iter_point.slice(), -1 * new_slice.size());
                 slice.m_start_index += iter_point.index() + extra_items_to_copy;
-                m_slices.insert(m_slices.begin() + iter_point.slice(), new_slice);
+                m_slices.insert(iter_point.slice(), new_slice);
+                _record_stat(&kernel_stats::m_slices_created);
                 return slice_point(iter_point.slice(), iter_point.index());
             } else {
                 // copy to end of slice
                 auto items_to_copy = slice.size() - iter_point.index();
-                if (items_to_copy < config_traits::cow_ops::slice_edge_offset)
-                    items_to_copy = config_traits::cow_ops::slice_edge_offset;
+                if (items_to_copy < m_policy.slice_edge_offset)
+                    items_to_copy = m_policy.slice_edge_offset;
 
                 auto slice_size = slice.size();
-                auto new_slice = slice.copy(slice_size - items_to_copy);
-                auto cum_slice_length = m_cum_slice_lengths[iter_point.slice()] - items_to_copy;
-                m_cum_slice_lengths.insert(m_cum_slice_lengths.begin() + iter_point.slice(), cum_slice_length);
+                auto new_slice = slice.extract(slice_size - items_to_copy);
+                _record_copy(&kernel_stats::m_iteration_copies, items_to_copy, true);
+                _update_slice_lengths(iter_point.slice(), -1 * items_to_copy);
                 slice.m_end_index -= items_to_copy;
-                m_slices.insert(m_slices.begin() + iter_point.slice() + 1, new_slice);
+                m_slices.insert(iter_point.slice() + 1, new_slice);
+                _record_stat(&kernel_stats::m_slices_created);
                 return slice_point(iter_point.slice() + 1, iter_point.index() - (slice_size - items_to_copy));
             }
         }
@@ -225,11 +575,12 @@ namespace snapshot_container {
             if (insert_point.slice() >= m_slices.size()) {
                 throw std::logic_error("Invalid cow point in call to cow_ops");
             }
+            _count_op(m_op_counts.m_inserts);
 
-            size_t copy_fraction = config_traits::cow_ops::copy_fraction_denominator;
+            size_t copy_fraction = m_policy.copy_fraction_denominator;
             auto& slice = m_slices[insert_point.slice()];
             if (slice.is_modifiable()) {
-                if (m_slices.size() > config_traits::num_slices_hwm ||
+                if (m_slices.size() > m_policy.num_slices_hwm ||
                     insert_point.index() <= slice.size() / copy_fraction || insert_point.index() + slice.size() / copy_fraction >= slice.size()) {
                     // insert point reasonably near one end of the slice so inserts will be reasonably fast here.
                     // also insert directly into slice if the number of slices is above hwm.
@@ -237,18 +588,19 @@ namespace snapshot_container {
                 }
             }
 
-            if (m_slices.size() > config_traits::num_slices_hwm || slice.size() <= config_traits::cow_ops::max_insertion_copy_size) {
-                auto new_slice = slice.copy(0);
+            if (m_slices.size() > m_policy.num_slices_hwm || slice.size() <= m_policy.max_insertion_copy_size) {
+                auto new_slice = slice.extract(0);
+                _record_copy(&kernel_stats::m_insert_copies, new_slice.size(), true);
                 m_slices[insert_point.slice()] = new_slice;
                 return insert_point;
             }
 
             // avoid some corner cases where split point is near the beginning or end of the slice.
             auto copy_index = insert_point.index();
-            if (copy_index < config_traits::cow_ops::slice_edge_offset)
-                copy_index = config_traits::cow_ops::slice_edge_offset;
-            else if (copy_index + config_traits::cow_ops::slice_edge_offset >= slice.size())
-                copy_index = slice.size() - config_traits::cow_ops::slice_edge_offset;
+            if (copy_index < m_policy.slice_edge_offset)
+                copy_index = m_policy.slice_edge_offset;
+            else if (copy_index + m_policy.slice_edge_offset >= slice.size())
+                copy_index = slice.size() - m_policy.slice_edge_offset;
 
 
             // This idiom copies on average 1/4 of the elements in slice to create an insertion point
@@ -257,37 +609,42 @@ namespace snapshot_container {
                 if (_is_prev_slice_modifiable(insert_point.slice())) {
                     auto& prev_slice = m_slices[insert_point.slice() - 1];
                     auto prev_slice_size = prev_slice.size();
-                    prev_slice.append(slice.begin(), slice.begin() + copy_index);
-                    m_cum_slice_lengths[insert_point.slice() - 1] += copy_index;
+                    prev_slice.append_extract(slice, 0, copy_index);
+                    _record_copy(&kernel_stats::m_insert_copies, copy_index, false);
+                    _update_slice_lengths(insert_point.slice() - 1, copy_index);
+                    _update_slice_lengths(insert_point.slice(), -1 * copy_index);
                     slice.m_start_index += copy_index;
                     return slice_point(insert_point.slice() - 1, prev_slice_size + insert_point.index());
                 }
 
                 auto items_to_copy = copy_index;
-                auto new_slice = slice_t(m_storage_creator(slice.begin(), slice.begin() + items_to_copy), 0);
-                m_cum_slice_lengths.insert(m_cum_slice_lengths.begin() + insert_point.slice() + 1, m_cum_slice_lengths[insert_point.slice()]);
-                m_cum_slice_lengths[insert_point.slice()] = m_cum_slice_lengths[insert_point.slice()] - m_slices[insert_point.slice()].size() + items_to_copy;
-                m_slices.insert(m_slices.begin() + insert_point.slice(), new_slice);
+                auto new_slice = slice_t(_create_storage(), 0);
+                new_slice.append_extract(slice, 0, items_to_copy);
+                _record_copy(&kernel_stats::m_insert_copies, items_to_copy, false);
+                _update_slice_lengths(insert_point.slice(), -1 * items_to_copy);
+                m_slices.insert(insert_point.slice(), new_slice);
+                _record_stat(&kernel_stats::m_slices_created);
 
                 m_slices[insert_point.slice() + 1].m_start_index += items_to_copy;
                 return slice_point(insert_point.slice(), insert_point.index());
             } else {
                 auto items_to_copy = slice.size() - copy_index;
-                auto new_slice = slice_t(m_storage_creator(slice.end() - items_to_copy, slice.end()), 0);
-                m_cum_slice_lengths.insert(m_cum_slice_lengths.begin() + insert_point.slice(), m_cum_slice_lengths[insert_point.slice()] - items_to_copy);
+                auto new_slice = slice_t(_create_storage(), 0);
+                new_slice.append_extract(slice, slice.size() - items_to_copy);
+                _record_copy(&kernel_stats::m_insert_copies, items_to_copy, false);
+                _update_slice_lengths(insert_point.slice(), -1 * items_to_copy);
                 slice.m_end_index -= items_to_copy;
-                m_slices.insert(m_slices.begin() + insert_point.slice() + 1, new_slice);
+                m_slices.insert(insert_point.slice() + 1, new_slice);
+                _record_stat(&kernel_stats::m_slices_created);
                 return slice_point(insert_point.slice() + 1, insert_point.index() - copy_index);
             }
         }
 
         size_t container_index(const slice_point & slice_pos) const {
-            if (m_cum_slice_lengths.size() < slice_pos.slice())
-                return m_cum_slice_lengths[m_cum_slice_lengths.size() - 1];
+            if (slice_pos.slice() >= m_slices.size())
+                return m_slices.total();
 
-            auto slice = m_slices[slice_pos.slice()];
-            auto size_upto_slice = m_cum_slice_lengths[slice_pos.slice()];
-            return (size_upto_slice + slice_pos.index() - slice.size());
+            return m_slices.offset(slice_pos.slice()) + slice_pos.index();
         }
 
         slice_point slice_index(size_t container_index) const {
@@ -296,16 +653,19 @@ namespace snapshot_container {
             // Out of bounds index accesses return the end iterator position.
 
             // handle some common cases fast
-            if (container_index < m_slices[0].size()) {
-                return (slice_point(0, m_slices[0].size() + container_index - m_cum_slice_lengths[0]));
-            } else if (m_cum_slice_lengths.size() > 1 && container_index >= m_cum_slice_lengths[m_cum_slice_lengths.size() - 2]) {
-                if (container_index < m_cum_slice_lengths[m_cum_slice_lengths.size() - 1]) {
-                    return slice_point(m_cum_slice_lengths.size() - 1,
-                        m_slices[m_cum_slice_lengths.size() - 1].size() + container_index - m_cum_slice_lengths[m_cum_slice_lengths.size() - 1]);
+            if (container_index < m_slices.length(0)) {
+                _record_stat(&kernel_stats::m_fast_lookups);
+                return slice_point(0, container_index);
+            } else if (m_slices.size() > 1 && container_index >= m_slices.offset(m_slices.size() - 1)) {
+                _record_stat(&kernel_stats::m_fast_lookups);
+                if (container_index < m_slices.total()) {
+                    return slice_point(m_slices.size() - 1,
+                        container_index - m_slices.offset(m_slices.size() - 1));
                 } else {
                     return end();
                 }
-            } else if (m_cum_slice_lengths.size() > 1) {
+            } else if (m_slices.size() > 1) {
+                _record_stat(&kernel_stats::m_binary_lookups);
                 return _slice_index_binary(container_index);
             } else {
                 return end();
@@ -314,6 +674,7 @@ namespace snapshot_container {
 
         slice_point insert(const slice_point& insert_before, const T & value) {
             // insert value into the container respecting snapshots
+            auto timer = _time_op(&kernel_latencies::m_insert);
             _incr_update_count();
             slice_point insert_pos = _insert_cow_ops(insert_before);
             m_slices[insert_pos.slice()].insert(insert_pos.index(), value);
@@ -321,8 +682,68 @@ namespace snapshot_container {
             return insert_pos;
         }
 
+        slice_point insert(const slice_point& insert_before, T && value) {
+            auto timer = _time_op(&kernel_latencies::m_insert);
+            _incr_update_count();
+            slice_point insert_pos = _insert_cow_ops(insert_before);
+            m_slices[insert_pos.slice()].insert(insert_pos.index(), std::move(value));
+            _update_slice_lengths(insert_pos.slice(), 1);
+            return insert_pos;
+        }
+
+        // Storage only supports insertion of constructed values so the value is constructed and then moved in.
+        template <typename... Args>
+        slice_point emplace(const slice_point& insert_before, Args&&... args) {
+            return insert(insert_before, T(std::forward<Args>(args)...));
+        }
+
+        // An empty slice on new storage from the kernel's storage creator, to be filled and passed to insert_slice or
+        // append_slice. The storage is counted in the kernel's stats.
+        slice_t create_slice() const {
+            return slice_t(_create_storage(), 0);
+        }
+
+        // Inserts the elements of new_slice before insert_before without copying them. The slice at insert_before
+        // is split if necessary. new_slice must not be referenced elsewhere if it is to be modifiable.
+        slice_point insert_slice(const slice_point& insert_before, const slice_t& new_slice) {
+            if (insert_before.slice() >= m_slices.size())
+                throw std::logic_error("Invalid slice_point to insert_slice");
+
+            if (new_slice.size() == 0)
+                return insert_before;
+
+            _incr_update_count();
+            if (size() == 0) {
+                // replace the empty slice which is always present in an empty kernel
+                m_slices.clear();
+                m_slices.push_back(new_slice);
+                return slice_point(0, 0);
+            }
+
+            auto slice_number = insert_before.slice();
+            auto index = insert_before.index();
+            _record_stat(&kernel_stats::m_slices_created);
+            if (index == 0) {
+                m_slices.insert(slice_number, new_slice);
+                return slice_point(slice_number, 0);
+            }
+
+            auto& slice = m_slices[slice_number];
+            if (index < slice.size()) {
+                auto tail = slice;
+                tail.m_start_index += index;
+                _update_slice_lengths(slice_number, -1 * tail.size());
+                slice.m_end_index = slice.m_start_index + index;
+                m_slices.insert(slice_number + 1, tail);
+                _record_stat(&kernel_stats::m_slices_created);
+            }
+            m_slices.insert(slice_number + 1, new_slice);
+            return slice_point(slice_number + 1, 0);
+        }
+
         template <typename IterType >
             slice_point insert(const slice_point& insert_before, const IterType& start_pos, const IterType & end_pos) {
+            auto timer = _time_op(&kernel_latencies::m_insert);
             _incr_update_count();
             slice_point insert_pos = _insert_cow_ops(insert_before);
             auto elems_before_insert = m_slices[insert_pos.slice()].size();
@@ -333,33 +754,30 @@ namespace snapshot_container {
             return insert_pos;
         }
 
-        void _update_slice_lengths(size_t begin_index, ssize_t adjustment) {
-            for (auto itr = m_cum_slice_lengths.begin() + begin_index; itr != m_cum_slice_lengths.end(); ++itr)
-                *itr += adjustment;
+        void _update_slice_lengths(size_t slice, ssize_t adjustment) {
+            m_slices.adjust(slice, adjustment);
         }
 
         slice_point _drop_slice(size_t slice) {
             // Note that this erase occurs irrespective of the ref counts on the slice.
-            auto drop_slice_size = m_slices[slice].size();
-            m_cum_slice_lengths.erase(m_cum_slice_lengths.begin() + slice);
-            m_slices.erase(m_slices.begin() + slice);
-            if (m_cum_slice_lengths.size() == 0) {
+            m_slices.erase(slice);
+            _record_stat(&kernel_stats::m_slices_dropped);
+            if (m_slices.size() == 0) {
                 // push on an empty slice as there must always be at least one slice in the deck
-                m_cum_slice_lengths.push_back(0);
-                m_slices.push_back(slice_t(m_storage_creator(), 0));
-            } else {
-                _update_slice_lengths(slice, -1 * drop_slice_size);
+                m_slices.push_back(slice_t(_create_storage(), 0));
             }
 
             return slice_point(slice, 0);
         }
 
         slice_point remove(const slice_point & remove_pos) {
+            auto timer = _time_op(&kernel_latencies::m_remove);
             _incr_update_count();
+            _count_op(m_op_counts.m_removes);
 
             // Remove element at the specified slice point
             // Returns iterator to element after deletion.
-            if (remove_pos.slice() >= m_cum_slice_lengths.size())
+            if (remove_pos.slice() >= m_slices.size())
                 throw std::logic_error("Invalid slice_point to remove");
 
             auto& slice = m_slices[remove_pos.slice()];
@@ -377,8 +795,9 @@ namespace snapshot_container {
             } else {
                 // TODO: Improve on this logic by minimizing copying.
                 auto new_slice = slice.copy(0);
-                m_slices[remove_pos.slice()] = new_slice;
+                _record_copy(&kernel_stats::m_remove_copies, new_slice.size(), true);
                 new_slice.remove(remove_pos.index());
+                m_slices[remove_pos.slice()] = new_slice;
                 return remove_pos;
             }
         }
@@ -404,9 +823,10 @@ namespace snapshot_container {
                 } else {
                     // an inner range of the slice is to be removed.
                     auto new_slice = slice.copy(0, start_pos.index());
-                    new_slice.append(slice.begin() + end_pos.index(), slice.end());
+                    new_slice.append(slice, end_pos.index());
                     m_slices[start_pos.slice()] = new_slice;
                 }
+                _record_copy(&kernel_stats::m_remove_copies, m_slices[start_pos.slice()].size(), true);
             } else {
                 slice.remove(start_pos.index(), end_pos.index());
             }
@@ -418,7 +838,9 @@ namespace snapshot_container {
         }
 
         slice_point remove(const slice_point& start_pos, const slice_point & end_pos) {
+            auto timer = _time_op(&kernel_latencies::m_remove);
             _incr_update_count();
+            _count_op(m_op_counts.m_removes);
             if (start_pos.slice() >= m_slices.size() || end_pos.slice() >= m_slices.size()) {
                 throw std::logic_error("Invalid slice_point values passed to remove");
             }
@@ -482,7 +904,7 @@ namespace snapshot_container {
         }
 
         slice_point begin() const {
-            if (m_cum_slice_lengths[0] > 0)
+            if (m_slices.cum_length(0) > 0)
                 return slice_point(0, 0);
             else
                 return end();
@@ -538,25 +960,26 @@ namespace snapshot_container {
             return end();
         }
 
-        static std::shared_ptr<_iterator_kernel<T, StorageCreator >> create(const StorageCreator & creator) {
-            return std::make_shared<_iterator_kernel<T, StorageCreator >> (creator);
+        static handle_t create(const StorageCreator & creator) {
+            return config_traits::template make_handle<_iterator_kernel> (creator);
         }
 
         template <typename IterType>
-            static std::shared_ptr<_iterator_kernel<T, StorageCreator >> create(const StorageCreator& creator,
+            static handle_t create(const StorageCreator& creator,
             IterType begin_pos, IterType end_pos) {
-            return std::make_shared<_iterator_kernel<T, StorageCreator >> (creator, begin_pos, end_pos);
+            return config_traits::template make_handle<_iterator_kernel> (creator, begin_pos, end_pos);
         }
 
-        static std::shared_ptr<_iterator_kernel<T, StorageCreator >> create(const std::shared_ptr<_iterator_kernel<T, StorageCreator>>&rhs) {
-            if (rhs)
-                return std::make_shared<_iterator_kernel < T, StorageCreator >> (*rhs);
-            else
+        static handle_t create(const handle_t&rhs) {
+            if (rhs) {
+                auto timer = rhs->_time_op(&kernel_latencies::m_snapshot);
+                return config_traits::template make_handle<_iterator_kernel> (*rhs);
+            } else
                 throw std::logic_error("Called create with an empty shared pointer");
         }
 
         size_t size() const noexcept {
-            return *(m_cum_slice_lengths.end() - 1);
+            return m_slices.total();
         }
 
         size_t num_slices() const {
@@ -576,6 +999,38 @@ namespace snapshot_container {
             return num_slices() * (1.0 - (num_elements / storage_size));
         }
 
+        // Calls f with each contiguous block of elements between start_index and end_index in order. This is much
+        // faster than iteration for scans since the loop over each segment is free of virtual calls and bookkeeping.
+        // If f returns bool, iteration stops when f returns false. Returns false if iteration was stopped by f.
+        template <typename Function>
+        bool for_each_segment(size_t start_index, size_t end_index, Function&& f) const {
+            if (end_index > size())
+                end_index = size();
+            if (start_index >= end_index)
+                return true;
+
+            auto pos = slice_index(start_index);
+            size_t remaining = end_index - start_index;
+            for (size_t slice = pos.slice(), index = pos.index(); remaining > 0; ++slice, index = 0) {
+                auto& current_slice = m_slices[slice];
+                while (index < current_slice.size() && remaining > 0) {
+                    auto segment = current_slice.contiguous_segment(index);
+                    if (segment.size() > remaining)
+                        segment = segment_t(segment.data(), remaining);
+
+                    if constexpr(std::is_same<decltype(f(segment)), bool>::value) {
+                        if (!f(segment))
+                            return false;
+                    } else {
+                        f(segment);
+                    }
+                    index += segment.size();
+                    remaining -= segment.size();
+                }
+            }
+            return true;
+        }
+
         template <typename IterType >
             slice_point append(const IterType& start_pos, const IterType & end_pos) {
             // Append creates a new slice with the requisite elements and add this to the end
@@ -584,17 +1039,32 @@ namespace snapshot_container {
             if (start_pos == end_pos)
                 return end();
 
+            auto timer = _time_op(&kernel_latencies::m_append);
             _incr_update_count();
 
             auto pre_append_size = size();
-            if (pre_append_size == 0) {
+            if (pre_append_size == 0)
                 m_slices.clear();
-                m_cum_slice_lengths.clear();
-            }
 
-            auto new_slice = slice_t(m_storage_creator(start_pos, end_pos), 0);
-            m_slices.push_back(new_slice);
-            m_cum_slice_lengths.push_back(pre_append_size + new_slice.size());
+            m_slices.push_back(slice_t(_create_storage(start_pos, end_pos), 0));
+            _record_stat(&kernel_stats::m_slices_created);
+            return slice_index(pre_append_size);
+        }
+
+        // Appends the elements of slice to the container without copying them. Like insert_slice, slice must not be
+        // referenced elsewhere if it is to be modifiable.
+        slice_point append_slice(const slice_t& slice) {
+            if (slice.size() == 0)
+                return end();
+
+            _incr_update_count();
+
+            auto pre_append_size = size();
+            if (pre_append_size == 0)
+                m_slices.clear();
+
+            m_slices.push_back(slice);
+            _record_stat(&kernel_stats::m_slices_created);
             return slice_index(pre_append_size);
         }
 
@@ -602,11 +1072,7 @@ namespace snapshot_container {
             // Check for referential integrity. Returns true if check passes and false otherwise
             // 1. size integrity
             // 2. slice length integrity
-
-            if (m_cum_slice_lengths.size() != m_slices.size()) {
-                std::cerr << "Slices and cum slice lengths don't have same size" << std::endl;
-                return false;
-            }
+            // 3. slice length index integrity
 
             size_t expected_total_size = size();
             size_t actual_total_size = 0;
@@ -620,17 +1086,29 @@ namespace snapshot_container {
             }
 
             size_t size_upto_here = 0;
-            for (size_t i = 0; i < m_cum_slice_lengths.size(); ++i) {
-                if (m_cum_slice_lengths[i] - size_upto_here != m_slices[i].size()) {
-                    std::cerr << "Referential integrity break at slice index " << i << std::endl;
+            size_t slice_index = 0;
+            for (auto& slice : m_slices) {
+                if (m_slices.cum_length(slice_index) - size_upto_here != slice.size()) {
+                    std::cerr << "Referential integrity break at slice index " << slice_index << std::endl;
                     std::cerr << "Total slices: " << m_slices.size() << std::endl;
-                    std::cerr << "Cum size: " << m_cum_slice_lengths[i] << std::endl;
+                    std::cerr << "Cum size: " << m_slices.cum_length(slice_index) << std::endl;
                     std::cerr << "Prev cum size: " << size_upto_here << std::endl;
-                    std::cerr << "Expected size: " << m_cum_slice_lengths[i] - size_upto_here << std::endl;
-                    std::cerr << "Actual size: " << m_slices[i].size() << std::endl;
+                    std::cerr << "Expected size: " << m_slices.cum_length(slice_index) - size_upto_here << std::endl;
+                    std::cerr << "Actual size: " << slice.size() << std::endl;
+                    return false;
+                }
+                size_upto_here = m_slices.cum_length(slice_index);
+                ++slice_index;
+            }
+
+            if (!m_slices.integrity_check())
+                return false;
+
+            for (size_t i = 0; i < m_slices.size(); ++i) {
+                if (m_slices.find(m_slices.offset(i)) != i && m_slices.length(i) > 0) {
+                    std::cerr << "Slice length index lookup mismatch at slice index " << i << std::endl;
                     return false;
                 }
-                size_upto_here = m_cum_slice_lengths[i];
             }
 
             return true;
@@ -639,16 +1117,99 @@ namespace snapshot_container {
         void clear() {
             _incr_update_count();
             m_slices.clear();
-            m_cum_slice_lengths.clear();
 
             // must always be a slice in the deck
-            m_cum_slice_lengths.push_back(0);
-            m_slices.push_back(slice_t(m_storage_creator(), 0));
+            m_slices.push_back(slice_t(_create_storage(), 0));
         }
 
         void push_back(const T & t) {
+            auto timer = _time_op(&kernel_latencies::m_append);
             _incr_update_count();
-            m_slices[m_slices.size() - 1].append(t);
+            auto slice = _push_back_slice();
+            m_slices[slice].append(t);
+            _update_slice_lengths(slice, 1);
+        }
+
+        void push_back(T && t) {
+            auto timer = _time_op(&kernel_latencies::m_append);
+            _incr_update_count();
+            auto slice = _push_back_slice();
+            m_slices[slice].append(std::move(t));
+            _update_slice_lengths(slice, 1);
+        }
+
+        // By default push_back appends to the storage of the last slice when the slice ends at the end of the storage,
+        // even when the storage is shared with snapshots, since snapshot slices end before the appended elements. Appending may however move the internals
+        // of the storage so snapshots read by other threads while the container is modified require this to be
+        // false. Appends then go to new storage once the last slice is shared.
+        void set_append_in_place(bool append_in_place) {
+            m_append_in_place = append_in_place;
+        }
+
+        bool append_in_place() const {
+            return m_append_in_place;
+        }
+
+        // The thresholds used by cow ops. Defaults to the values of config_traits. Adaptive policies are adjusted by
+        // the kernel as it is modified (see cow_policy::adapted).
+        const cow_policy& get_cow_policy() const {
+            return m_policy;
+        }
+
+        void set_cow_policy(const cow_policy& policy) {
+            m_policy = policy;
+            m_op_counts = cow_op_counts();
+            m_ops_since_adapt = 0;
+        }
+
+        const cow_op_counts& op_counts() const {
+            return m_op_counts;
+        }
+
+        // Statistics since the kernel was created or reset_stats was called. All zero unless
+        // config_traits::collect_stats is true. Snapshots start with zero statistics.
+        kernel_stats stats() const {
+            if constexpr (config_traits::collect_stats)
+                return m_stats;
+            else
+                return kernel_stats();
+        }
+
+        void reset_stats() {
+            if constexpr (config_traits::collect_stats)
+                m_stats = kernel_stats();
+        }
+
+        // Bytes of storage referenced by the kernel. Storage referenced by slices which are shared with another
+        // kernel through the slice table counts as shared. Costs O(number of slices).
+        storage_usage memory_usage() const {
+            _storage_accounting accounting;
+            size_t slice_index = 0;
+            for (auto& slice : m_slices)
+                accounting.add(this, slice, m_slices.exclusive(slice_index++));
+            return accounting.result();
+        }
+
+        // Latency histograms since the kernel was created or reset_latencies was called. Empty unless
+        // config_traits::collect_latencies is true.
+        kernel_latencies latencies() const {
+            if constexpr (config_traits::collect_latencies)
+                return m_latencies;
+            else
+                return kernel_latencies();
+        }
+
+        void reset_latencies() {
+            if constexpr (config_traits::collect_latencies)
+                m_latencies = kernel_latencies();
+        }
+
+        // Returns a reference to the new element. The reference is only valid until the next modification.
+        template <typename... Args>
+        T& emplace_back(Args&&... args) {
+            push_back(T(std::forward<Args>(args)...));
+            auto& slice = m_slices[m_slices.size() - 1];
+            return slice[slice.size() - 1];
         }
 
         void pop_back() {
@@ -661,14 +1222,7 @@ namespace snapshot_container {
             _incr_update_count();
             rhs._incr_update_count();
 
-            auto slices = m_slices;
-            auto lengths = m_cum_slice_lengths;
-
-            m_slices = rhs.m_slices;
-            m_cum_slice_lengths = rhs.m_cum_slice_lengths;
-
-            rhs.m_slices = slices;
-            rhs.m_cum_slice_lengths = lengths;
+            std::swap(m_slices, rhs.m_slices);
         }
 
         storage_creator_t& get_storage_creator() const
@@ -676,6 +1230,12 @@ namespace snapshot_container {
             return m_storage_creator;
         }
 
+        // The slice table. This is for abstractions which work at the level of storage e.g. serialization.
+        const slice_table_t& slices() const
+        {
+            return m_slices;
+        }
+
         std::vector<size_t> storage_ids() const
         {
             std::vector<size_t> result(m_slices.size());
@@ -683,6 +1243,170 @@ namespace snapshot_container {
                 result.push_back(slice.id());
             return result;
         }
+
+        // Slices [m_first_slice, m_last_slice) which compaction merges into a single slice of m_size elements.
+        struct compaction_run {
+            size_t m_first_slice;
+            size_t m_last_slice;
+            size_t m_size;
+        };
+
+        // Runs of two or more consecutive small slices (see cow_policy::small_slice_size) in order. The runs hold at
+        // most budget elements in total, which is the number of elements merging them copies.
+        std::vector<compaction_run> compaction_runs(size_t budget = npos) const {
+            std::vector<compaction_run> result;
+            compaction_run run{0, 0, 0};
+            auto end_run = [&result, &run, &budget](size_t next_slice) {
+                if (run.m_last_slice - run.m_first_slice >= 2) {
+                    result.push_back(run);
+                    budget -= run.m_size;
+                }
+                run = compaction_run{next_slice, next_slice, 0};
+            };
+
+            size_t slice_index = 0;
+            for (auto& slice : m_slices) {
+                auto slice_size = slice.size();
+                auto small = slice_size > 0 && slice_size < m_policy.small_slice_size;
+                if (!small || run.m_size + slice_size > m_policy.max_merged_size ||
+                    run.m_size + slice_size > budget) {
+                    end_run(slice_index);
+                    if (!small || slice_size > budget)
+                        run = compaction_run{slice_index + 1, slice_index + 1, 0};
+                }
+                if (run.m_last_slice == slice_index) {
+                    run.m_last_slice = slice_index + 1;
+                    run.m_size += slice_size;
+                }
+                ++slice_index;
+            }
+            end_run(slice_index);
+            return result;
+        }
+
+        // A slice holding the elements of slices [first_slice, last_slice) in new storage.
+        slice_t merged_slice(size_t first_slice, size_t last_slice) const {
+            slice_t result(_create_storage(), 0);
+            for (auto slice = first_slice; slice < last_slice; ++slice)
+                result.append(m_slices[slice]);
+            return result;
+        }
+
+        // Merges the runs of small slices given by compaction_runs(budget). Returns the number of slices removed.
+        size_t compact(size_t budget = npos) {
+            auto runs = compaction_runs(budget);
+            size_t removed = 0;
+            // Runs are merged back to front so the slice indices of the remaining runs stay valid.
+            for (auto run = runs.rbegin(); run != runs.rend(); ++run) {
+                _replace_slices(run->m_first_slice, run->m_last_slice, merged_slice(run->m_first_slice, run->m_last_slice));
+                removed += run->m_last_slice - run->m_first_slice - 1;
+            }
+            return removed;
+        }
+
+        // Replaces the slices starting at first_slice with merged if they are the slices in expected, which is the
+        // case if the kernel has not been modified there since merged was built from expected. Returns false, leaving
+        // the kernel unchanged, otherwise.
+        bool replace_slices(size_t first_slice, const std::vector<slice_t>& expected, const slice_t& merged) {
+            if (first_slice + expected.size() > m_slices.size())
+                return false;
+
+            for (size_t i = 0; i < expected.size(); ++i) {
+                if (!(std::as_const(m_slices)[first_slice + i] == expected[i]))
+                    return false;
+            }
+            _replace_slices(first_slice, first_slice + expected.size(), merged);
+            return true;
+        }
+
+        // Copies the elements within slices of storage elements which only this kernel references to new storage when
+        // the slices reach at most max_live_fraction of the elements. This frees elements cut off by cow ops once the
+        // snapshots sharing them are gone (see storage_usage::m_dead_bytes). Storage elements with the most dead bytes
+        // are copied first until at least target_bytes are freed. Returns the number of bytes freed.
+        size_t trim_dead_storage(double max_live_fraction = 0.5, size_t target_bytes = npos) {
+            struct candidate {
+                std::vector<size_t> m_slices;
+                std::vector<std::pair<size_t, size_t>> m_live_ranges;
+                size_t m_dead_bytes = 0;
+                bool m_exclusive = true;
+            };
+
+            std::unordered_map<const storage_t*, candidate> storages;
+            size_t slice_index = 0;
+            for (auto& slice : std::as_const(m_slices)) {
+                if (slice.m_storage && slice.size() > 0) {
+                    auto& storage = storages[slice.m_storage.get()];
+                    storage.m_slices.push_back(slice_index);
+                    storage.m_exclusive = storage.m_exclusive && m_slices.exclusive(slice_index);
+                }
+                ++slice_index;
+            }
+
+            std::vector<candidate*> candidates;
+            for (auto& entry : storages) {
+                auto& storage = entry.second;
+                auto& first_slice = std::as_const(m_slices)[storage.m_slices.front()];
+                if (!storage.m_exclusive || first_slice.m_storage.use_count() != static_cast<long>(storage.m_slices.size()))
+                    continue;
+
+                for (auto slice : storage.m_slices)
+                    storage.m_live_ranges.emplace_back(std::as_const(m_slices)[slice].m_start_index,
+                                                       std::as_const(m_slices)[slice].m_end_index);
+                std::sort(storage.m_live_ranges.begin(), storage.m_live_ranges.end());
+                size_t live = 0;
+                size_t merged = 0;
+                for (auto& range : storage.m_live_ranges) {
+                    if (merged > 0 && range.first <= storage.m_live_ranges[merged - 1].second) {
+                        auto& last = storage.m_live_ranges[merged - 1];
+                        live += range.second > last.second ? range.second - last.second : 0;
+                        last.second = std::max(last.second, range.second);
+                    } else {
+                        live += range.second - range.first;
+                        storage.m_live_ranges[merged++] = range;
+                    }
+                }
+                storage.m_live_ranges.resize(merged);
+
+                auto storage_size = first_slice.m_storage->size();
+                if (live < storage_size && live <= max_live_fraction * storage_size) {
+                    storage.m_dead_bytes = (storage_size - live) * sizeof(T);
+                    candidates.push_back(&storage);
+                }
+            }
+
+            std::sort(candidates.begin(), candidates.end(), [](const candidate* lhs, const candidate* rhs) {
+                return lhs->m_dead_bytes > rhs->m_dead_bytes;
+            });
+
+            size_t freed = 0;
+            for (auto storage : candidates) {
+                if (freed >= target_bytes)
+                    break;
+
+                // The live ranges are copied back to back into the new storage and the slices moved onto it. Slice
+                // lengths do not change.
+                auto old_storage = std::as_const(m_slices)[storage->m_slices.front()].m_storage;
+                slice_t live(_create_storage(), 0);
+                std::vector<size_t> range_offsets;
+                for (auto& range : storage->m_live_ranges) {
+                    range_offsets.push_back(live.size());
+                    live.append(slice_t(old_storage, range.first, range.second));
+                }
+
+                for (auto slice : storage->m_slices) {
+                    auto& current = m_slices[slice];
+                    auto range = std::upper_bound(storage->m_live_ranges.begin(), storage->m_live_ranges.end(),
+                                                  std::make_pair(current.m_start_index, npos)) - 1;
+                    auto start = range_offsets[range - storage->m_live_ranges.begin()] + current.m_start_index - range->first;
+                    current = slice_t(live.m_storage, start, start + current.size());
+                }
+                freed += storage->m_dead_bytes;
+            }
+
+            if (freed)
+                _incr_update_count();
+            return freed;
+        }
         
 #ifndef _SNAPSHOTCONTAINER_TEST
         private:
@@ -692,48 +1416,123 @@ namespace snapshot_container {
             return m_update_count;
         }
 
-        void _incr_update_count() {
+        void _incr_update_count() const {
             ++m_update_count;
         }
 
+        // Counts an operation and recomputes an adaptive policy every adapt_interval operations. Counts decay by half
+        // at each recomputation so the policy follows changes in the mix of operations.
+        void _count_op(size_t& count) {
+            ++count;
+            if (m_policy.adaptive && ++m_ops_since_adapt >= cow_policy::adapt_interval) {
+                m_policy = cow_policy::adapted<config_traits>(m_op_counts, sizeof(T));
+                m_op_counts.m_inserts /= 2;
+                m_op_counts.m_removes /= 2;
+                m_op_counts.m_iteration_writes /= 2;
+                m_op_counts.m_snapshots /= 2;
+                m_ops_since_adapt = 0;
+            }
+        }
+
+        // Statistics are only recorded when config_traits::collect_stats is true.
+        void _record_stat(size_t kernel_stats::* counter, size_t count = 1) const {
+            if constexpr (config_traits::collect_stats)
+                m_stats.*counter += count;
+        }
+
+        void _record_copy(cow_copy_stats kernel_stats::* path, size_t elements, bool new_storage) const {
+            if constexpr (config_traits::collect_stats) {
+                auto& copies = m_stats.*path;
+                ++copies.m_copies;
+                copies.m_elements += elements;
+                copies.m_bytes += elements * sizeof(T);
+                if (new_storage)
+                    ++m_stats.m_storage_allocations;
+            }
+        }
+
+        void _register() const {
+            if constexpr (config_traits::register_kernels)
+                kernel_registry<_iterator_kernel>::instance().add(this);
+        }
+
+        typedef _latency_timer<config_traits::collect_latencies, typename config_traits::latency_clock> _latency_timer_t;
+
+        _latency_timer_t _time_op(latency_histogram kernel_latencies::* op) const {
+            if constexpr (config_traits::collect_latencies)
+                return _latency_timer_t(m_latencies.*op);
+            else
+                return _latency_timer_t();
+        }
+
+        template <typename... Args>
+        decltype(auto) _create_storage(Args&&... args) const {
+            _record_stat(&kernel_stats::m_storage_allocations);
+            return m_storage_creator(std::forward<Args>(args)...);
+        }
+
+        void _replace_slices(size_t first_slice, size_t last_slice, const slice_t& merged) {
+            _incr_update_count();
+            for (auto slice = last_slice; slice-- > first_slice;)
+                m_slices.erase(slice);
+            m_slices.insert(first_slice, merged);
+            _record_stat(&kernel_stats::m_slices_merged, last_slice - first_slice - 1);
+        }
+
+        // The slice to append to. Appending extends the slice over the elements added to the end of its storage, so
+        // the last slice is only appended to if it ends at the end of its storage.
+        size_t _push_back_slice() {
+            auto last_slice = m_slices.size() - 1;
+            auto& slice = m_slices[last_slice];
+            if (slice.m_end_index == slice.storage_size() && (m_append_in_place || slice.m_storage.use_count() == 1))
+                return last_slice;
+
+            if (slice.size() == 0) {
+                // replace the empty slice which is always present in an empty kernel
+                slice = slice_t(_create_storage(), 0);
+                return last_slice;
+            }
+
+            m_slices.push_back(slice_t(_create_storage(), 0));
+            _record_stat(&kernel_stats::m_slices_created);
+            return last_slice + 1;
+        }
+
         slice_point _slice_index_binary(size_t container_index) const {
-            auto indices_pos = std::lower_bound(m_cum_slice_lengths.begin(), m_cum_slice_lengths.end(), container_index);
-            if (indices_pos == m_cum_slice_lengths.end())
+            auto slice_index = m_slices.find(container_index);
+            if (slice_index >= m_slices.size())
                 return end();
 
-            auto slice_index = indices_pos - m_cum_slice_lengths.begin();
-            if (container_index == m_cum_slice_lengths[slice_index]) {
-                slice_index += 1;
-                if (slice_index == m_cum_slice_lengths.size())
-                    return end();
-            }
-            auto& slice = m_slices[slice_index];
-            return slice_point(slice_index, slice.size() + container_index - m_cum_slice_lengths[slice_index]);
+            return slice_point(slice_index, container_index - m_slices.offset(slice_index));
         }
 
-        std::vector<slice_t> m_slices;
-        std::vector<size_t> m_cum_slice_lengths;
+        slice_table_t m_slices;
         mutable storage_creator_t m_storage_creator;
-        size_t m_update_count = 0; // indicator to iterators that state changed
+        mutable size_t m_update_count = 0; // indicator to iterators that state changed
+        bool m_append_in_place = true;
+        cow_policy m_policy = cow_policy::from_traits<config_traits>();
+        mutable cow_op_counts m_op_counts;
+        size_t m_ops_since_adapt = 0;
+
+        struct _no_stats {};
+        mutable std::conditional_t<config_traits::collect_stats, kernel_stats, _no_stats> m_stats;
+        mutable std::conditional_t<config_traits::collect_latencies, kernel_latencies, _no_stats> m_latencies;
     };
 
 
-    template <typename T, typename Ref, typename Ptr, typename StorageCreator>
-    class _iterator;
-
     // Implementation detail. Do not use directly.
     // TODO: Find a way to move this out of namespace scope.
-    template <typename T, typename Ref, typename Ptr, typename StorageCreator>
-    std::shared_ptr<_iterator_kernel<T, StorageCreator>> _extract_kernel(const _iterator<T, Ref, Ptr, StorageCreator>&);
+    template <typename T, typename Ref, typename Ptr, typename StorageCreator, typename ConfigTraits, unsigned Flags>
+    _iterator_kernel_ref<_iterator_kernel<T, StorageCreator, ConfigTraits>, Flags> _extract_kernel(const _iterator<T, Ref, Ptr, StorageCreator, ConfigTraits, Flags>&);
 
 
     // Implementation detail. Do not construct directly.
 
-    template<typename T, typename Ref, typename Ptr, typename StorageCreator>
+    template<typename T, typename Ref, typename Ptr, typename StorageCreator, typename ConfigTraits, unsigned Flags>
     class _iterator {
     public:
         static constexpr size_t npos = 0xFFFFFFFFFFFFFFFF;
-        using iterator_kernel_t = _iterator_kernel<T, StorageCreator>;
+        using iterator_kernel_t = _iterator_kernel<T, StorageCreator, ConfigTraits>;
         typedef typename iterator_kernel_t::slice_t slice_t;
         typedef typename iterator_kernel_t::slice_point slice_point;
         typedef std::random_access_iterator_tag iterator_category;
@@ -744,13 +1543,15 @@ namespace snapshot_container {
         typedef typename iterator_kernel_t::fwd_iter_type fwd_iter_type;
         typedef typename iterator_kernel_t::rand_iter_type rand_iter_type;
 
-        friend std::shared_ptr<iterator_kernel_t> _extract_kernel<>(const _iterator&);
+        typedef _iterator_kernel_ref<iterator_kernel_t, Flags> kernel_handle_t;
+
+        friend kernel_handle_t _extract_kernel<>(const _iterator&);
 
         _iterator() = default;
 
         // TODO: Only the higher container type should be able to use this constructor directly.
 
-        _iterator(const std::shared_ptr<iterator_kernel_t>& kernel, const slice_point& iter_pos) :
+        _iterator(const kernel_handle_t& kernel, const slice_point& iter_pos) :
             m_kernel(kernel),
             m_iter_pos(iter_pos),
             m_update_count(npos),
@@ -758,7 +1559,7 @@ namespace snapshot_container {
             m_container_index = m_kernel->container_index(m_iter_pos);
         }
 
-        _iterator(const std::shared_ptr<iterator_kernel_t>& kernel, size_t container_index) :
+        _iterator(const kernel_handle_t& kernel, size_t container_index) :
             m_kernel(kernel),
             m_iter_pos(),
             m_update_count(npos),
@@ -772,7 +1573,7 @@ namespace snapshot_container {
         template <typename Ref2, typename Ptr2,
         std::enable_if_t<std::is_same<std::remove_const_t<std::remove_reference_t<Ref>>, std::remove_reference_t<Ref2>>::value &&
         !std::is_same<Ref, Ref2>::value, int> = 0 >
-        _iterator(const _iterator<T, Ref2, Ptr2, StorageCreator>& rhs) :
+        _iterator(const _iterator<T, Ref2, Ptr2, StorageCreator, ConfigTraits, Flags>& rhs) :
             m_kernel(_extract_kernel(rhs)),
             m_iter_pos(),
             m_update_count(npos),
@@ -782,7 +1583,7 @@ namespace snapshot_container {
         // Used by higher level container type
 
         slice_point pos() const {
-            if (m_update_count == m_kernel->get_update_count())
+            if (_up_to_date())
                 return m_iter_pos;
 
             _prefix_plusplus_impl(0);
@@ -801,10 +1602,11 @@ namespace snapshot_container {
 
         template <typename Ref2, typename Ptr2,
         std::enable_if_t<std::is_same<std::remove_const_t<Ref>, Ref2>::value && !std::is_same<Ref, Ref2>::value, int> = 0 >
-        _iterator& operator=(const _iterator<T, Ref2, Ptr2, StorageCreator>& rhs) {
+        _iterator& operator=(const _iterator<T, Ref2, Ptr2, StorageCreator, ConfigTraits, Flags>& rhs) {
             m_kernel = rhs.m_kernel;
             m_container_index = rhs.m_container_index;
             m_update_count = npos;
+            _reset_slice_cache();
             return *this;
         }
 
@@ -906,7 +1708,7 @@ namespace snapshot_container {
                 return 0x7FFFFFFFFFFFFFFF;
 
             if (m_kernel && rhs.m_kernel == m_kernel)
-                return rhs.m_container_index - m_container_index;
+                return m_container_index - rhs.m_container_index;
             else
                 throw std::logic_error("Invalid iterator subtraction");
         }
@@ -948,16 +1750,17 @@ namespace snapshot_container {
             if (not m_kernel)
                 return *this;
 
-            if (incr == 1 && m_kernel->get_update_count() == m_update_count) {
+            if (incr == 1 && _up_to_date()) {
                 // the state of the underlying container has not changed since the last modification to the iterator
                 // thus cached state can be used to determine next iter position.
-                auto& current_slice = m_kernel->m_slices[m_iter_pos.slice()];
+                auto& current_slice = _current_slice();
                 if (current_slice.size() > m_iter_pos.index() + 1) {
                     m_iter_pos = slice_point(m_iter_pos.slice(), m_iter_pos.index() + 1);
                     m_container_index += 1;
                     return *this;
                 }
                 // move to next slice or to end pos
+                _reset_slice_cache();
                 if (m_iter_pos.slice() < m_kernel->m_slices.size() - 1) {
                     m_iter_pos = slice_point(m_iter_pos.slice() + 1, 0);
                 } else {
@@ -969,6 +1772,7 @@ namespace snapshot_container {
 
             m_update_count = m_kernel->get_update_count();
             m_iter_pos = m_kernel->slice_index(m_container_index + incr);
+            _reset_slice_cache();
 
             if (m_iter_pos.slice() < m_kernel->m_slices.size())
                 m_container_index += incr;
@@ -989,7 +1793,7 @@ namespace snapshot_container {
             if (not m_kernel)
                 return *this;
 
-            if (decr == 1 && m_kernel->get_update_count() == m_update_count) {
+            if (decr == 1 && _up_to_date()) {
                 if (m_iter_pos.index() > 0) {
                     m_iter_pos = slice_point(m_iter_pos.slice(), m_iter_pos.index() - 1);
                     m_container_index -= 1;
@@ -997,7 +1801,8 @@ namespace snapshot_container {
                 }
 
                 if (m_iter_pos.slice() > 0) {
-                    m_iter_pos = slice_point(m_iter_pos.slice() - 1, m_kernel->m_slices[m_iter_pos.slice() - 1].size() - 1);
+                    _reset_slice_cache();
+                    m_iter_pos = slice_point(m_iter_pos.slice() - 1, m_kernel->m_slices.length(m_iter_pos.slice() - 1) - 1);
                 } else {
                     *this = _iterator();
                 }
@@ -1015,6 +1820,7 @@ namespace snapshot_container {
 
             m_update_count = m_kernel->get_update_count();
             m_iter_pos = m_kernel->slice_index(m_container_index - decr);
+            _reset_slice_cache();
             m_container_index -= decr;
             return *this;
         }
@@ -1027,16 +1833,24 @@ namespace snapshot_container {
             if (not m_kernel)
                 throw std::logic_error("Invalid iterator dereference (no kernel)");
 
-            if (m_update_count == m_kernel->get_update_count()) {
-                auto& current_slice = m_kernel->m_slices[m_iter_pos.slice()];
-                if (current_slice.m_storage.use_count() == 1)
-                    return current_slice[m_iter_pos.index()];
+            if (_up_to_date()) {
+                if constexpr(std::is_same<std::add_pointer_t<T>, pointer>::value) {
+                    // Writing through the slice is only safe if no part of the slice table or the slice storage
+                    // is shared with a snapshot.
+                    if (m_writable_slice == nullptr && m_kernel->m_slices.exclusive(m_iter_pos.slice()))
+                        m_writable_slice = &m_kernel->m_slices[m_iter_pos.slice()];
+                    if (m_writable_slice != nullptr && m_writable_slice->m_storage.use_count() == 1)
+                        return (*m_writable_slice)[m_iter_pos.index()];
+                } else {
+                    return _current_slice()[m_iter_pos.index()];
+                }
             }
 
             if (m_container_index == npos)
                 throw std::logic_error("Invalid iterator dereference (npos)");
 
             m_iter_pos = m_kernel->slice_index(m_container_index);
+            _reset_slice_cache();
 
             // If reference is modifiable then need to do cow ops
             if constexpr(std::is_same<std::add_pointer_t<T>, pointer>::value) {
@@ -1044,22 +1858,55 @@ namespace snapshot_container {
 
                 m_update_count = m_kernel->get_update_count();
                 m_iter_pos = new_iter_pos;
+
+                if (m_iter_pos == m_kernel->end())
+                    throw std::logic_error("Invalid iterator dereference (end)");
+
+                m_writable_slice = &m_kernel->m_slices[m_iter_pos.slice()];
+                return (*m_writable_slice)[m_iter_pos.index()];
+            } else {
+                m_update_count = m_kernel->get_update_count();
+
+                if (m_iter_pos == m_kernel->end())
+                    throw std::logic_error("Invalid iterator dereference (end)");
+
+                return _current_slice()[m_iter_pos.index()];
             }
+        }
 
-            if (m_iter_pos == m_kernel->end())
-                throw std::logic_error("Invalid iterator dereference (end)");
+        // True if m_iter_pos is valid for the current state of the kernel. The kernels of frozen iterators do not
+        // change so their position only needs computing once.
+        bool _up_to_date() const {
+            if constexpr((Flags & _iterator_frozen) != 0)
+                return m_update_count != npos;
+            else
+                return m_update_count == m_kernel->get_update_count();
+        }
+
+        // Slice lookup is not constant time for every slice table type so the slice at m_iter_pos is cached. The
+        // cache is reset whenever m_iter_pos moves to another slice or is recomputed from the kernel. Must only be
+        // called when m_update_count matches the kernel update count.
+        const slice_t& _current_slice() const {
+            if (m_slice == nullptr)
+                m_slice = &std::as_const(m_kernel->m_slices)[m_iter_pos.slice()];
+            return *m_slice;
+        }
 
-            return m_kernel->m_slices[m_iter_pos.slice()][m_iter_pos.index()];
+        void _reset_slice_cache() const {
+            m_slice = nullptr;
+            m_writable_slice = nullptr;
         }
 
-        std::shared_ptr<iterator_kernel_t> m_kernel;
+        kernel_handle_t m_kernel;
         mutable slice_point m_iter_pos;
-        mutable size_t m_update_count;
+        mutable size_t m_update_count = npos;
         mutable size_t m_container_index;
+        mutable const slice_t* m_slice = nullptr;
+        mutable slice_t* m_writable_slice = nullptr; // m_slice when the slice is known to be exclusive to m_kernel
     };
 
-    template <typename T, typename Ref, typename Ptr, typename StorageCreator>
-    std::shared_ptr<_iterator_kernel<T, StorageCreator>> _extract_kernel(const _iterator<T, Ref, Ptr, StorageCreator>& rhs) {
+    template <typename T, typename Ref, typename Ptr, typename StorageCreator, typename ConfigTraits, unsigned Flags>
+    _iterator_kernel_ref<_iterator_kernel<T, StorageCreator, ConfigTraits>, Flags> _extract_kernel(const _iterator<T, Ref, Ptr, StorageCreator, ConfigTraits, Flags>& rhs) {
         return rhs.m_kernel;
     }
 }
\ No newline at end of file
@@ -0,0 +1,184 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+
+namespace snapshot_container
+{
+    // Bytes of storage elements referenced by a container or snapshot (see _iterator_kernel::memory_usage). Each
+    // storage element is counted once however many slices refer to it. Exclusive and shared bytes add up to the
+    // total. Dead bytes are included in these as well.
+    struct storage_usage
+    {
+        size_t m_total_bytes = 0;
+        size_t m_exclusive_bytes = 0;   // storage referenced by nothing else, which is freed when it is destroyed
+        size_t m_shared_bytes = 0;      // storage also referenced by other containers, snapshots or caches
+        size_t m_dead_bytes = 0;        // elements of the storage outside every slice, which nothing can reach
+        size_t m_num_storages = 0;
+    };
+
+
+    // Memory used by all live kernels of a type (see kernel_registry).
+    struct storage_usage_report
+    {
+        size_t m_num_kernels = 0;
+
+        // Storage referenced by the kernels. Exclusive storage is referenced by a single kernel, and dead bytes
+        // are outside the slices of every kernel.
+        storage_usage m_total;
+    };
+
+
+    // Accumulates the slices referring to storage elements and computes their storage_usage. Slices are added with
+    // the kernel they belong to and whether the kernel shares the slice with another kernel via the slice table.
+    class _storage_accounting
+    {
+    public:
+
+        template <typename Slice>
+        void add(const void* kernel, const Slice& slice, bool exclusive_slice)
+        {
+            if (!slice.m_storage)
+                return;
+
+            auto& entry = m_storages[slice.m_storage.get()];
+            if (!entry.m_kernel)
+            {
+                entry.m_kernel = kernel;
+                entry.m_element_size = sizeof(typename Slice::storage_t::value_type);
+                entry.m_size = slice.m_storage->size();
+                entry.m_use_count = slice.m_storage.use_count();
+            }
+            else if (entry.m_kernel != kernel)
+            {
+                entry.m_shared = true;
+            }
+
+            if (!exclusive_slice)
+                entry.m_shared = true;
+
+            // Kernels sharing a slice table refer to the same slice objects, which hold a single reference.
+            if (m_slices.insert(&slice).second)
+                ++entry.m_references;
+            entry.m_ranges.emplace_back(slice.m_start_index, slice.m_end_index);
+        }
+
+        storage_usage result()
+        {
+            storage_usage usage;
+            for (auto& storage: m_storages)
+            {
+                auto& entry = storage.second;
+                auto bytes = entry.m_size * entry.m_element_size;
+                usage.m_total_bytes += bytes;
+                if (entry.m_shared || entry.m_use_count != static_cast<long>(entry.m_references))
+                    usage.m_shared_bytes += bytes;
+                else
+                    usage.m_exclusive_bytes += bytes;
+                usage.m_dead_bytes += (entry.m_size - _live_elements(entry.m_ranges)) * entry.m_element_size;
+            }
+            usage.m_num_storages = m_storages.size();
+            return usage;
+        }
+
+    private:
+
+        struct _entry
+        {
+            const void* m_kernel = nullptr;
+            size_t m_element_size = 0;
+            size_t m_size = 0;
+            long m_use_count = 0;
+            size_t m_references = 0;
+            bool m_shared = false;
+            std::vector<std::pair<size_t, size_t>> m_ranges;
+        };
+
+        // Number of elements in the union of ranges.
+        static size_t _live_elements(std::vector<std::pair<size_t, size_t>>& ranges)
+        {
+            std::sort(ranges.begin(), ranges.end());
+            size_t live = 0;
+            size_t covered = 0;
+            for (auto& range: ranges)
+            {
+                auto start = std::max(range.first, covered);
+                if (range.second > start)
+                {
+                    live += range.second - start;
+                    covered = range.second;
+                }
+            }
+            return live;
+        }
+
+        std::unordered_map<const void*, _entry> m_storages;
+        std::unordered_set<const void*> m_slices;
+    };
+
+
+    // The live kernels of a type whose ConfigTraits::register_kernels is true. Kernels add themselves on construction
+    // and remove themselves on destruction from any thread.
+    template <typename Kernel>
+    class kernel_registry
+    {
+    public:
+
+        // The registry is never destroyed so kernels destroyed during static destruction can still remove themselves.
+        static kernel_registry& instance()
+        {
+            static kernel_registry* registry = new kernel_registry();
+            return *registry;
+        }
+
+        void add(const Kernel* kernel)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_kernels.insert(kernel);
+        }
+
+        void remove(const Kernel* kernel)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_kernels.erase(kernel);
+        }
+
+        // Storage used by all live kernels. Reads the slices of every kernel so it must not be called while any of
+        // them is being modified. Snapshots may be read by other threads meanwhile.
+        storage_usage_report report() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            _storage_accounting accounting;
+            for (auto kernel: m_kernels)
+            {
+                for (auto& slice: kernel->slices())
+                    accounting.add(kernel, slice, true);
+            }
+
+            storage_usage_report result;
+            result.m_num_kernels = m_kernels.size();
+            result.m_total = accounting.result();
+            return result;
+        }
+
+    private:
+
+        kernel_registry() = default;
+
+        mutable std::mutex m_mutex;
+        std::unordered_set<const Kernel*> m_kernels;
+    };
+}
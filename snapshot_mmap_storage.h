@@ -0,0 +1,431 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <type_traits>
+#include <unistd.h>
+#include "snapshot_storage.h"
+
+
+namespace snapshot_container
+{
+    // A storage type holding elements in a memory mapped file so that containers larger than RAM can be built and
+    // scanned without loading them into the heap. Each storage element is a separate file in a directory given to the
+    // creator. The file is a fixed size header followed by the elements. The file is grown by doubling via ftruncate
+    // and remapping so appends are amortized O(1) as with vector_storage. Copies map a new file and copy the source
+    // pages directly. The file is only open while it is being resized and mapped, so the number of storage elements
+    // is not limited by the open file limit.
+    //
+    // Only trivially copyable types can be held since elements are written to the file as is. Files of persistent
+    // storage are kept when the storage is destroyed and can be mapped again (e.g. after a restart) via open. Files of
+    // non persistent storage are removed on destruction. Only the elements of each file are persisted. The slices of
+    // a container referring to them are not, so a container cannot be restored from its storage files. An application
+    // needing that must record which part of which file each slice of the container refers to.
+    template <typename T>
+    class mmap_storage final : public storage_base<T, 48, virtual_iter::rand_iter<T,48>>
+    {
+    public:
+
+        static_assert(std::is_trivially_copyable<T>::value, "mmap_storage: T must be trivially copyable");
+
+        static const size_t npos = 0xFFFFFFFFFFFFFFFF;
+        typedef storage_base<T, 48, virtual_iter::rand_iter<T,48>> storage_base_t;
+        using storage_base_t::iter_mem_size;
+        typedef T value_type;
+        typedef std::shared_ptr<mmap_storage<T>> shared_t;
+        typedef std::shared_ptr<storage_base_t> shared_base_t;
+        using fwd_iter_type = typename storage_base_t::fwd_iter_type;
+        using rand_iter_type = typename storage_base_t::rand_iter_type;
+        typedef virtual_iter::rand_iter<T,48> storage_iter_type;
+
+        void append(const T& value) override
+        {
+            _insert(m_size, &value, 1);
+        }
+
+        void append(const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) override
+        {
+            _insert_blocks(m_size, start_pos, end_pos);
+        }
+
+        void append(const rand_iter_type& start_pos, const rand_iter_type& end_pos) override
+        {
+            _insert_blocks(m_size, start_pos, end_pos);
+        }
+
+        void append(const segment<T>& elements) override
+        {
+            _insert(m_size, elements.data(), elements.size());
+        }
+
+        shared_base_t copy(size_t start_index = 0, size_t end_index = npos) const override;
+
+        void insert(size_t index, const T& value) override
+        {
+            _insert(index, &value, 1);
+        }
+
+        void insert(size_t index, const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) override
+        {
+            _insert_blocks(index, start_pos, end_pos);
+        }
+
+        void insert(size_t index, const rand_iter_type& start_pos, const rand_iter_type& end_pos) override
+        {
+            _insert_blocks(index, start_pos, end_pos);
+        }
+
+        void remove(size_t index) override
+        {
+            remove(index, index + 1);
+        }
+
+        void remove(size_t start_index, size_t end_index) override
+        {
+            std::memmove(m_data + start_index, m_data + end_index, (m_size - end_index) * sizeof(T));
+            _set_size(m_size - (end_index - start_index));
+        }
+
+        size_t size() const override
+        {return m_size;}
+
+        size_t capacity() const
+        {return m_capacity;}
+
+        const T& operator[](size_t index) const override
+        {return m_data[index];}
+
+        T& operator[](size_t index) override
+        {return m_data[index];}
+
+        segment<T> contiguous_segment(size_t start_index, size_t end_index) const override
+        {
+            if (start_index >= end_index)
+                return segment<T>();
+            return segment<T>(m_data + start_index, end_index - start_index);
+        }
+
+        const storage_iter_type begin() const override
+        {
+            return iterator(0);
+        }
+
+        const storage_iter_type end() const override
+        {
+            return iterator(m_size);
+        }
+
+        const storage_iter_type iterator(size_t offset) const override
+        {
+            const T* data = m_data + std::min(offset, m_size);
+            return storage_iter_type(_iter_impl, data);
+        }
+
+        storage_iter_type begin() override
+        {
+            return iterator(0);
+        }
+
+        storage_iter_type end() override
+        {
+            return iterator(m_size);
+        }
+
+        storage_iter_type iterator(size_t offset) override
+        {
+            const T* data = m_data + std::min(offset, m_size);
+            return storage_iter_type(_iter_impl, data);
+        }
+
+        size_t id() const override
+        {return m_storage_id;}
+
+        const std::string& path() const
+        {return m_path;}
+
+        bool persistent() const
+        {return m_persistent;}
+
+        // Flushes the mapped elements and the header to the file.
+        void sync() const
+        {
+            if (msync(m_header, _file_size(m_capacity), MS_SYNC) != 0)
+                throw std::system_error(errno, std::generic_category(), "mmap_storage: msync failed for " + m_path);
+        }
+
+        // Creates storage in a new uniquely named file in directory.
+        static shared_t create(const std::string& directory, bool persistent = false, size_t reserve_size = 0);
+
+        template <typename InputIter>
+        static shared_t create(const std::string& directory, bool persistent, InputIter start_pos, InputIter end_pos);
+
+        // Maps the file of persistent storage created previously. The storage opened is persistent.
+        static shared_t open(const std::string& path);
+
+        ~mmap_storage();
+
+        // The copy constructors should never be called. All construction is through the storage creator mechanism
+        mmap_storage(const mmap_storage<T>& rhs) = delete;
+        mmap_storage(mmap_storage<T>&& rhs) = delete;
+
+    private:
+
+        struct _header
+        {
+            uint64_t m_magic;
+            uint64_t m_element_size;
+            uint64_t m_size;
+        };
+
+        static constexpr uint64_t _magic = 0x534e41504d4d4150; // SNAPMMAP
+        // Elements start at a fixed offset so that they are aligned in the mapping.
+        static constexpr size_t _data_offset = 64;
+        static constexpr size_t _min_capacity = 1024;
+
+        static_assert(alignof(T) <= _data_offset, "mmap_storage: T alignment too large");
+
+        mmap_storage(const std::string& path, bool persistent):
+            m_path(path),
+            m_persistent(persistent),
+            m_storage_id(storage_base_t::generate_storage_id())
+        {}
+
+        static size_t _file_size(size_t capacity)
+        {
+            return _data_offset + capacity * sizeof(T);
+        }
+
+        void _set_size(size_t size)
+        {
+            m_size = size;
+            m_header->m_size = size;
+        }
+
+        void _map(size_t capacity);
+        void _reserve(size_t size);
+
+        // Makes room for count elements at index. The new elements are uninitialized.
+        void _make_room(size_t index, size_t count)
+        {
+            _reserve(m_size + count);
+            if (index < m_size)
+                std::memmove(m_data + index + count, m_data + index, (m_size - index) * sizeof(T));
+            _set_size(m_size + count);
+        }
+
+        void _insert(size_t index, const T* elements, size_t count)
+        {
+            if (count == 0)
+                return;
+
+            // elements may refer to this storage and be invalidated by a remap.
+            if (elements >= m_data && elements < m_data + m_capacity)
+            {
+                std::unique_ptr<T[]> temp(new T[count]);
+                std::memcpy(temp.get(), elements, count * sizeof(T));
+                _insert(index, temp.get(), count);
+                return;
+            }
+
+            _make_room(index, count);
+            std::memcpy(m_data + index, elements, count * sizeof(T));
+        }
+
+        template <typename VirtualIter>
+        void _insert_blocks(size_t index, const VirtualIter& start_pos, const VirtualIter& end_pos)
+        {
+            auto original_size = m_size;
+            VirtualIter current_pos(start_pos);
+            current_pos.visit_blocks(end_pos, [this](const T* block, size_t count)
+            {
+                _insert(m_size, block, count);
+                return true;
+            });
+
+            if (index < original_size)
+                std::rotate(m_data + index, m_data + original_size, m_data + m_size);
+        }
+
+        static virtual_iter::std_rand_iter_impl<const T*, iter_mem_size> _iter_impl;
+        std::string m_path;
+        bool m_persistent;
+        _header* m_header = nullptr;
+        T* m_data = nullptr;
+        size_t m_size = 0;
+        size_t m_capacity = 0;
+        size_t m_storage_id;
+    };
+
+
+    // The new mapping is made before the current one is removed so the storage is unchanged if this throws.
+    template <typename T>
+    void mmap_storage<T>::_map(size_t capacity)
+    {
+        int fd = ::open(m_path.c_str(), O_RDWR);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "mmap_storage: could not open " + m_path);
+
+        if (_file_size(capacity) > _file_size(m_capacity) && ftruncate(fd, _file_size(capacity)) != 0)
+        {
+            auto error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), "mmap_storage: ftruncate failed for " + m_path);
+        }
+
+        void* mem = mmap(nullptr, _file_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        auto error = errno;
+        close(fd);
+        if (mem == MAP_FAILED)
+            throw std::system_error(error, std::generic_category(), "mmap_storage: mmap failed for " + m_path);
+
+        if (m_header)
+            munmap(m_header, _file_size(m_capacity));
+        m_header = reinterpret_cast<_header*>(mem);
+        m_data = reinterpret_cast<T*>(reinterpret_cast<char*>(mem) + _data_offset);
+        m_capacity = capacity;
+    }
+
+
+    template <typename T>
+    void mmap_storage<T>::_reserve(size_t size)
+    {
+        if (size <= m_capacity)
+            return;
+        _map(std::max(size, std::max(2 * m_capacity, _min_capacity)));
+    }
+
+
+    template <typename T>
+    mmap_storage<T>::~mmap_storage()
+    {
+        if (m_header)
+            munmap(m_header, _file_size(m_capacity));
+        if (!m_persistent)
+            unlink(m_path.c_str());
+    }
+
+
+    template <typename T>
+    typename mmap_storage<T>::shared_base_t mmap_storage<T>::copy(size_t start_index, size_t end_index) const
+    {
+        if (end_index == npos)
+            end_index = m_size;
+
+        auto directory = m_path.substr(0, m_path.find_last_of('/'));
+        auto new_storage = create(directory, m_persistent, end_index - start_index);
+        new_storage->_insert(0, m_data + start_index, end_index - start_index);
+        return new_storage;
+    }
+
+
+    template <typename T>
+    typename mmap_storage<T>::shared_t mmap_storage<T>::create(const std::string& directory, bool persistent,
+                                                               size_t reserve_size)
+    {
+        std::string path = directory + "/snapshot_storage_XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "mmap_storage: could not create storage in " + directory);
+        close(fd);
+
+        // The file is removed by the destructor if mapping it fails.
+        shared_t storage(new mmap_storage<T>(path, persistent));
+        storage->_map(std::max(reserve_size, _min_capacity));
+        storage->m_header->m_magic = _magic;
+        storage->m_header->m_element_size = sizeof(T);
+        storage->_set_size(0);
+        return storage;
+    }
+
+
+    template <typename T>
+    template <typename InputIter>
+    typename mmap_storage<T>::shared_t mmap_storage<T>::create(const std::string& directory, bool persistent,
+                                                               InputIter start_pos, InputIter end_pos)
+    {
+        auto storage = create(directory, persistent);
+        if constexpr(std::is_base_of<fwd_iter_type, InputIter>::value || std::is_base_of<rand_iter_type, InputIter>::value)
+        {
+            storage->append(start_pos, end_pos);
+        }
+        else
+        {
+            for (; start_pos != end_pos; ++start_pos)
+                storage->append(*start_pos);
+        }
+        return storage;
+    }
+
+
+    template <typename T>
+    typename mmap_storage<T>::shared_t mmap_storage<T>::open(const std::string& path)
+    {
+        struct stat file_stat;
+        if (stat(path.c_str(), &file_stat) != 0)
+            throw std::system_error(errno, std::generic_category(), "mmap_storage: could not open " + path);
+
+        shared_t storage(new mmap_storage<T>(path, true));
+        if (size_t(file_stat.st_size) < _data_offset)
+            throw std::runtime_error("mmap_storage: " + path + " is not a storage file");
+
+        storage->_map((file_stat.st_size - _data_offset) / sizeof(T));
+        if (storage->m_header->m_magic != _magic || storage->m_header->m_element_size != sizeof(T) ||
+            storage->m_header->m_size > storage->m_capacity)
+            throw std::runtime_error("mmap_storage: " + path + " is not a storage file for this element type");
+
+        storage->m_size = storage->m_header->m_size;
+        return storage;
+    }
+
+
+    template <typename T>
+    virtual_iter::std_rand_iter_impl<const T*, mmap_storage<T>::iter_mem_size> mmap_storage<T>::_iter_impl;
+
+
+    // Storage creator for mmap_storage. Storage files are created in directory, which must exist. Persistent storage
+    // files are kept after the storage is destroyed.
+    template <typename T>
+    struct mmap_storage_creator
+    {
+        typedef mmap_storage<T> storage_type;
+        typedef typename mmap_storage<T>::shared_t shared_base_t;
+
+        mmap_storage_creator(const std::string& directory, bool persistent = false, size_t reserve_size = 0):
+            m_directory(directory),
+            m_persistent(persistent),
+            m_reserve_size(reserve_size)
+        {}
+
+        shared_base_t operator() ()
+        {
+            return mmap_storage<T>::create(m_directory, m_persistent, m_reserve_size);
+        }
+
+        template <typename IterType>
+        shared_base_t operator() (IterType start_pos, IterType end_pos)
+        {
+            return mmap_storage<T>::create(m_directory, m_persistent, start_pos, end_pos);
+        }
+
+        std::string m_directory;
+        bool m_persistent;
+        size_t m_reserve_size;
+    };
+}
@@ -0,0 +1,355 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace snapshot_container
+{
+    // A fixed size thread pool in which each worker has its own task queue. Workers run their own tasks newest first
+    // and steal the oldest tasks of other workers when their queue is empty. Threads waiting for a parallel_for to
+    // complete run tasks as well so parallel_for may be called from within tasks.
+    class work_stealing_pool
+    {
+    public:
+
+        explicit work_stealing_pool(size_t num_threads = std::thread::hardware_concurrency())
+        {
+            num_threads = std::max<size_t>(num_threads, 1);
+            for (size_t i = 0; i < num_threads; ++i)
+                m_queues.emplace_back(new _queue());
+            for (size_t i = 0; i < num_threads; ++i)
+                m_threads.emplace_back([this, i]() {_worker(i);});
+        }
+
+        work_stealing_pool(const work_stealing_pool&) = delete;
+        work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+        ~work_stealing_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_work_available.notify_all();
+            for (auto& thread: m_threads)
+                thread.join();
+        }
+
+        size_t size() const
+        {
+            return m_threads.size();
+        }
+
+        // Calls f(i) for each i in [0, count) and returns once all calls have returned. Consecutive indices are
+        // queued to the same worker. Rethrows the first exception thrown by f after all calls have completed.
+        template <typename Function>
+        void parallel_for(size_t count, Function&& f)
+        {
+            if (count == 0)
+                return;
+
+            _task_group group(count);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending += count;
+            }
+
+            auto num_queues = m_queues.size();
+            for (size_t queue = 0; queue < num_queues; ++queue)
+            {
+                auto first = count * queue / num_queues;
+                auto last = count * (queue + 1) / num_queues;
+                if (first == last)
+                    continue;
+
+                std::lock_guard<std::mutex> lock(m_queues[queue]->m_mutex);
+                for (auto i = first; i < last; ++i)
+                {
+                    m_queues[queue]->m_tasks.emplace_back([&group, &f, i]() {
+                        try
+                        {
+                            f(i);
+                        }
+                        catch (...)
+                        {
+                            group.set_exception(std::current_exception());
+                        }
+                        group.complete();
+                    });
+                }
+            }
+
+            m_work_available.notify_all();
+
+            while (!group.done())
+            {
+                if (!_run_one(0))
+                    group.wait();
+            }
+            group.rethrow();
+        }
+
+    private:
+
+        struct _queue
+        {
+            std::mutex m_mutex;
+            std::deque<std::function<void()>> m_tasks;
+        };
+
+        class _task_group
+        {
+        public:
+
+            explicit _task_group(size_t count):
+                m_remaining(count)
+            {}
+
+            void complete()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_remaining == 0)
+                    m_done.notify_all();
+            }
+
+            bool done()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_remaining == 0;
+            }
+
+            // Waits for tasks of the group run by other threads.
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done.wait(lock, [this]() {return m_remaining == 0;});
+            }
+
+            void set_exception(std::exception_ptr exception)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_exception)
+                    m_exception = exception;
+            }
+
+            void rethrow()
+            {
+                if (m_exception)
+                    std::rethrow_exception(m_exception);
+            }
+
+        private:
+
+            std::mutex m_mutex;
+            std::condition_variable m_done;
+            size_t m_remaining;
+            std::exception_ptr m_exception;
+        };
+
+        // Runs the newest task of queue or else the oldest task of another queue. Returns false if no task was run.
+        bool _run_one(size_t queue)
+        {
+            std::function<void()> task;
+            auto num_queues = m_queues.size();
+            for (size_t i = 0; i < num_queues && !task; ++i)
+            {
+                auto& current = *m_queues[(queue + i) % num_queues];
+                std::lock_guard<std::mutex> lock(current.m_mutex);
+                if (current.m_tasks.empty())
+                    continue;
+
+                if (i == 0)
+                {
+                    task = std::move(current.m_tasks.back());
+                    current.m_tasks.pop_back();
+                }
+                else
+                {
+                    task = std::move(current.m_tasks.front());
+                    current.m_tasks.pop_front();
+                }
+            }
+
+            if (!task)
+                return false;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_pending;
+            }
+            task();
+            return true;
+        }
+
+        void _worker(size_t queue)
+        {
+            while (true)
+            {
+                if (_run_one(queue))
+                    continue;
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_work_available.wait(lock, [this]() {return m_stop || m_pending > 0;});
+                if (m_stop)
+                    return;
+            }
+        }
+
+        std::vector<std::unique_ptr<_queue>> m_queues;
+        std::vector<std::thread> m_threads;
+        std::mutex m_mutex;
+        std::condition_variable m_work_available;
+        size_t m_pending = 0;   // queued tasks not yet taken by a thread
+        bool m_stop = false;
+    };
+
+
+    // Splits a snapshot into ranges of consecutive elements for parallel algorithms. Ranges follow slice boundaries:
+    // slices longer than grain are split and consecutive slices shorter than grain are grouped.
+    template <typename Snapshot>
+    struct _parallel_partition
+    {
+        static constexpr size_t min_grain = 4096;
+
+        static size_t default_grain(const Snapshot& snapshot, const work_stealing_pool& pool)
+        {
+            // Enough ranges per thread for stealing to even out slow ranges.
+            return std::max(min_grain, snapshot.size() / (pool.size() * 16) + 1);
+        }
+
+        static std::vector<std::pair<size_t, size_t>> ranges(const Snapshot& snapshot, size_t grain)
+        {
+            std::vector<std::pair<size_t, size_t>> result;
+            size_t range_start = 0;
+            size_t container_index = 0;
+            for (auto& slice: snapshot.m_kernel->slices())
+            {
+                auto slice_end = container_index + slice.size();
+                while (slice_end - range_start >= grain)
+                {
+                    // Split at the end of the slice rather than leave a short remainder.
+                    auto range_end = slice_end - range_start < 2 * grain ? slice_end : range_start + grain;
+                    result.emplace_back(range_start, range_end);
+                    range_start = range_end;
+                }
+                container_index = slice_end;
+            }
+            if (range_start < container_index)
+                result.emplace_back(range_start, container_index);
+            return result;
+        }
+    };
+
+
+    // Parallel algorithms over the elements of a snapshot. Snapshots do not change so they can be read by any number
+    // of threads. Work is partitioned by slice (see _parallel_partition) and run on pool. Functions are called
+    // concurrently from several threads. grain = 0 selects a grain based on the size of the snapshot and pool.
+
+    // Calls f(element) for each element in no particular order.
+    template <typename Snapshot, typename Function>
+    void parallel_for_each(work_stealing_pool& pool, const Snapshot& snapshot, Function&& f, size_t grain = 0)
+    {
+        if (grain == 0)
+            grain = _parallel_partition<Snapshot>::default_grain(snapshot, pool);
+        auto ranges = _parallel_partition<Snapshot>::ranges(snapshot, grain);
+        pool.parallel_for(ranges.size(), [&](size_t range) {
+            snapshot.for_each_segment(ranges[range].first, ranges[range].second, [&](const auto& segment) {
+                for (auto& element: segment)
+                    f(element);
+            });
+        });
+    }
+
+
+    // Reduces transform(element) over all elements with reduce, which must be associative and commutative.
+    template <typename Snapshot, typename U, typename Reduce, typename Transform>
+    U parallel_transform_reduce(work_stealing_pool& pool, const Snapshot& snapshot, U init, Reduce&& reduce,
+                                Transform&& transform, size_t grain = 0)
+    {
+        if (grain == 0)
+            grain = _parallel_partition<Snapshot>::default_grain(snapshot, pool);
+        auto ranges = _parallel_partition<Snapshot>::ranges(snapshot, grain);
+        std::vector<U> partial(ranges.size(), init);
+        pool.parallel_for(ranges.size(), [&](size_t range) {
+            // Ranges are never empty. Each starts from its first element so init is only reduced once.
+            auto first = true;
+            auto& result = partial[range];
+            snapshot.for_each_segment(ranges[range].first, ranges[range].second, [&](const auto& segment) {
+                auto element = segment.begin();
+                if (first)
+                {
+                    result = transform(*element++);
+                    first = false;
+                }
+                for (; element != segment.end(); ++element)
+                    result = reduce(result, transform(*element));
+            });
+        });
+
+        U result = init;
+        for (size_t range = 0; range < ranges.size(); ++range)
+            result = reduce(result, partial[range]);
+        return result;
+    }
+
+
+    template <typename Snapshot, typename Predicate>
+    size_t parallel_count_if(work_stealing_pool& pool, const Snapshot& snapshot, Predicate&& predicate,
+                             size_t grain = 0)
+    {
+        return parallel_transform_reduce(pool, snapshot, size_t(0), std::plus<size_t>(),
+                                         [&predicate](const auto& element) -> size_t {return predicate(element) ? 1 : 0;},
+                                         grain);
+    }
+
+
+    // Returns an iterator to the first element satisfying predicate or end(). Ranges after a match which has been
+    // found are skipped and ranges being searched stop at a match found earlier in the snapshot.
+    template <typename Snapshot, typename Predicate>
+    typename Snapshot::const_iterator parallel_find_if(work_stealing_pool& pool, const Snapshot& snapshot,
+                                                       Predicate&& predicate, size_t grain = 0)
+    {
+        if (grain == 0)
+            grain = _parallel_partition<Snapshot>::default_grain(snapshot, pool);
+        auto ranges = _parallel_partition<Snapshot>::ranges(snapshot, grain);
+        std::atomic<size_t> found(snapshot.size());
+        pool.parallel_for(ranges.size(), [&](size_t range) {
+            auto index = ranges[range].first;
+            snapshot.for_each_segment(ranges[range].first, ranges[range].second, [&](const auto& segment) {
+                if (index >= found.load(std::memory_order_relaxed))
+                    return false;
+
+                for (auto& element: segment)
+                {
+                    if (predicate(element))
+                    {
+                        auto current = found.load(std::memory_order_relaxed);
+                        while (index < current && !found.compare_exchange_weak(current, index, std::memory_order_relaxed))
+                            ;
+                        return false;
+                    }
+                    ++index;
+                }
+                return true;
+            });
+        });
+        return snapshot.begin() + found.load();
+    }
+}
@@ -0,0 +1,174 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace snapshot_container
+{
+    // Publishes snapshots of a container modified by a single writer thread to any number of reader threads. The
+    // writer publishes with an atomic pointer swap and readers acquire the latest snapshot wait-free. Snapshots
+    // replaced by a publish are retired and deleted once no reader can still be copying them (epoch based
+    // reclamation). A reader only holds its epoch while copying the snapshot, which is a reference count
+    // increment, so retired snapshots are reclaimed promptly.
+    //
+    // Each reader thread registers once via reader() and acquires snapshots through the returned handle. At most
+    // MaxReaders handles may exist at a time. publish and reclaim must only be called by the writer thread.
+    template <typename Snapshot, size_t MaxReaders = 64>
+    class snapshot_publisher
+    {
+        static_assert(std::is_same<typename Snapshot::shared_kernel_t,
+                                   std::shared_ptr<typename Snapshot::kernel_t>>::value,
+                      "snapshot_publisher: snapshots must share kernels via std::shared_ptr");
+        static_assert(std::is_same<typename Snapshot::kernel_t::slice_t::shared_base_t,
+                                   std::shared_ptr<typename Snapshot::kernel_t::slice_t::storage_t>>::value,
+                      "snapshot_publisher: snapshots must share storage via std::shared_ptr");
+
+        static constexpr uint64_t _idle = std::numeric_limits<uint64_t>::max();
+
+        struct alignas(64) _reader_slot
+        {
+            std::atomic<uint64_t> m_epoch{_idle};
+            std::atomic<bool> m_in_use{false};
+        };
+
+    public:
+
+        class reader_handle
+        {
+        public:
+
+            reader_handle(reader_handle&& rhs):
+                m_publisher(rhs.m_publisher),
+                m_slot(rhs.m_slot)
+            {
+                rhs.m_slot = nullptr;
+            }
+
+            reader_handle(const reader_handle&) = delete;
+            reader_handle& operator=(const reader_handle&) = delete;
+
+            ~reader_handle()
+            {
+                if (m_slot)
+                    m_slot->m_in_use.store(false, std::memory_order_release);
+            }
+
+            // Returns the latest snapshot published. Wait-free.
+            Snapshot acquire() const
+            {
+                // The epoch is announced before the snapshot pointer is loaded (both sequentially consistent) so a
+                // writer retiring the snapshot either sees the announcement or this reader sees the newer snapshot.
+                m_slot->m_epoch.store(m_publisher.m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+                Snapshot result(*m_publisher.m_current.load(std::memory_order_seq_cst));
+                m_slot->m_epoch.store(_idle, std::memory_order_release);
+                return result;
+            }
+
+        private:
+
+            friend class snapshot_publisher;
+
+            reader_handle(const snapshot_publisher& publisher, _reader_slot* slot):
+                m_publisher(publisher),
+                m_slot(slot)
+            {}
+
+            const snapshot_publisher& m_publisher;
+            _reader_slot* m_slot;
+        };
+
+        // Readers acquire an empty snapshot until the first publish.
+        snapshot_publisher():
+            m_current(new Snapshot())
+        {}
+
+        snapshot_publisher(const snapshot_publisher&) = delete;
+        snapshot_publisher& operator=(const snapshot_publisher&) = delete;
+
+        // All reader handles must have been destroyed.
+        ~snapshot_publisher()
+        {
+            delete m_current.load();
+            for (auto& retired: m_retired)
+                delete retired.second;
+        }
+
+        // Registers a reader. Throws if MaxReaders handles already exist.
+        reader_handle reader() const
+        {
+            for (auto& slot: m_slots)
+            {
+                bool expected = false;
+                if (!slot.m_in_use.load(std::memory_order_relaxed) &&
+                    slot.m_in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                    return reader_handle(*this, &slot);
+            }
+            throw std::runtime_error("snapshot_publisher: too many readers");
+        }
+
+        // Publishes a snapshot of container. Elements of published snapshots must not be moved by the writer while
+        // readers access them so appends to the container go to new storage from here on. Snapshots are only
+        // published via their container so that this is guaranteed.
+        template <typename Container>
+        void publish(Container& container)
+        {
+            container.set_append_in_place(false);
+            _publish(container.create_snapshot());
+        }
+
+        // Deletes retired snapshots which no reader can be copying. Returns the number still retired.
+        size_t reclaim()
+        {
+            auto min_epoch = _idle;
+            for (auto& slot: m_slots)
+                min_epoch = std::min(min_epoch, slot.m_epoch.load(std::memory_order_seq_cst));
+
+            size_t kept = 0;
+            for (auto& retired: m_retired)
+            {
+                if (retired.first <= min_epoch)
+                    delete retired.second;
+                else
+                    m_retired[kept++] = retired;
+            }
+            m_retired.resize(kept);
+            return kept;
+        }
+
+        // The latest snapshot published. Only for the writer thread.
+        const Snapshot& latest() const
+        {
+            return *m_current.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        void _publish(const Snapshot& snapshot)
+        {
+            auto previous = m_current.exchange(new Snapshot(snapshot), std::memory_order_seq_cst);
+            auto retire_epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+            m_retired.emplace_back(retire_epoch, previous);
+            reclaim();
+        }
+
+        std::atomic<Snapshot*> m_current;
+        std::atomic<uint64_t> m_epoch{0};
+        mutable _reader_slot m_slots[MaxReaders];
+        std::vector<std::pair<uint64_t, Snapshot*>> m_retired; // retire epoch, snapshot
+    };
+}
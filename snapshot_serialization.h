@@ -0,0 +1,405 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace snapshot_container
+{
+    // Sinks and sources for snapshot serialization. A sink supports write(const iovec* iov, size_t count) which must
+    // write all of the buffers or throw. A source supports size_t read(void* data, size_t size) which returns the
+    // number of bytes read, which is only less than size at the end of the input.
+
+    // Writes to a file descriptor with writev.
+    class fd_sink
+    {
+    public:
+
+        explicit fd_sink(int fd):
+            m_fd(fd)
+        {}
+
+        void write(const iovec* iov, size_t count)
+        {
+            std::vector<iovec> remaining(iov, iov + count);
+            size_t first = 0;
+            while (first < remaining.size())
+            {
+                int batch = int(std::min(remaining.size() - first, size_t(IOV_MAX)));
+                ssize_t written = ::writev(m_fd, &remaining[first], batch);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::system_error(errno, std::generic_category(), "fd_sink: writev failed");
+                }
+
+                // Skip the buffers written and adjust for a partial write.
+                while (first < remaining.size() && size_t(written) >= remaining[first].iov_len)
+                    written -= remaining[first++].iov_len;
+                if (written > 0)
+                {
+                    remaining[first].iov_base = static_cast<char*>(remaining[first].iov_base) + written;
+                    remaining[first].iov_len -= written;
+                }
+            }
+        }
+
+    private:
+        int m_fd;
+    };
+
+
+    // Reads from a file descriptor.
+    class fd_source
+    {
+    public:
+
+        explicit fd_source(int fd):
+            m_fd(fd)
+        {}
+
+        size_t read(void* data, size_t size)
+        {
+            size_t total = 0;
+            while (total < size)
+            {
+                ssize_t result = ::read(m_fd, static_cast<char*>(data) + total, size - total);
+                if (result < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::system_error(errno, std::generic_category(), "fd_source: read failed");
+                }
+                if (result == 0)
+                    break;
+                total += result;
+            }
+            return total;
+        }
+
+    private:
+        int m_fd;
+    };
+
+
+    // Serialization format. A stream starts with a stream_header followed by records, each of which is a
+    // record_header and a payload:
+    //
+    // storage:           count elements of storage id starting at storage index start.
+    // storage extension: count elements following the elements of storage id written so far.
+    // snapshot:          count slice_record entries, one per non empty slice of the snapshot.
+    //
+    // Ids are the storage ids of the writing process. Elements are written in their in memory representation so
+    // streams are only readable on the same platform for the same element type.
+    struct _serialization_format
+    {
+        static constexpr uint64_t magic = 0x4d52545350414e53; // SNAPSTRM
+        static constexpr uint32_t version = 1;
+
+        enum record_type : uint32_t
+        {
+            storage_record = 1,
+            storage_extension_record = 2,
+            snapshot_record = 3
+        };
+
+        struct stream_header
+        {
+            uint64_t m_magic;
+            uint32_t m_version;
+            uint32_t m_element_size;
+        };
+
+        struct record_header
+        {
+            uint32_t m_type;
+            uint32_t m_reserved;
+            uint64_t m_id;
+            uint64_t m_start;
+            uint64_t m_count;
+        };
+
+        struct slice_record
+        {
+            uint64_t m_id;
+            uint64_t m_start;
+            uint64_t m_end;
+        };
+    };
+
+
+    // Writes a sequence of snapshots to a sink. Each storage element referenced by the snapshots is written once per
+    // writer. Only the part of a storage element referenced by the slices of a snapshot is written and later
+    // snapshots referencing more of the storage element (e.g. elements appended to a container since the last
+    // snapshot was written) only add the new elements. Checkpointing snapshots which share storage therefore
+    // costs roughly the size of the unique data.
+    //
+    // Elements already written are assumed not to have changed. This holds as long as a snapshot referencing them
+    // is alive since modification of elements shared with a snapshot is copy on write. Keep the last snapshot
+    // written alive while using a writer across checkpoints.
+    template <typename Snapshot, typename Sink>
+    class snapshot_writer
+    {
+    public:
+
+        typedef typename Snapshot::value_type value_type;
+        typedef typename Snapshot::kernel_t kernel_t;
+        typedef typename kernel_t::slice_t slice_t;
+
+        static_assert(std::is_trivially_copyable<value_type>::value,
+                      "snapshot_writer: elements must be trivially copyable");
+
+        explicit snapshot_writer(Sink& sink):
+            m_sink(sink)
+        {}
+
+        void write(const Snapshot& snapshot)
+        {
+            if (!m_header_written)
+            {
+                _serialization_format::stream_header header{_serialization_format::magic,
+                                                            _serialization_format::version, sizeof(value_type)};
+                iovec iov{&header, sizeof(header)};
+                m_sink.write(&iov, 1);
+                m_header_written = true;
+            }
+
+            auto& slices = snapshot.m_kernel->slices();
+
+            // Extent of each storage element referenced by the snapshot.
+            std::vector<std::pair<const slice_t*, std::pair<size_t, size_t>>> extents;
+            std::unordered_map<size_t, size_t> extent_index;
+            std::vector<_serialization_format::slice_record> slice_records;
+            for (auto& slice: slices)
+            {
+                if (slice.size() == 0)
+                    continue;
+
+                auto id = slice.id();
+                slice_records.push_back({id, slice.m_start_index, slice.m_end_index});
+                auto insert_result = extent_index.emplace(id, extents.size());
+                if (insert_result.second)
+                {
+                    extents.push_back({&slice, {slice.m_start_index, slice.m_end_index}});
+                }
+                else
+                {
+                    auto& extent = extents[insert_result.first->second].second;
+                    extent.first = std::min(extent.first, slice.m_start_index);
+                    extent.second = std::max(extent.second, slice.m_end_index);
+                }
+            }
+
+            for (auto& extent: extents)
+                _write_storage(*extent.first, extent.second.first, extent.second.second);
+
+            _serialization_format::record_header header{_serialization_format::snapshot_record, 0, 0, 0,
+                                                        slice_records.size()};
+            iovec iov[2] = {{&header, sizeof(header)},
+                            {slice_records.data(), slice_records.size() * sizeof(slice_records[0])}};
+            m_sink.write(iov, 2);
+        }
+
+        // Total number of elements written so far.
+        size_t elements_written() const
+        {
+            return m_elements_written;
+        }
+
+    private:
+
+        void _write_storage(const slice_t& slice, size_t start, size_t end)
+        {
+            auto id = slice.id();
+            auto written = m_written.find(id);
+            if (written != m_written.end())
+            {
+                auto& extent = written->second;
+                if (start >= extent.first && end <= extent.second)
+                    return;
+
+                if (start >= extent.first)
+                {
+                    _write_elements(_serialization_format::storage_extension_record, slice, extent.second, end);
+                    extent.second = end;
+                    return;
+                }
+
+                // Elements preceding those written are written along with the rest as a new storage element.
+                end = std::max(end, extent.second);
+            }
+
+            _write_elements(_serialization_format::storage_record, slice, start, end);
+            m_written[id] = {start, end};
+        }
+
+        void _write_elements(uint32_t type, const slice_t& slice, size_t start, size_t end)
+        {
+            _serialization_format::record_header header{type, 0, slice.id(), start, end - start};
+            std::vector<iovec> iov;
+            iov.push_back({&header, sizeof(header)});
+
+            // Contiguous segments of the storage element are written directly from the storage with writev.
+            auto& storage = slice.m_storage;
+            for (size_t index = start; index < end;)
+            {
+                auto segment = storage->contiguous_segment(index, end);
+                iov.push_back({const_cast<value_type*>(segment.data()), segment.size() * sizeof(value_type)});
+                index += segment.size();
+            }
+
+            m_sink.write(iov.data(), iov.size());
+            m_elements_written += end - start;
+        }
+
+        Sink& m_sink;
+        bool m_header_written = false;
+        size_t m_elements_written = 0;
+        std::unordered_map<size_t, std::pair<size_t, size_t>> m_written; // storage id -> extent written
+    };
+
+
+    // Reads snapshots written by snapshot_writer. Storage elements are created via the storage creator and shared
+    // between the snapshots read as they were between the snapshots written.
+    template <typename Snapshot, typename Source>
+    class snapshot_reader
+    {
+    public:
+
+        typedef typename Snapshot::value_type value_type;
+        typedef typename Snapshot::kernel_t kernel_t;
+        typedef typename Snapshot::storage_creator_t storage_creator_t;
+        typedef typename kernel_t::slice_t slice_t;
+        typedef typename kernel_t::segment_t segment_t;
+        typedef typename slice_t::shared_base_t shared_storage_t;
+
+        static_assert(std::is_trivially_copyable<value_type>::value,
+                      "snapshot_reader: elements must be trivially copyable");
+
+        snapshot_reader(Source& source, const storage_creator_t& storage_creator = storage_creator_t()):
+            m_source(source),
+            m_storage_creator(storage_creator)
+        {}
+
+        // Reads the next snapshot into result. Returns false at the end of the input.
+        bool read(Snapshot& result)
+        {
+            if (!m_header_read)
+            {
+                _serialization_format::stream_header header;
+                auto size_read = m_source.read(&header, sizeof(header));
+                if (size_read == 0)
+                    return false;
+                if (size_read != sizeof(header) || header.m_magic != _serialization_format::magic)
+                    throw std::runtime_error("snapshot_reader: not a snapshot stream");
+                if (header.m_version != _serialization_format::version || header.m_element_size != sizeof(value_type))
+                    throw std::runtime_error("snapshot_reader: incompatible snapshot stream");
+                m_header_read = true;
+            }
+
+            while (true)
+            {
+                _serialization_format::record_header header;
+                auto size_read = m_source.read(&header, sizeof(header));
+                if (size_read == 0)
+                    return false;
+                if (size_read != sizeof(header))
+                    throw std::runtime_error("snapshot_reader: truncated snapshot stream");
+
+                switch (header.m_type)
+                {
+                    case _serialization_format::storage_record:
+                    {
+                        auto storage = m_storage_creator();
+                        _read_elements(*storage, header.m_count);
+                        m_storage[header.m_id] = {storage, header.m_start};
+                        break;
+                    }
+                    case _serialization_format::storage_extension_record:
+                    {
+                        auto storage = m_storage.find(header.m_id);
+                        if (storage == m_storage.end() ||
+                            header.m_start != storage->second.second + storage->second.first->size())
+                            throw std::runtime_error("snapshot_reader: invalid storage extension");
+                        _read_elements(*storage->second.first, header.m_count);
+                        break;
+                    }
+                    case _serialization_format::snapshot_record:
+                        result = _read_snapshot(header.m_count);
+                        return true;
+                    default:
+                        throw std::runtime_error("snapshot_reader: invalid record in snapshot stream");
+                }
+            }
+        }
+
+    private:
+
+        template <typename Storage>
+        void _read_elements(Storage& storage, size_t count)
+        {
+            constexpr size_t buffer_size = 65536 / sizeof(value_type) + 1;
+            std::unique_ptr<value_type[]> buffer(new value_type[std::min(count, buffer_size)]);
+            while (count > 0)
+            {
+                auto batch = std::min(count, buffer_size);
+                _read(buffer.get(), batch * sizeof(value_type));
+                storage.append(segment_t(buffer.get(), batch));
+                count -= batch;
+            }
+        }
+
+        Snapshot _read_snapshot(size_t num_slices)
+        {
+            std::vector<_serialization_format::slice_record> slice_records(num_slices);
+            _read(slice_records.data(), num_slices * sizeof(slice_records[0]));
+
+            auto kernel = kernel_t::create(m_storage_creator);
+            for (auto& record: slice_records)
+            {
+                auto storage = m_storage.find(record.m_id);
+                if (storage == m_storage.end() || record.m_start < storage->second.second ||
+                    record.m_end > storage->second.second + storage->second.first->size() ||
+                    record.m_start > record.m_end)
+                    throw std::runtime_error("snapshot_reader: slice refers to elements not in snapshot stream");
+
+                auto base = storage->second.second;
+                kernel->append_slice(slice_t(storage->second.first, record.m_start - base, record.m_end - base));
+            }
+            return Snapshot(kernel);
+        }
+
+        void _read(void* data, size_t size)
+        {
+            if (m_source.read(data, size) != size)
+                throw std::runtime_error("snapshot_reader: truncated snapshot stream");
+        }
+
+        Source& m_source;
+        storage_creator_t m_storage_creator;
+        bool m_header_read = false;
+        // storage id in the stream -> storage element and the storage index of its first element
+        std::unordered_map<size_t, std::pair<shared_storage_t, size_t>> m_storage;
+    };
+}
@@ -14,24 +14,32 @@
 #include <sys/types.h>
 #include "snapshot_storage.h"
 #include "virtual_std_iter.h"
-
-#pragma once
+#include <type_traits>
+#include <utility>
 
 namespace snapshot_container
 {
 
-    // A slice maintains a valid index range over a storage element.
-    template <typename T>
+    // A slice maintains a valid index range over a storage element. Storage is the storage type the slice refers to.
+    // When this is a concrete (final) storage type, calls to the storage are statically dispatched and can be inlined.
+    // The default is the type erased storage_base which supports any storage type. StorageHandle is the reference
+    // counted handle through which slices share storage. It must be constructible from the std::shared_ptr handed
+    // out by storage creators.
+    template <typename T, typename Storage = storage_base<T, 48, virtual_iter::rand_iter<T, 48>>,
+              typename StorageHandle = std::shared_ptr<Storage>>
     class _slice
     {
     public:
 
         // TODO: Generalize slices to work for non-random access storage types also.
         typedef storage_base<T, 48, virtual_iter::rand_iter<T, 48>> storage_base_t;
-        typedef typename storage_base_t::shared_base_t shared_base_t;
+        typedef Storage storage_t;
+        typedef StorageHandle shared_base_t;
         typedef typename storage_base_t::fwd_iter_type fwd_iter_type;
         typedef typename storage_base_t::rand_iter_type rand_iter_type;        
         typedef typename storage_base_t::storage_iter_type storage_iter_type;
+
+        static_assert(std::is_base_of<storage_base_t, storage_t>::value, "_slice: Storage must derive from storage_base");
         
         _slice(const shared_base_t &storage, size_t start_index, size_t end_index = storage_base_t::npos):
             m_start_index(start_index),
@@ -44,7 +52,7 @@ namespace snapshot_container
 
         // Note that slices work like shared_ptrs on copy construction and assignment.  Call copy to obtain
         // a deep copy.
-        _slice(const _slice<T>& rhs):
+        _slice(const _slice& rhs):
             m_storage(rhs.m_storage),
             m_start_index(rhs.m_start_index),
             m_end_index(rhs.m_end_index)
@@ -52,7 +60,10 @@ namespace snapshot_container
             
         }
         
-        _slice& operator = (const _slice<T>& rhs)
+        _slice(_slice&& rhs) = default;
+        _slice& operator = (_slice&& rhs) = default;
+
+        _slice& operator = (const _slice& rhs)
         {
             if (this == &rhs)
                 return *this;
@@ -71,6 +82,12 @@ namespace snapshot_container
             m_end_index += 1;
         }
 
+        void append(T&& t)
+        {
+            m_storage->append(std::move(t));
+            m_end_index += 1;
+        }
+
         // Must only be called on extensible slices
         void append(const fwd_iter_type& start_pos, const fwd_iter_type& end_pos)
         {
@@ -84,12 +101,47 @@ namespace snapshot_container
             m_end_index = m_storage->size();
         }
 
+        // Appends elements start_index through end_index of rhs. Must only be called on extensible slices.
+        void append(const _slice& rhs, size_t start_index = 0, size_t end_index = storage_base_t::npos)
+        {
+            if (end_index == storage_base_t::npos)
+                end_index = rhs.size();
+
+            while (start_index < end_index)
+            {
+                auto segment = rhs.contiguous_segment(start_index, end_index);
+                m_storage->append(segment);
+                start_index += segment.size();
+            }
+            m_end_index = m_storage->size();
+        }
+
+        // As append(rhs, start_index, end_index) but the elements are moved out of rhs if rhs holds the only reference
+        // to its storage. The caller must exclude the range from rhs afterwards.
+        void append_extract(_slice& rhs, size_t start_index = 0, size_t end_index = storage_base_t::npos)
+        {
+            if (end_index == storage_base_t::npos)
+                end_index = rhs.size();
+
+            if constexpr(!std::is_trivially_copyable<T>::value)
+            {
+                if (rhs.m_storage.use_count() == 1)
+                {
+                    for (size_t i = start_index; i < end_index; ++i)
+                        m_storage->append(std::move(rhs[i]));
+                    m_end_index = m_storage->size();
+                    return;
+                }
+            }
+            append(rhs, start_index, end_index);
+        }
+
         bool is_modifiable () const
         {
             return (m_start_index == 0 && m_end_index == m_storage->size() && m_storage.use_count() == 1);
         }
                 
-        _slice<T> copy(size_t start_index, size_t end_index = storage_base_t::npos) const
+        _slice copy(size_t start_index, size_t end_index = storage_base_t::npos) const
         {
             // This is how to obtain an empty copy (i.e. an empty slice based on the same impl
             // as this slice.
@@ -99,8 +151,29 @@ namespace snapshot_container
             if (end_index == storage_base_t::npos)
                 end_index = size();
             
-            shared_base_t storage_copy = m_storage->copy(m_start_index + start_index, m_start_index + end_index);
-            return _slice<T>(storage_copy, 0, end_index - start_index);
+            // Storage types copy to storage of the same type.
+            auto storage_copy = std::static_pointer_cast<storage_t>(
+                m_storage->copy(m_start_index + start_index, m_start_index + end_index));
+            return _slice(storage_copy, 0, end_index - start_index);
+        }
+
+        // As copy but the elements are moved out of this slice if it holds the only reference to its storage. The
+        // caller must exclude the range from this slice afterwards (or drop the slice).
+        _slice extract(size_t start_index, size_t end_index = storage_base_t::npos)
+        {
+            if constexpr(!std::is_trivially_copyable<T>::value)
+            {
+                if (m_storage.use_count() == 1)
+                {
+                    if (end_index == storage_base_t::npos)
+                        end_index = size();
+
+                    auto result = copy(start_index, start_index);
+                    result.append_extract(*this, start_index, end_index);
+                    return result;
+                }
+            }
+            return copy(start_index, end_index);
         }
 
         // Insert must not be called on slices not co-terminus with the end of the storage element.
@@ -110,6 +183,12 @@ namespace snapshot_container
             m_end_index += 1;
         }
 
+        void insert(size_t index, T&& t)
+        {
+            m_storage->insert(m_start_index + index, std::move(t));
+            m_end_index += 1;
+        }
+
         // Insert must not be called on slices not co-terminus with the end of the storage elememt.
         void insert(size_t index, const fwd_iter_type& startPos, const fwd_iter_type& endPos)
         {
@@ -124,13 +203,13 @@ namespace snapshot_container
         }        
         
         // Remove can only be called on slices extending to the end of the storage element.
-        virtual void remove(size_t index)
+        void remove(size_t index)
         {
             m_storage->remove(m_start_index + index);
             m_end_index -= 1;
         }
         
-        virtual void remove(size_t start_index, size_t end_index)
+        void remove(size_t start_index, size_t end_index)
         {
             m_storage->remove(m_start_index + start_index, m_start_index + end_index);
             m_end_index -= (end_index - start_index);
@@ -150,6 +229,14 @@ namespace snapshot_container
 
         size_t storage_size() const {return m_storage->size();}
 
+        // Longest contiguous block of elements of this slice starting at index and ending at or before end_index.
+        segment<T> contiguous_segment(size_t index, size_t end_index = storage_base_t::npos) const
+        {
+            if (end_index > size())
+                end_index = size();
+            return m_storage->contiguous_segment(m_start_index + index, m_start_index + end_index);
+        }
+
         const T& operator [] (size_t index) const
         {
             return m_storage->operator[](index + m_start_index);
@@ -163,7 +250,7 @@ namespace snapshot_container
             return m_storage->operator[](index + m_start_index);
         }
         
-        bool operator == (const _slice<T>& rhs) const
+        bool operator == (const _slice& rhs) const
         {
             if (this == &rhs)
                 return true;
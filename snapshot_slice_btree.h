@@ -0,0 +1,550 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+
+namespace snapshot_container
+{
+    // A slice table holding slices in the leaves of a B+tree. Inner nodes hold the number of slices and the number
+    // of elements under each child so that access by slice index, mapping a container index to a slice, inserting
+    // and erasing slices and adjusting slice lengths are all O(log num_slices). This supports the same interface as
+    // _slice_vector_table and is selected via the slice_table_type of the iterator kernel config traits.
+    //
+    // Nodes are shared between copies of the table. Copying the table shares the root and modifications copy the
+    // nodes on the path from the root to the modified leaf if they are shared (path copying), so taking a
+    // snapshot is O(1) and each subsequent modification costs at most O(log num_slices) node copies.
+    template <typename Slice, size_t NodeSize = 64>
+    class _slice_btree
+    {
+        struct _node;
+        typedef std::shared_ptr<_node> shared_node_t;
+
+    public:
+
+        typedef Slice slice_t;
+        static constexpr size_t max_node_size = NodeSize;
+        static constexpr size_t min_node_size = NodeSize / 4;
+
+        static_assert(NodeSize >= 4, "_slice_btree: NodeSize too small");
+
+        // Iterates slices in order. Sequential access within a leaf is O(1).
+        class const_iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef slice_t value_type;
+            typedef ssize_t difference_type;
+            typedef const slice_t* pointer;
+            typedef const slice_t& reference;
+
+            const_iterator(const _slice_btree* table, size_t slice):
+                m_table(table),
+                m_slice(slice),
+                m_leaf(nullptr),
+                m_leaf_start(0)
+            {}
+
+            const slice_t& operator*() const
+            {
+                if (m_leaf == nullptr || m_slice < m_leaf_start || m_slice - m_leaf_start >= m_leaf->m_slices.size())
+                {
+                    auto location = m_table->_locate(m_slice);
+                    m_leaf = location.m_node;
+                    m_leaf_start = m_slice - location.m_index;
+                }
+                return m_leaf->m_slices[m_slice - m_leaf_start];
+            }
+
+            const slice_t* operator->() const
+            {
+                return &(**this);
+            }
+
+            const_iterator& operator++()
+            {
+                ++m_slice;
+                return *this;
+            }
+
+            bool operator==(const const_iterator& rhs) const
+            {
+                return m_table == rhs.m_table && m_slice == rhs.m_slice;
+            }
+
+            bool operator!=(const const_iterator& rhs) const
+            {
+                return !(*this == rhs);
+            }
+
+        private:
+            const _slice_btree* m_table;
+            size_t m_slice;
+            mutable const _node* m_leaf;
+            mutable size_t m_leaf_start;
+        };
+
+        typedef const_iterator iterator;
+
+        _slice_btree():
+            m_root(std::make_shared<_node>(true))
+        {}
+
+        size_t size() const
+        {
+            return m_root->m_count;
+        }
+
+        bool empty() const
+        {
+            return m_root->m_count == 0;
+        }
+
+        // True if slice can be modified without copying any node of the table.
+        bool exclusive(size_t slice) const
+        {
+            if (m_root.use_count() != 1)
+                return false;
+
+            const _node* node = m_root.get();
+            while (!node->m_leaf)
+            {
+                size_t child = _child(*node, slice);
+                if (node->m_children[child].use_count() != 1)
+                    return false;
+                node = node->m_children[child].get();
+            }
+            return true;
+        }
+
+        slice_t& operator[](size_t slice)
+        {
+            _node* node = &_mutable(m_root);
+            while (!node->m_leaf)
+                node = &_mutable(node->m_children[_child(*node, slice)]);
+            return node->m_slices[slice];
+        }
+
+        const slice_t& operator[](size_t slice) const
+        {
+            auto location = _locate(slice);
+            return location.m_node->m_slices[location.m_index];
+        }
+
+        slice_t& back()
+        {
+            return (*this)[size() - 1];
+        }
+
+        const slice_t& back() const
+        {
+            return (*this)[size() - 1];
+        }
+
+        const_iterator begin() const {return const_iterator(this, 0);}
+        const_iterator end() const {return const_iterator(this, size());}
+
+        void insert(size_t slice, const slice_t& value)
+        {
+            auto sibling = _insert(_mutable(m_root), slice, value);
+            if (sibling)
+            {
+                auto root = std::make_shared<_node>(false);
+                root->m_children = {m_root, sibling};
+                root->m_counts = {m_root->m_count, sibling->m_count};
+                root->m_lengths = {m_root->m_total, sibling->m_total};
+                root->m_count = m_root->m_count + sibling->m_count;
+                root->m_total = m_root->m_total + sibling->m_total;
+                m_root = root;
+            }
+        }
+
+        void erase(size_t slice)
+        {
+            _erase(_mutable(m_root), slice);
+            while (!m_root->m_leaf && m_root->m_children.size() == 1)
+                m_root = m_root->m_children[0];
+        }
+
+        void push_back(const slice_t& value)
+        {
+            insert(size(), value);
+        }
+
+        void clear()
+        {
+            m_root = std::make_shared<_node>(true);
+        }
+
+        // Cumulative length of slices 0 through slice inclusive.
+        size_t cum_length(size_t slice) const
+        {
+            return offset(slice + 1);
+        }
+
+        // Number of elements preceding slice.
+        size_t offset(size_t slice) const
+        {
+            if (slice >= size())
+                return total();
+
+            const _node* node = m_root.get();
+            size_t result = 0;
+            while (!node->m_leaf)
+            {
+                size_t child = 0;
+                while (slice >= node->m_counts[child])
+                {
+                    slice -= node->m_counts[child];
+                    result += node->m_lengths[child];
+                    ++child;
+                }
+                node = node->m_children[child].get();
+            }
+
+            for (size_t i = 0; i < slice; ++i)
+                result += node->m_lengths[i];
+            return result;
+        }
+
+        size_t length(size_t slice) const
+        {
+            auto location = _locate(slice);
+            return location.m_node->m_lengths[location.m_index];
+        }
+
+        size_t total() const
+        {
+            return m_root->m_total;
+        }
+
+        // Returns the slice containing container_index. Empty slices are skipped. Returns size() if
+        // container_index is not less than total().
+        size_t find(size_t container_index) const
+        {
+            if (container_index >= total())
+                return size();
+
+            const _node* node = m_root.get();
+            size_t slice = 0;
+            while (!node->m_leaf)
+            {
+                size_t child = 0;
+                while (container_index >= node->m_lengths[child])
+                {
+                    container_index -= node->m_lengths[child];
+                    slice += node->m_counts[child];
+                    ++child;
+                }
+                node = node->m_children[child].get();
+            }
+
+            size_t index = 0;
+            while (container_index >= node->m_lengths[index])
+            {
+                container_index -= node->m_lengths[index];
+                ++index;
+            }
+            return slice + index;
+        }
+
+        void adjust(size_t slice, ssize_t adjustment)
+        {
+            _node* node = &_mutable(m_root);
+            while (!node->m_leaf)
+            {
+                node->m_total += adjustment;
+                size_t child = _child(*node, slice);
+                node->m_lengths[child] += adjustment;
+                node = &_mutable(node->m_children[child]);
+            }
+            node->m_total += adjustment;
+            node->m_lengths[slice] += adjustment;
+        }
+
+        size_t depth() const
+        {
+            size_t result = 1;
+            for (const _node* node = m_root.get(); !node->m_leaf; node = node->m_children[0].get())
+                ++result;
+            return result;
+        }
+
+        bool integrity_check() const
+        {
+            size_t leaf_depth = 0;
+            return _integrity_check(*m_root, 1, leaf_depth);
+        }
+
+    private:
+
+        struct _node
+        {
+            explicit _node(bool leaf):
+                m_leaf(leaf)
+            {}
+
+            size_t entries() const
+            {
+                return m_leaf ? m_slices.size() : m_children.size();
+            }
+
+            bool m_leaf;
+            size_t m_count = 0; // slices under this node
+            size_t m_total = 0; // elements under this node
+
+            // leaf nodes only
+            std::vector<slice_t> m_slices;
+
+            // leaf nodes: length of each slice. inner nodes: number of elements under each child.
+            std::vector<size_t> m_lengths;
+
+            // inner nodes only
+            std::vector<shared_node_t> m_children;
+            std::vector<size_t> m_counts;
+        };
+
+        struct _location
+        {
+            const _node* m_node;
+            size_t m_index;
+        };
+
+        _location _locate(size_t slice) const
+        {
+            const _node* node = m_root.get();
+            while (!node->m_leaf)
+                node = node->m_children[_child(*node, slice)].get();
+            return _location{node, slice};
+        }
+
+        // Returns the child of an inner node holding slice and makes slice relative to that child.
+        static size_t _child(const _node& node, size_t& slice)
+        {
+            size_t child = 0;
+            while (child + 1 < node.m_children.size() && slice >= node.m_counts[child])
+            {
+                slice -= node.m_counts[child];
+                ++child;
+            }
+            return child;
+        }
+
+        // Copies node if it is shared with another table. Copying an inner node shares its children.
+        static _node& _mutable(shared_node_t& node)
+        {
+            if (node.use_count() != 1)
+                node = std::make_shared<_node>(*node);
+            return *node;
+        }
+
+        // Moves the upper half of node's entries into a new sibling which is returned.
+        static shared_node_t _split(_node& node)
+        {
+            auto sibling = std::make_shared<_node>(node.m_leaf);
+            size_t split_point = node.entries() / 2;
+
+            sibling->m_lengths.assign(node.m_lengths.begin() + split_point, node.m_lengths.end());
+            node.m_lengths.resize(split_point);
+            if (node.m_leaf)
+            {
+                sibling->m_slices.assign(std::make_move_iterator(node.m_slices.begin() + split_point),
+                                         std::make_move_iterator(node.m_slices.end()));
+                node.m_slices.erase(node.m_slices.begin() + split_point, node.m_slices.end());
+                sibling->m_count = sibling->m_slices.size();
+            }
+            else
+            {
+                sibling->m_children.assign(node.m_children.begin() + split_point, node.m_children.end());
+                sibling->m_counts.assign(node.m_counts.begin() + split_point, node.m_counts.end());
+                node.m_children.resize(split_point);
+                node.m_counts.resize(split_point);
+                for (auto count : sibling->m_counts)
+                    sibling->m_count += count;
+            }
+
+            for (auto length : sibling->m_lengths)
+                sibling->m_total += length;
+
+            node.m_count -= sibling->m_count;
+            node.m_total -= sibling->m_total;
+            return sibling;
+        }
+
+        // Returns a new right sibling of node if the insert caused node to split.
+        static shared_node_t _insert(_node& node, size_t slice, const slice_t& value)
+        {
+            auto length = value.size();
+            node.m_count += 1;
+            node.m_total += length;
+
+            if (node.m_leaf)
+            {
+                node.m_slices.insert(node.m_slices.begin() + slice, value);
+                node.m_lengths.insert(node.m_lengths.begin() + slice, length);
+            }
+            else
+            {
+                size_t child = 0;
+                while (child + 1 < node.m_children.size() && slice > node.m_counts[child])
+                {
+                    slice -= node.m_counts[child];
+                    ++child;
+                }
+
+                auto& child_node = _mutable(node.m_children[child]);
+                auto sibling = _insert(child_node, slice, value);
+                node.m_counts[child] = child_node.m_count;
+                node.m_lengths[child] = child_node.m_total;
+                if (sibling)
+                {
+                    node.m_children.insert(node.m_children.begin() + child + 1, sibling);
+                    node.m_counts.insert(node.m_counts.begin() + child + 1, sibling->m_count);
+                    node.m_lengths.insert(node.m_lengths.begin() + child + 1, sibling->m_total);
+                }
+            }
+
+            if (node.entries() > max_node_size)
+                return _split(node);
+            return shared_node_t();
+        }
+
+        // Returns the length of the erased slice.
+        static size_t _erase(_node& node, size_t slice)
+        {
+            size_t length = 0;
+            if (node.m_leaf)
+            {
+                length = node.m_lengths[slice];
+                node.m_slices.erase(node.m_slices.begin() + slice);
+                node.m_lengths.erase(node.m_lengths.begin() + slice);
+            }
+            else
+            {
+                size_t child = _child(node, slice);
+                auto& child_node = _mutable(node.m_children[child]);
+                length = _erase(child_node, slice);
+                node.m_counts[child] = child_node.m_count;
+                node.m_lengths[child] = child_node.m_total;
+                if (child_node.entries() < min_node_size)
+                    _rebalance(node, child);
+            }
+
+            node.m_count -= 1;
+            node.m_total -= length;
+            return length;
+        }
+
+        // Merges an underfull child with a neighbour, splitting the result again if it is too large.
+        static void _rebalance(_node& node, size_t child)
+        {
+            if (node.m_children[child]->entries() == 0)
+            {
+                node.m_children.erase(node.m_children.begin() + child);
+                node.m_counts.erase(node.m_counts.begin() + child);
+                node.m_lengths.erase(node.m_lengths.begin() + child);
+                return;
+            }
+
+            if (node.m_children.size() < 2)
+                return;
+
+            size_t left = child > 0 ? child - 1 : child;
+            auto& left_node = _mutable(node.m_children[left]);
+            auto& right_node = _mutable(node.m_children[left + 1]);
+
+            if (left_node.m_leaf)
+            {
+                left_node.m_slices.insert(left_node.m_slices.end(),
+                                          std::make_move_iterator(right_node.m_slices.begin()),
+                                          std::make_move_iterator(right_node.m_slices.end()));
+            }
+            else
+            {
+                left_node.m_children.insert(left_node.m_children.end(), right_node.m_children.begin(), right_node.m_children.end());
+                left_node.m_counts.insert(left_node.m_counts.end(), right_node.m_counts.begin(), right_node.m_counts.end());
+            }
+            left_node.m_lengths.insert(left_node.m_lengths.end(), right_node.m_lengths.begin(), right_node.m_lengths.end());
+            left_node.m_count += right_node.m_count;
+            left_node.m_total += right_node.m_total;
+
+            if (left_node.entries() > max_node_size)
+            {
+                node.m_children[left + 1] = _split(left_node);
+                node.m_counts[left + 1] = node.m_children[left + 1]->m_count;
+                node.m_lengths[left + 1] = node.m_children[left + 1]->m_total;
+            }
+            else
+            {
+                node.m_children.erase(node.m_children.begin() + left + 1);
+                node.m_counts.erase(node.m_counts.begin() + left + 1);
+                node.m_lengths.erase(node.m_lengths.begin() + left + 1);
+            }
+            node.m_counts[left] = left_node.m_count;
+            node.m_lengths[left] = left_node.m_total;
+        }
+
+        bool _integrity_check(const _node& node, size_t depth, size_t& leaf_depth) const
+        {
+            if (node.entries() > max_node_size || (&node != m_root.get() && node.entries() == 0))
+            {
+                std::cerr << "Slice btree node with " << node.entries() << " entries at depth " << depth << std::endl;
+                return false;
+            }
+
+            if (node.m_lengths.size() != node.entries() || (!node.m_leaf && node.m_counts.size() != node.entries()))
+            {
+                std::cerr << "Slice btree node bookkeeping size mismatch at depth " << depth << std::endl;
+                return false;
+            }
+
+            size_t total = 0;
+            size_t count = node.m_leaf ? node.m_slices.size() : 0;
+            for (size_t i = 0; i < node.entries(); ++i)
+            {
+                total += node.m_lengths[i];
+                if (node.m_leaf)
+                    continue;
+
+                auto& child = *node.m_children[i];
+                count += node.m_counts[i];
+                if (child.m_count != node.m_counts[i] || child.m_total != node.m_lengths[i])
+                {
+                    std::cerr << "Slice btree child summary mismatch at depth " << depth << std::endl;
+                    return false;
+                }
+                if (!_integrity_check(child, depth + 1, leaf_depth))
+                    return false;
+            }
+
+            if (node.m_leaf)
+            {
+                if (leaf_depth == 0)
+                    leaf_depth = depth;
+                if (leaf_depth != depth)
+                {
+                    std::cerr << "Slice btree leaves at depths " << leaf_depth << " and " << depth << std::endl;
+                    return false;
+                }
+            }
+
+            if (total != node.m_total || count != node.m_count)
+            {
+                std::cerr << "Slice btree node totals mismatch at depth " << depth << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        shared_node_t m_root;
+    };
+}
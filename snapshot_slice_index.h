@@ -0,0 +1,357 @@
+/***********************************************************************************************************************
+ * snapshot_container:
+ * A temporal sequentially accessible container type.
+ * Copyright 2019 Kuberan Naganathan
+ * Released under the terms of the MIT license:
+ * https://opensource.org/licenses/MIT
+ **********************************************************************************************************************/
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+
+namespace snapshot_container
+{
+    // Maintains the lengths of the slices in a slice table along with a Fenwick (binary indexed) tree over
+    // those lengths. Length adjustments, cumulative length queries and mapping a container index to the slice
+    // holding it are all O(log num_slices). Structural changes (inserting or erasing a slice) are linear in the
+    // number of slices, the same as the corresponding change to the slice vector itself.
+    class _slice_length_index
+    {
+    public:
+
+        _slice_length_index():
+            m_tree(1, 0),
+            m_total(0)
+        {}
+
+        size_t size() const
+        {
+            return m_lengths.size();
+        }
+
+        bool empty() const
+        {
+            return m_lengths.empty();
+        }
+
+        // Cumulative length of slices 0 through slice inclusive.
+        size_t operator[](size_t slice) const
+        {
+            if (slice + 1 == m_lengths.size())
+                return m_total;
+            return _prefix(slice + 1);
+        }
+
+        // Number of elements preceding slice. i.e. the container index of the first element of slice.
+        size_t offset(size_t slice) const
+        {
+            if (slice >= m_lengths.size())
+                return m_total;
+            if (slice + 1 == m_lengths.size())
+                return m_total - m_lengths[slice];
+            return _prefix(slice);
+        }
+
+        size_t length(size_t slice) const
+        {
+            return m_lengths[slice];
+        }
+
+        size_t total() const
+        {
+            return m_total;
+        }
+
+        size_t back() const
+        {
+            return m_total;
+        }
+
+        // Returns the slice containing container_index. Empty slices are skipped. Returns size() if
+        // container_index is not less than total().
+        size_t find(size_t container_index) const
+        {
+            size_t pos = 0;
+            size_t remaining = container_index;
+            for (size_t step = m_high_bit; step > 0; step >>= 1)
+            {
+                if (pos + step < m_tree.size() && m_tree[pos + step] <= remaining)
+                {
+                    pos += step;
+                    remaining -= m_tree[pos];
+                }
+            }
+            return pos;
+        }
+
+        void adjust(size_t slice, ssize_t adjustment)
+        {
+            m_lengths[slice] += adjustment;
+            m_total += adjustment;
+            for (size_t i = slice + 1; i < m_tree.size(); i += _low_bit(i))
+                m_tree[i] += adjustment;
+        }
+
+        void set(size_t slice, size_t length)
+        {
+            adjust(slice, ssize_t(length) - ssize_t(m_lengths[slice]));
+        }
+
+        void push_back(size_t length)
+        {
+            m_lengths.push_back(length);
+            m_total += length;
+            size_t i = m_lengths.size();
+            // The new node covers (i - low_bit(i), i]. All entries but the last are already in the tree.
+            m_tree.push_back(length + _prefix(i - 1) - _prefix(i - _low_bit(i)));
+            _update_high_bit();
+        }
+
+        void insert(size_t slice, size_t length)
+        {
+            m_lengths.insert(m_lengths.begin() + slice, length);
+            m_total += length;
+            _rebuild();
+        }
+
+        void erase(size_t slice)
+        {
+            m_total -= m_lengths[slice];
+            m_lengths.erase(m_lengths.begin() + slice);
+            _rebuild();
+        }
+
+        void clear()
+        {
+            m_lengths.clear();
+            m_tree.assign(1, 0);
+            m_total = 0;
+            m_high_bit = 0;
+        }
+
+        // Verifies the tree against the slice lengths. Returns true if check passes and false otherwise.
+        bool integrity_check() const
+        {
+            if (m_tree.size() != m_lengths.size() + 1)
+            {
+                std::cerr << "Slice length tree has " << m_tree.size() - 1 << " nodes for "
+                          << m_lengths.size() << " slices" << std::endl;
+                return false;
+            }
+
+            size_t cum_length = 0;
+            for (size_t i = 0; i < m_lengths.size(); ++i)
+            {
+                cum_length += m_lengths[i];
+                if (_prefix(i + 1) != cum_length)
+                {
+                    std::cerr << "Slice length tree mismatch at slice index " << i << std::endl;
+                    std::cerr << "Tree cum size: " << _prefix(i + 1) << " Expected: " << cum_length << std::endl;
+                    return false;
+                }
+            }
+
+            if (cum_length != m_total)
+            {
+                std::cerr << "Slice length total: " << m_total << " Expected: " << cum_length << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+
+        static size_t _low_bit(size_t i)
+        {
+            return i & (~i + 1);
+        }
+
+        // Sum of the first count slice lengths.
+        size_t _prefix(size_t count) const
+        {
+            size_t result = 0;
+            for (size_t i = count; i > 0; i -= _low_bit(i))
+                result += m_tree[i];
+            return result;
+        }
+
+        void _rebuild()
+        {
+            m_tree.resize(m_lengths.size() + 1);
+            for (size_t i = 1; i < m_tree.size(); ++i)
+                m_tree[i] = m_lengths[i - 1];
+
+            for (size_t i = 1; i < m_tree.size(); ++i)
+            {
+                size_t parent = i + _low_bit(i);
+                if (parent < m_tree.size())
+                    m_tree[parent] += m_tree[i];
+            }
+            _update_high_bit();
+        }
+
+        void _update_high_bit()
+        {
+            m_high_bit = 1;
+            while (m_high_bit * 2 < m_tree.size())
+                m_high_bit *= 2;
+        }
+
+        std::vector<size_t> m_lengths;
+        std::vector<size_t> m_tree; // 1 based Fenwick tree over m_lengths
+        size_t m_total;
+        size_t m_high_bit = 0;
+    };
+
+
+    // The default slice table used by _iterator_kernel. Slices are held in a flat vector alongside a
+    // _slice_length_index. A slice table records the length of each slice when it is added to the table. Callers
+    // that change the size of a slice in place must report the change via adjust.
+    //
+    // Copies of the table share the slices copy on write so that copying a table (i.e. taking a snapshot) is a
+    // single reference count increment. Non const access to a shared table copies it first. Copying a slice
+    // increments the use count of its storage so slices of a table which has been copied are no longer
+    // modifiable in place.
+    template <typename Slice>
+    class _slice_vector_table
+    {
+        struct _impl;
+
+    public:
+
+        typedef Slice slice_t;
+        typedef typename std::vector<slice_t>::const_iterator const_iterator;
+        typedef const_iterator iterator;
+
+        _slice_vector_table():
+            m_impl(std::make_shared<_impl>())
+        {}
+
+        size_t size() const
+        {
+            return m_impl->m_slices.size();
+        }
+
+        bool empty() const
+        {
+            return m_impl->m_slices.empty();
+        }
+
+        // True if slice can be modified without copying any part of the table.
+        bool exclusive(size_t) const
+        {
+            return m_impl.use_count() == 1;
+        }
+
+        slice_t& operator[](size_t slice)
+        {
+            return _mutable().m_slices[slice];
+        }
+
+        const slice_t& operator[](size_t slice) const
+        {
+            return m_impl->m_slices[slice];
+        }
+
+        slice_t& back()
+        {
+            return _mutable().m_slices.back();
+        }
+
+        const slice_t& back() const
+        {
+            return m_impl->m_slices.back();
+        }
+
+        const_iterator begin() const {return m_impl->m_slices.begin();}
+        const_iterator end() const {return m_impl->m_slices.end();}
+
+        void insert(size_t slice, const slice_t& value)
+        {
+            auto& impl = _mutable();
+            impl.m_lengths.insert(slice, value.size());
+            impl.m_slices.insert(impl.m_slices.begin() + slice, value);
+        }
+
+        void erase(size_t slice)
+        {
+            auto& impl = _mutable();
+            impl.m_lengths.erase(slice);
+            impl.m_slices.erase(impl.m_slices.begin() + slice);
+        }
+
+        void push_back(const slice_t& value)
+        {
+            auto& impl = _mutable();
+            impl.m_lengths.push_back(value.size());
+            impl.m_slices.push_back(value);
+        }
+
+        void clear()
+        {
+            m_impl = std::make_shared<_impl>();
+        }
+
+        // Cumulative length of slices 0 through slice inclusive.
+        size_t cum_length(size_t slice) const
+        {
+            return m_impl->m_lengths[slice];
+        }
+
+        size_t offset(size_t slice) const
+        {
+            return m_impl->m_lengths.offset(slice);
+        }
+
+        size_t length(size_t slice) const
+        {
+            return m_impl->m_lengths.length(slice);
+        }
+
+        size_t total() const
+        {
+            return m_impl->m_lengths.total();
+        }
+
+        size_t find(size_t container_index) const
+        {
+            return m_impl->m_lengths.find(container_index);
+        }
+
+        void adjust(size_t slice, ssize_t adjustment)
+        {
+            _mutable().m_lengths.adjust(slice, adjustment);
+        }
+
+        bool integrity_check() const
+        {
+            if (m_impl->m_lengths.size() != m_impl->m_slices.size())
+            {
+                std::cerr << "Slices and slice lengths don't have same size" << std::endl;
+                return false;
+            }
+            return m_impl->m_lengths.integrity_check();
+        }
+
+    private:
+
+        struct _impl
+        {
+            std::vector<slice_t> m_slices;
+            _slice_length_index m_lengths;
+        };
+
+        _impl& _mutable()
+        {
+            if (m_impl.use_count() != 1)
+                m_impl = std::make_shared<_impl>(*m_impl);
+            return *m_impl;
+        }
+
+        std::shared_ptr<_impl> m_impl;
+    };
+}
@@ -7,11 +7,51 @@
  **********************************************************************************************************************/
 #pragma  once
 
+#include <algorithm>
 #include <atomic>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "virtual_std_iter.h"
 
 namespace snapshot_container
 {
+    // A contiguous block of elements. This is a minimal stand in for std::span<const T> (C++20). Segments are only
+    // valid until the container they were obtained from is next modified.
+    template <typename T>
+    class segment
+    {
+    public:
+
+        typedef T value_type;
+        typedef const T* const_iterator;
+        typedef const_iterator iterator;
+
+        segment():
+            m_data(nullptr),
+            m_size(0)
+        {}
+
+        segment(const T* data, size_t size):
+            m_data(data),
+            m_size(size)
+        {}
+
+        const T* data() const {return m_data;}
+        size_t size() const {return m_size;}
+        bool empty() const {return m_size == 0;}
+        const T& operator[](size_t index) const {return m_data[index];}
+        const_iterator begin() const {return m_data;}
+        const_iterator end() const {return m_data + m_size;}
+
+    private:
+        const T* m_data;
+        size_t m_size;
+    };
+
+
     // The basic functions that the storage type must support.
     template <typename T, size_t MemSize, typename StorageIterType>
     class storage_base
@@ -28,14 +68,34 @@ namespace snapshot_container
         
         virtual void append(const value_type&) = 0;
 
+        // Storage types supporting move construction of elements should override the rvalue variants of append and
+        // insert. The defaults copy.
+        virtual void append(value_type&& value)
+        {
+            append(static_cast<const value_type&>(value));
+        }
+
         virtual void append(const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) = 0;
         virtual void append(const rand_iter_type& start_pos, const rand_iter_type& end_pos) = 0;
+
+        // Appends a contiguous block of elements e.g. from another storage element. The default appends one element
+        // at a time.
+        virtual void append(const segment<value_type>& elements)
+        {
+            for (auto& value : elements)
+                append(value);
+        }
         
         // Create a deep copy of the object between startIndex and endIndex and return it.
         virtual shared_base_t copy(size_t start_index = 0, size_t end_index = npos) const = 0;
 
         virtual void insert(size_t index, const value_type&) = 0;
 
+        virtual void insert(size_t index, value_type&& value)
+        {
+            insert(index, static_cast<const value_type&>(value));
+        }
+
         virtual void insert(size_t index, const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) = 0;
         virtual void insert(size_t index, const rand_iter_type& start_pos, const rand_iter_type& end_pos) = 0;
 
@@ -49,6 +109,15 @@ namespace snapshot_container
 
         virtual value_type& operator[](size_t index) = 0;
 
+        // Returns the longest contiguous block of elements starting at start_index and ending at or before end_index.
+        // Storage types with contiguous memory should override this. The default is one element at a time.
+        virtual segment<value_type> contiguous_segment(size_t start_index, size_t end_index) const
+        {
+            if (start_index >= end_index)
+                return segment<value_type>();
+            return segment<value_type>(&(*this)[start_index], 1);
+        }
+
         virtual size_t id() const = 0;
                 
         virtual ~storage_base()
@@ -87,7 +156,7 @@ namespace snapshot_container
     // by the higher level abstractions is that appending records to the storage is efficient. Inserting to the middle
     // is permissible.
     template <typename T>
-    class deque_storage : public storage_base<T, 48, virtual_iter::rand_iter<T,48>>
+    class deque_storage final : public storage_base<T, 48, virtual_iter::rand_iter<T,48>>
     {
     public:
 
@@ -107,24 +176,24 @@ namespace snapshot_container
             m_data.push_back (value);
         }
 
-        void append(const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) override
+        void append(T&& value) override
         {
-            fwd_iter_type start_pos_copy(start_pos);
-            
-            std::function<bool(const value_type& v)> f =
-                    [this](const value_type& v) 
-                    {
-                        m_data.push_back (v);
-                        return true;
-                    };
+            m_data.push_back(std::move(value));
+        }
 
-            start_pos_copy.visit (end_pos, f);
+        void append(const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) override
+        {
+            _append_blocks(start_pos, end_pos);
         }
 
         void append(const rand_iter_type& start_pos, const rand_iter_type& end_pos) override
         {
-            for (auto current_pos = start_pos; current_pos != end_pos; ++current_pos)
-                m_data.push_back(*current_pos);            
+            _append_blocks(start_pos, end_pos);
+        }
+
+        void append(const segment<T>& elements) override
+        {
+            m_data.insert(m_data.end(), elements.begin(), elements.end());
         }
         
         shared_base_t copy(size_t start_index = 0, size_t end_index = npos) const override;
@@ -134,14 +203,19 @@ namespace snapshot_container
             m_data.insert (m_data.begin () + index, value);
         }
 
+        void insert(size_t index, T&& value) override
+        {
+            m_data.insert(m_data.begin() + index, std::move(value));
+        }
+
         void insert(size_t index, const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) override
         {
-            m_data.insert(m_data.begin() + index, start_pos, end_pos);
+            _insert_blocks(index, start_pos, end_pos);
         }
 
         void insert(size_t index, const rand_iter_type& start_pos, const rand_iter_type& end_pos) override
         {
-            m_data.insert(m_data.begin() + index, start_pos, end_pos);
+            _insert_blocks(index, start_pos, end_pos);
         }
         
         void remove(size_t index) override
@@ -163,6 +237,27 @@ namespace snapshot_container
         T& operator[](size_t index) override
         {return m_data[index];}
 
+        // Deques hold elements in fixed size blocks. A segment extends to the end of the block holding start_index.
+        // The block size is implementation defined so the end of the block is found by comparing element addresses.
+        segment<T> contiguous_segment(size_t start_index, size_t end_index) const override
+        {
+            if (start_index >= end_index)
+                return segment<T>();
+
+            auto pos = m_data.begin() + start_index;
+            size_t count = end_index - start_index;
+            const T* first = &*pos;
+            for (size_t i = 1; i < count; ++i)
+            {
+                if (&*(++pos) != first + i)
+                {
+                    count = i;
+                    break;
+                }
+            }
+            return segment<T>(&m_data[start_index], count);
+        }
+
         const storage_iter_type begin() const override
         {
             return storage_iter_type(_iter_impl, m_data.begin());
@@ -202,10 +297,10 @@ namespace snapshot_container
             return m_storage_id;
         }
         
-        static shared_base_t create();
+        static shared_t create();
 
         template <typename InputIter>
-        static shared_base_t create(InputIter start_pos, InputIter end_pos);
+        static shared_t create(InputIter start_pos, InputIter end_pos);
        
         // The copy constructors should never be called. All construction is through the storage creator mechanism
         deque_storage(const deque_storage<T>& rhs) = delete;
@@ -220,6 +315,49 @@ namespace snapshot_container
         template <typename InputIter>
         deque_storage(InputIter start_pos, InputIter end_pos);
         
+        // Elements are added a block at a time via visit_blocks rather than through the virtual iterator per element.
+        template <typename VirtualIter>
+        void _append_blocks(const VirtualIter& start_pos, const VirtualIter& end_pos)
+        {
+            VirtualIter current_pos(start_pos);
+            current_pos.visit_blocks(end_pos, [this](const T* block, size_t count)
+            {
+                m_data.insert(m_data.end(), block, block + count);
+                return true;
+            });
+        }
+
+        template <typename VirtualIter>
+        void _insert_blocks(size_t index, const VirtualIter& start_pos, const VirtualIter& end_pos)
+        {
+            if (index == m_data.size())
+            {
+                _append_blocks(start_pos, end_pos);
+                return;
+            }
+
+            std::vector<segment<T>> blocks;
+            VirtualIter current_pos(start_pos);
+            current_pos.visit_blocks(end_pos, [&blocks](const T* block, size_t count)
+            {
+                blocks.emplace_back(block, count);
+                return true;
+            });
+
+            if (blocks.size() == 1)
+            {
+                m_data.insert(m_data.begin() + index, blocks[0].begin(), blocks[0].end());
+                return;
+            }
+
+            // Gather the blocks so that the tail of the deque is only shifted once.
+            std::vector<T> elements;
+            for (auto& block: blocks)
+                elements.insert(elements.end(), block.begin(), block.end());
+            m_data.insert(m_data.begin() + index, std::make_move_iterator(elements.begin()),
+                          std::make_move_iterator(elements.end()));
+        }
+
         static virtual_iter::std_rand_iter_impl<typename std::deque<value_type>::const_iterator, iter_mem_size> _iter_impl;        
         std::deque<T> m_data;
         size_t m_storage_id;
@@ -246,18 +384,18 @@ namespace snapshot_container
 
     
     template <typename T>
-    typename deque_storage<T>::shared_base_t deque_storage<T>::create()
+    typename deque_storage<T>::shared_t deque_storage<T>::create()
     {
-        return shared_base_t (new deque_storage<T> ());
+        return shared_t (new deque_storage<T> ());
     }
 
     
     template <typename T>
     template <typename InputItr>
-    typename deque_storage<T>::shared_base_t deque_storage<T>::create(InputItr start_pos, InputItr end_pos)
+    typename deque_storage<T>::shared_t deque_storage<T>::create(InputItr start_pos, InputItr end_pos)
     {
         auto storage = new deque_storage<T> (start_pos, end_pos);
-        return shared_base_t (storage);
+        return shared_t (storage);
     }
 
     
@@ -267,11 +405,14 @@ namespace snapshot_container
     
     // Storage creation may need to be stateful. To support this, the higher level abstraction takes a storage creator
     // object as an arg on which operator () is called to create storage. This is a wrapper around deque_storage
-    // supporting this usage
+    // supporting this usage. Storage creators define storage_type as the type of storage created. The higher level
+    // abstractions refer to storage through this type so that calls to final storage types are statically dispatched.
+    // A storage creator without a storage_type (or with storage_type storage_base) is supported via virtual calls.
     template <typename T>
     struct deque_storage_creator
     {
-        typedef typename deque_storage<T>::shared_base_t shared_base_t;
+        typedef deque_storage<T> storage_type;
+        typedef typename deque_storage<T>::shared_t shared_base_t;
         shared_base_t operator() ()
         {
             return deque_storage<T>::create();
@@ -282,5 +423,304 @@ namespace snapshot_container
         {
             return deque_storage<T>::create(start_pos, end_pos);
         }
-    };    
-}
\ No newline at end of file
+    };
+
+
+    // A storage type holding elements contiguously in a std::vector. Copies and appends from contiguous sources are
+    // done in bulk, i.e. with memcpy/memmove when T is trivially copyable, so copying slices during cow ops runs at
+    // memory bandwidth. Insertion to the middle moves the tail of the storage so slices over this storage type should
+    // favour appends, which is the case for the higher level abstractions.
+    template <typename T>
+    class vector_storage final : public storage_base<T, 48, virtual_iter::rand_iter<T,48>>
+    {
+    public:
+
+        static const size_t npos = 0xFFFFFFFFFFFFFFFF;
+        typedef storage_base<T, 48, virtual_iter::rand_iter<T,48>> storage_base_t;
+        using storage_base_t::iter_mem_size;
+        typedef T value_type;
+        typedef std::shared_ptr<vector_storage<T>> shared_t;
+        typedef std::shared_ptr<storage_base_t> shared_base_t;
+        using fwd_iter_type = typename storage_base_t::fwd_iter_type;
+        using rand_iter_type = typename storage_base_t::rand_iter_type;
+        typedef virtual_iter::rand_iter<T,48> storage_iter_type;
+
+        // Bulk copies through the virtual iterators need default constructible elements to size the destination.
+        static constexpr bool bulk_copyable = std::is_trivially_copyable<T>::value &&
+                                              std::is_default_constructible<T>::value;
+
+        void append(const T& value) override
+        {
+            m_data.push_back(value);
+        }
+
+        void append(T&& value) override
+        {
+            m_data.push_back(std::move(value));
+        }
+
+        void append(const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) override
+        {
+            _insert(m_data.size(), start_pos, end_pos);
+        }
+
+        void append(const rand_iter_type& start_pos, const rand_iter_type& end_pos) override
+        {
+            _insert(m_data.size(), start_pos, end_pos);
+        }
+
+        void append(const segment<T>& elements) override
+        {
+            _insert(m_data.size(), elements.begin(), elements.end());
+        }
+
+        shared_base_t copy(size_t start_index = 0, size_t end_index = npos) const override;
+
+        void insert(size_t index, const T& value) override
+        {
+            m_data.insert(m_data.begin() + index, value);
+        }
+
+        void insert(size_t index, T&& value) override
+        {
+            m_data.insert(m_data.begin() + index, std::move(value));
+        }
+
+        void insert(size_t index, const fwd_iter_type& start_pos, const fwd_iter_type& end_pos) override
+        {
+            _insert(index, start_pos, end_pos);
+        }
+
+        void insert(size_t index, const rand_iter_type& start_pos, const rand_iter_type& end_pos) override
+        {
+            _insert(index, start_pos, end_pos);
+        }
+
+        void remove(size_t index) override
+        {
+            m_data.erase(m_data.begin() + index);
+        }
+
+        void remove(size_t start_index, size_t end_index) override
+        {
+            m_data.erase(m_data.begin() + start_index, m_data.begin() + end_index);
+        }
+
+        size_t size() const override
+        {return m_data.size();}
+
+        size_t capacity() const
+        {return m_data.capacity();}
+
+        const T& operator[](size_t index) const override
+        {return m_data[index];}
+
+        T& operator[](size_t index) override
+        {return m_data[index];}
+
+        segment<T> contiguous_segment(size_t start_index, size_t end_index) const override
+        {
+            if (start_index >= end_index)
+                return segment<T>();
+            return segment<T>(m_data.data() + start_index, end_index - start_index);
+        }
+
+        const storage_iter_type begin() const override
+        {
+            return storage_iter_type(_iter_impl, m_data.cbegin());
+        }
+
+        const storage_iter_type end() const override
+        {
+            return storage_iter_type(_iter_impl, m_data.cend());
+        }
+
+        const storage_iter_type iterator(size_t offset) const override
+        {
+            if (offset > m_data.size())
+                offset = m_data.size();
+            return storage_iter_type(_iter_impl, m_data.cbegin() + offset);
+        }
+
+        storage_iter_type begin() override
+        {
+            return storage_iter_type(_iter_impl, m_data.cbegin());
+        }
+
+        storage_iter_type end() override
+        {
+            return storage_iter_type(_iter_impl, m_data.cend());
+        }
+
+        storage_iter_type iterator(size_t offset) override
+        {
+            if (offset > m_data.size())
+                offset = m_data.size();
+            return storage_iter_type(_iter_impl, m_data.cbegin() + offset);
+        }
+
+        size_t id() const override
+        {
+            return m_storage_id;
+        }
+
+        static shared_t create(size_t reserve_size = 0);
+
+        template <typename InputIter>
+        static shared_t create(InputIter start_pos, InputIter end_pos, size_t reserve_size = 0);
+
+        // The copy constructors should never be called. All construction is through the storage creator mechanism
+        vector_storage(const vector_storage<T>& rhs) = delete;
+        vector_storage(vector_storage<T>&& rhs) = delete;
+
+    private:
+
+        explicit vector_storage(size_t reserve_size):
+        m_storage_id(storage_base_t::generate_storage_id())
+        {
+            m_data.reserve(reserve_size);
+        }
+
+        void _insert(size_t index, const fwd_iter_type& start_pos, const fwd_iter_type& end_pos)
+        {
+            _insert_bulk(index, start_pos, end_pos);
+        }
+
+        void _insert(size_t index, const rand_iter_type& start_pos, const rand_iter_type& end_pos)
+        {
+            _insert_bulk(index, start_pos, end_pos);
+        }
+
+        template <typename InputIter>
+        void _insert(size_t index, InputIter start_pos, InputIter end_pos)
+        {
+            m_data.insert(m_data.begin() + index, start_pos, end_pos);
+        }
+
+        // The virtual iterator copy function is used in preference to element by element iteration through the
+        // virtual iterator. It copies with memcpy when the source is contiguous. Other types are appended a block at
+        // a time via visit_blocks and rotated into place.
+        template <typename VirtualIter>
+        void _insert_bulk(size_t index, const VirtualIter& start_pos, const VirtualIter& end_pos)
+        {
+            if constexpr(bulk_copyable)
+            {
+                ssize_t count = end_pos - start_pos;
+                if (count <= 0)
+                    return;
+
+                auto original_size = m_data.size();
+                m_data.resize(original_size + count);
+                if (index < original_size)
+                {
+                    std::memmove(m_data.data() + index + count, m_data.data() + index,
+                                 (original_size - index) * sizeof(T));
+                }
+
+                VirtualIter current_pos(start_pos);
+                current_pos.copy(m_data.data() + index, count, end_pos);
+            }
+            else
+            {
+                auto original_size = m_data.size();
+                VirtualIter current_pos(start_pos);
+                current_pos.visit_blocks(end_pos, [this](const T* block, size_t count)
+                {
+                    m_data.insert(m_data.end(), block, block + count);
+                    return true;
+                });
+
+                if (index < original_size)
+                    std::rotate(m_data.begin() + index, m_data.begin() + original_size, m_data.end());
+            }
+        }
+
+        static virtual_iter::std_rand_iter_impl<typename std::vector<value_type>::const_iterator, iter_mem_size> _iter_impl;
+        std::vector<T> m_data;
+        size_t m_storage_id;
+    };
+
+
+    template <typename T>
+    typename vector_storage<T>::shared_base_t vector_storage<T>::copy(size_t start_index, size_t end_index) const
+    {
+        if (end_index == npos)
+            end_index = m_data.size();
+
+        auto count = end_index - start_index;
+        auto new_storage = new vector_storage<T> (count);
+        if constexpr(bulk_copyable)
+        {
+            new_storage->m_data.resize(count);
+            if (count)
+                std::memcpy(new_storage->m_data.data(), m_data.data() + start_index, count * sizeof(T));
+        }
+        else
+        {
+            new_storage->m_data.assign(m_data.begin() + start_index, m_data.begin() + end_index);
+        }
+        return vector_storage<T>::shared_base_t (new_storage);
+    }
+
+
+    template <typename T>
+    typename vector_storage<T>::shared_t vector_storage<T>::create(size_t reserve_size)
+    {
+        return shared_t (new vector_storage<T> (reserve_size));
+    }
+
+
+    template <typename T>
+    template <typename InputItr>
+    typename vector_storage<T>::shared_t vector_storage<T>::create(InputItr start_pos, InputItr end_pos, size_t reserve_size)
+    {
+        auto storage = new vector_storage<T> (reserve_size);
+        storage->_insert(0, start_pos, end_pos);
+        return shared_t (storage);
+    }
+
+
+    template <typename T>
+    virtual_iter::std_rand_iter_impl<typename std::vector<T>::const_iterator, vector_storage<T>::iter_mem_size> vector_storage<T>::_iter_impl;
+
+
+    // Storage creator for vector_storage. reserve_size is the capacity reserved for newly created storage. Storage
+    // that is appended to (e.g. the last slice of a container being built with push_back) benefits from a reserve.
+    template <typename T>
+    struct vector_storage_creator
+    {
+        typedef vector_storage<T> storage_type;
+        typedef typename vector_storage<T>::shared_t shared_base_t;
+
+        vector_storage_creator(size_t reserve_size = 0):
+            m_reserve_size(reserve_size)
+        {}
+
+        shared_base_t operator() ()
+        {
+            return vector_storage<T>::create(m_reserve_size);
+        }
+
+        template <typename IterType>
+        shared_base_t operator() (IterType start_pos, IterType end_pos)
+        {
+            return vector_storage<T>::create(start_pos, end_pos);
+        }
+
+        size_t m_reserve_size;
+    };
+
+
+    // The storage type referred to by slices for a given storage creator.
+    template <typename StorageCreator, typename BaseStorage, typename = void>
+    struct _creator_storage_type
+    {
+        typedef BaseStorage type;
+    };
+
+    template <typename StorageCreator, typename BaseStorage>
+    struct _creator_storage_type<StorageCreator, BaseStorage, std::void_t<typename StorageCreator::storage_type>>
+    {
+        typedef typename StorageCreator::storage_type type;
+    };
+}
@@ -8,11 +8,15 @@
 #include "snapshot_slice.h"
 #include "snapshot_iterator.h"
 #include "snapshot_storage.h"
+#include "snapshot_mmap_storage.h"
 #include <numeric>
+#include <deque>
 #include <vector>
 #include <memory>
 #include <algorithm>
 #include <tuple>
+#include <random>
+#include <string>
 
 
 
@@ -196,9 +200,9 @@ TEST_CASE("complex merge and insert tests", "[iterator kernel]") {
             ik->insert(insert_point, 0xdeadbeef);
 
             if (node_size > config_traits::cow_ops::max_insertion_copy_size)
-                REQUIRE(ik->m_cum_slice_lengths[0] == insert_pos + 1);
+                REQUIRE(ik->m_slices.cum_length(0) == insert_pos + 1);
             else
-                REQUIRE(ik->m_cum_slice_lengths[0] == node_size + 1);
+                REQUIRE(ik->m_slices.cum_length(0) == node_size + 1);
             
             std::vector<int> new_values { 10001, 10002, 10003, 10004 };
             auto impl = virtual_iter::std_fwd_iter_impl_creator::create(new_values);
@@ -210,7 +214,7 @@ TEST_CASE("complex merge and insert tests", "[iterator kernel]") {
             ik->insert(insert_point, vitr, vend_itr);
             
             if (node_size > config_traits::cow_ops::max_insertion_copy_size)
-                REQUIRE(ik->m_cum_slice_lengths[0] == slice_size_before_insert + config_traits::cow_ops::slice_edge_offset + (vend_itr - vitr));
+                REQUIRE(ik->m_slices.cum_length(0) == slice_size_before_insert + config_traits::cow_ops::slice_edge_offset + (vend_itr - vitr));
             REQUIRE(ik->size() == node_size + 5);
         }
     
@@ -246,7 +250,7 @@ TEST_CASE("complex merge and insert tests", "[iterator kernel]") {
             auto insert_point = ik->slice_index(insert_pos);
             auto insert_index = ik->container_index(insert_point);
             ik->insert(insert_point, 0xdeadbeef);
-            REQUIRE(ik->m_cum_slice_lengths[0] == insert_pos);
+            REQUIRE(ik->m_slices.cum_length(0) == insert_pos);
             auto itr = _iterator(ik, ik->slice_index(insert_index));            
 
             // force non-const iterator access which will force a copy on write            
@@ -344,4 +348,639 @@ TEST_CASE("multi slice tests", "[iterator kernel]") {
             REQUIRE(std::equal(_iterator(ik, 0), _iterator(ik, ik->size()), test_values2.begin()));
         }
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("slice length index", "[iterator kernel]") {
+    snapshot_container::_slice_length_index index;
+    std::vector<size_t> lengths;
+
+    for (size_t i = 0; i < 37; ++i)
+    {
+        index.push_back(i % 5);
+        lengths.push_back(i % 5);
+    }
+    index.insert(3, 11);
+    lengths.insert(lengths.begin() + 3, 11);
+    index.erase(20);
+    lengths.erase(lengths.begin() + 20);
+    index.adjust(7, 4);
+    lengths[7] += 4;
+    index.set(0, 0);
+    lengths[0] = 0;
+
+    REQUIRE(index.integrity_check());
+    size_t cum_length = 0;
+    for (size_t i = 0; i < lengths.size(); ++i)
+    {
+        REQUIRE(index.offset(i) == cum_length);
+        cum_length += lengths[i];
+        REQUIRE(index[i] == cum_length);
+    }
+    REQUIRE(index.total() == cum_length);
+
+    for (size_t container_index = 0; container_index < cum_length; ++container_index)
+    {
+        auto slice = index.find(container_index);
+        REQUIRE(index.offset(slice) <= container_index);
+        REQUIRE(container_index < index[slice]);
+    }
+    REQUIRE(index.find(cum_length) == lengths.size());
+}
+
+
+TEST_CASE("slice btree", "[iterator kernel]") {
+    // Small nodes so that splits, merges and root changes all occur.
+    using slice_t = snapshot_container::_slice<int>;
+    snapshot_container::_slice_btree<slice_t, 4> table;
+    std::vector<slice_t> reference;
+    deque_storage_creator<int> storage_creator;
+    std::vector<int> values(64, 7);
+
+    std::default_random_engine generator(17);
+    for (size_t i = 0; i < 2000; ++i)
+    {
+        auto position = reference.empty() ? 0 : generator() % (reference.size() + 1);
+        if (reference.size() < 8 || generator() % 3)
+        {
+            auto length = generator() % values.size();
+            auto slice = slice_t(storage_creator(values.begin(), values.begin() + length), 0);
+            table.insert(position, slice);
+            reference.insert(reference.begin() + position, slice);
+        }
+        else
+        {
+            position = position % reference.size();
+            table.erase(position);
+            reference.erase(reference.begin() + position);
+        }
+    }
+
+    REQUIRE(table.integrity_check());
+    REQUIRE(table.depth() > 2);
+    REQUIRE(table.size() == reference.size());
+    REQUIRE(std::equal(table.begin(), table.end(), reference.begin()));
+
+    size_t cum_length = 0;
+    for (size_t i = 0; i < reference.size(); ++i)
+    {
+        REQUIRE(table.offset(i) == cum_length);
+        REQUIRE(table.length(i) == reference[i].size());
+        cum_length += reference[i].size();
+        if (reference[i].size())
+            REQUIRE(table.find(cum_length - 1) == i);
+    }
+    REQUIRE(table.total() == cum_length);
+
+    // Copies share nodes until either copy is modified.
+    auto table_copy = table;
+    table.adjust(reference.size() / 2, 5);
+    REQUIRE(table.total() == cum_length + 5);
+    REQUIRE(table.integrity_check());
+    REQUIRE(table_copy.total() == cum_length);
+    REQUIRE(!table.exclusive(reference.size() - 1));
+    REQUIRE(table.exclusive(reference.size() / 2));
+    table[0] = slice_t(storage_creator(), 0);
+    REQUIRE(table_copy[0].size() == reference[0].size());
+    REQUIRE(std::equal(table_copy.begin(), table_copy.end(), reference.begin()));
+    REQUIRE(table_copy.integrity_check());
+
+    while (table.size())
+        table.erase(table.size() / 2);
+    REQUIRE(table.integrity_check());
+    REQUIRE(table.total() == 0);
+}
+
+
+TEST_CASE("btree iterator kernel", "[iterator kernel]") {
+    using btree_kernel = _iterator_kernel<int, deque_storage_creator<int>, snapshot_container::_btree_iterator_kernel_config_traits>;
+    std::vector<int> test_values(4096);
+    std::iota(test_values.begin(), test_values.end(), 0);
+    auto ik = btree_kernel::create(deque_storage_creator<int>());
+    for (size_t i = 0; i < test_values.size(); i += 16)
+        ik->append(test_values.begin() + i, test_values.begin() + i + 16);
+    auto ik2 = btree_kernel::create(ik);
+
+    REQUIRE(ik->num_slices() == test_values.size() / 16);
+    REQUIRE(ik->integrity_check());
+
+    std::vector<int> expected(test_values);
+    std::vector<int> new_values {10001, 10002, 10003};
+    auto impl = virtual_iter::std_iter_impl_creator::create(new_values);
+    virtual_iter::rand_iter<int, 48> itr (impl, new_values.begin());
+    virtual_iter::rand_iter<int, 48> end_itr (impl, new_values.end());
+
+    for (size_t i = 1; i < 64; ++i)
+    {
+        auto index = (i * 997) % expected.size();
+        ik->insert(ik->slice_index(index), itr, end_itr);
+        expected.insert(expected.begin() + index, new_values.begin(), new_values.end());
+        ik->remove(ik->slice_index(index / 2), ik->slice_index(index / 2 + 7));
+        expected.erase(expected.begin() + index / 2, expected.begin() + index / 2 + 7);
+    }
+
+    REQUIRE(ik->integrity_check());
+    REQUIRE(ik->size() == expected.size());
+    REQUIRE(std::equal(btree_kernel::iterator(ik, 0), btree_kernel::iterator(ik, ik->size()), expected.begin()));
+    REQUIRE(std::equal(btree_kernel::const_iterator(ik2, 0), btree_kernel::const_iterator(ik2, ik2->size()), test_values.begin()));
+
+    // Writes to the first slice of a leaf merge it into the previous slice if that is modifiable. The previous slice
+    // is in another leaf shared with a snapshot, so appending to its storage would modify the snapshot.
+    auto ik3 = btree_kernel::create(deque_storage_creator<int>());
+    for (size_t i = 0; i < test_values.size(); i += 16)
+        ik3->append(test_values.begin() + i, test_values.begin() + i + 16);
+    auto ik4 = btree_kernel::create(ik3);
+    auto usage = ik4->memory_usage();
+    for (size_t i = test_values.size(); i > 0; i -= 16)
+        (*ik3)[i - 16] = -1;
+
+    REQUIRE(ik3->integrity_check());
+    REQUIRE(ik4->memory_usage().m_total_bytes == usage.m_total_bytes);
+    REQUIRE(std::equal(btree_kernel::const_iterator(ik4, 0), btree_kernel::const_iterator(ik4, ik4->size()), test_values.begin()));
+}
+
+
+TEST_CASE("compaction", "[iterator kernel]") {
+    using btree_kernel = _iterator_kernel<int, deque_storage_creator<int>, snapshot_container::_btree_iterator_kernel_config_traits>;
+    std::vector<int> test_values(4096);
+    std::iota(test_values.begin(), test_values.end(), 0);
+    auto ik = btree_kernel::create(deque_storage_creator<int>());
+    for (size_t i = 0; i < test_values.size(); i += 16)
+        ik->append(test_values.begin() + i, test_values.begin() + i + 16);
+    auto large = std::vector<int>(config_traits::compaction::small_slice_size, 7);
+    ik->append(large.begin(), large.end());
+    for (size_t i = 0; i < test_values.size(); i += 16)
+        ik->append(test_values.begin() + i, test_values.begin() + i + 16);
+    auto ik2 = btree_kernel::create(ik);
+
+    std::vector<int> expected(test_values);
+    expected.insert(expected.end(), large.begin(), large.end());
+    expected.insert(expected.end(), test_values.begin(), test_values.end());
+
+    // The large slice separates two runs
+    auto runs = ik->compaction_runs();
+    REQUIRE(runs.size() == 2);
+    REQUIRE(runs[0].m_first_slice == 0);
+    REQUIRE(runs[0].m_last_slice == 256);
+    REQUIRE(runs[0].m_size == 4096);
+    REQUIRE(runs[1].m_first_slice == 257);
+    REQUIRE(runs[1].m_last_slice == 513);
+
+    // The budget limits the number of elements copied
+    runs = ik->compaction_runs(100);
+    REQUIRE(runs.size() == 1);
+    REQUIRE(runs[0].m_last_slice == 6);
+
+    REQUIRE(ik->compact(1000) == 61);
+    REQUIRE(ik->num_slices() == 513 - 61);
+    REQUIRE(ik->compact() == 194 + 255);
+    REQUIRE(ik->num_slices() == 3);
+    REQUIRE(ik->integrity_check());
+    REQUIRE(std::equal(btree_kernel::iterator(ik, 0), btree_kernel::iterator(ik, ik->size()), expected.begin()));
+    REQUIRE(std::equal(btree_kernel::const_iterator(ik2, 0), btree_kernel::const_iterator(ik2, ik2->size()), expected.begin()));
+    REQUIRE(ik2->num_slices() == 513);
+
+    // Slices are only replaced if they are unchanged
+    auto merged = ik2->merged_slice(0, 2);
+    std::vector<btree_kernel::slice_t> slices {ik2->slices()[0], ik2->slices()[1]};
+    REQUIRE(!ik->replace_slices(0, slices, merged));
+    REQUIRE(ik2->replace_slices(0, slices, merged));
+    REQUIRE(ik2->num_slices() == 512);
+    REQUIRE(std::equal(btree_kernel::const_iterator(ik2, 0), btree_kernel::const_iterator(ik2, ik2->size()), expected.begin()));
+}
+
+
+TEST_CASE("cow policy", "[iterator kernel]") {
+    using snapshot_container::cow_policy;
+    using kernel = _iterator_kernel<int, deque_storage_creator<int>>;
+
+    auto policy = cow_policy::from_traits<config_traits>();
+    REQUIRE(policy.num_slices_lwm == config_traits::num_slices_lwm);
+    REQUIRE(policy.max_merge_size == config_traits::cow_ops::max_merge_size);
+    REQUIRE(!policy.adaptive);
+    REQUIRE(cow_policy::for_element_size<config_traits>(4).max_merge_size == config_traits::cow_ops::max_merge_size);
+    REQUIRE(cow_policy::for_element_size<config_traits>(64).max_merge_size == config_traits::cow_ops::max_merge_size / 8);
+    REQUIRE(cow_policy::for_element_size<config_traits>(1 << 20).max_insertion_copy_size == config_traits::cow_ops::slice_edge_offset);
+
+    // An insertion into a shared slice splits it unless the slice is small enough to copy
+    std::vector<int> test_values(1000);
+    std::iota(test_values.begin(), test_values.end(), 0);
+    for (size_t max_insertion_copy_size: {size_t(32), size_t(2000)}) {
+        auto ik = kernel::create(deque_storage_creator<int>(), test_values.begin(), test_values.end());
+        policy.max_insertion_copy_size = max_insertion_copy_size;
+        ik->set_cow_policy(policy);
+        auto snapshot = kernel::create(ik);
+        REQUIRE(snapshot->get_cow_policy().max_insertion_copy_size == max_insertion_copy_size);
+        ik->insert(ik->slice_index(500), 1);
+        REQUIRE(ik->num_slices() == (max_insertion_copy_size < test_values.size() ? 2 : 1));
+        REQUIRE(ik->size() == 1001);
+        REQUIRE((*ik)[500] == 1);
+        REQUIRE(std::equal(kernel::const_iterator(snapshot, 0), kernel::const_iterator(snapshot, snapshot->size()), test_values.begin()));
+    }
+
+    // An insert heavy mix without snapshots keeps more slices and copies more per cow op
+    auto ik = kernel::create(deque_storage_creator<int>(), test_values.begin(), test_values.end());
+    ik->set_cow_policy(cow_policy::adaptive_for_element_size<config_traits>(sizeof(int)));
+    for (size_t i = 0; i < cow_policy::adapt_interval; ++i)
+        ik->insert(ik->slice_index(i % ik->size()), static_cast<int>(i));
+    REQUIRE(ik->get_cow_policy().adaptive);
+    REQUIRE(ik->get_cow_policy().num_slices_lwm == 2 * config_traits::num_slices_lwm);
+    REQUIRE(ik->get_cow_policy().copy_fraction_denominator == config_traits::cow_ops::copy_fraction_denominator / 2);
+    REQUIRE(ik->op_counts().m_inserts == cow_policy::adapt_interval / 2);
+    REQUIRE(ik->size() == test_values.size() + cow_policy::adapt_interval);
+}
+
+
+struct stats_traits : public config_traits {
+    static constexpr bool collect_stats = true;
+};
+
+TEST_CASE("kernel stats", "[iterator kernel]") {
+    using kernel = _iterator_kernel<int, deque_storage_creator<int>, stats_traits>;
+
+    std::vector<int> test_values(1000);
+    std::iota(test_values.begin(), test_values.end(), 0);
+    auto ik = kernel::create(deque_storage_creator<int>(), test_values.begin(), test_values.end());
+    REQUIRE(ik->stats().m_storage_allocations == 1);
+
+    // An insertion into the middle of a shared slice moves the back half of the slice to new storage
+    auto snapshot = kernel::create(ik);
+    REQUIRE(snapshot->stats().m_storage_allocations == 0);
+    ik->insert(ik->slice_index(500), 1);
+    auto stats = ik->stats();
+    REQUIRE(stats.m_insert_copies.m_copies == 1);
+    REQUIRE(stats.m_insert_copies.m_elements == 500);
+    REQUIRE(stats.m_insert_copies.m_bytes == 500 * sizeof(int));
+    REQUIRE(stats.m_slices_created == 1);
+    REQUIRE(stats.m_storage_allocations == 2);
+    REQUIRE(stats.m_fast_lookups == 1);
+    REQUIRE(stats.m_binary_lookups == 0);
+
+    // A removal from shared storage copies the slice. The middle slice holds the inserted element as well.
+    ik->append(test_values.begin(), test_values.end());
+    snapshot = kernel::create(ik);
+    ik->reset_stats();
+    ik->remove(ik->slice_index(700));
+    stats = ik->stats();
+    REQUIRE(stats.m_binary_lookups == 1);
+    REQUIRE(stats.m_remove_copies.m_copies == 1);
+    REQUIRE(stats.m_remove_copies.m_elements == 501);
+    REQUIRE(stats.m_storage_allocations == 1);
+    REQUIRE(stats.m_iteration_copies.m_copies == 0);
+
+    ik->remove(ik->slice_index(0), ik->slice_index(500));
+    REQUIRE(ik->stats().m_slices_dropped == 1);
+    REQUIRE(ik->integrity_check());
+
+    // Slices built outside the kernel and inserted whole are counted as well
+    ik->reset_stats();
+    auto new_slice = ik->create_slice();
+    new_slice.append(7);
+    ik->insert_slice(ik->slice_index(10), new_slice);
+    REQUIRE(ik->stats().m_storage_allocations == 1);
+    REQUIRE((*ik)[10] == 7);
+
+    // Kernels which do not collect statistics report zeros
+    auto plain = _iterator_kernel<int, deque_storage_creator<int>>::create(deque_storage_creator<int>(),
+                                                                           test_values.begin(), test_values.end());
+    auto plain_snapshot = _iterator_kernel<int, deque_storage_creator<int>>::create(plain);
+    plain->insert(plain->slice_index(500), 1);
+    REQUIRE(plain->stats().m_storage_allocations == 0);
+    REQUIRE(plain->stats().m_insert_copies.m_copies == 0);
+}
+
+
+struct latency_traits : public config_traits {
+    static constexpr bool collect_latencies = true;
+};
+
+TEST_CASE("kernel latencies", "[iterator kernel]") {
+    snapshot_container::latency_histogram histogram;
+    REQUIRE(histogram.percentile(0.5) == 0);
+    histogram.record(0);
+    for (int i = 0; i < 98; ++i)
+        histogram.record(100);
+    histogram.record(5000);
+    REQUIRE(histogram.m_count == 100);
+    REQUIRE(histogram.m_max_ns == 5000);
+    REQUIRE(histogram.percentile(0.0) == 0);
+    REQUIRE(histogram.percentile(0.5) == 127);  // upper bound of the [64, 128) bucket
+    REQUIRE(histogram.percentile(0.999) == 5000);
+    REQUIRE(histogram.mean() == Approx(148.0));
+
+    using kernel = _iterator_kernel<int, deque_storage_creator<int>, latency_traits>;
+    std::vector<int> test_values(1000);
+    std::iota(test_values.begin(), test_values.end(), 0);
+    auto ik = kernel::create(deque_storage_creator<int>(), test_values.begin(), test_values.end());
+    auto snapshot = kernel::create(ik);
+    ik->insert(ik->slice_index(500), 1);
+    (*ik)[100] = 3;
+    ik->remove(ik->slice_index(10));
+    ik->push_back(2);
+
+    auto latencies = ik->latencies();
+    REQUIRE(latencies.m_snapshot.m_count == 1);
+    REQUIRE(latencies.m_insert.m_count == 1);
+    REQUIRE(latencies.m_remove.m_count == 1);
+    REQUIRE(latencies.m_append.m_count == 1);
+    REQUIRE(latencies.m_cow_write.m_count == 1);
+    REQUIRE(snapshot->latencies().m_snapshot.m_count == 0);
+
+    // A write to a slice which is already modifiable requires no cow ops
+    (*ik)[100] = 4;
+    REQUIRE(ik->latencies().m_cow_write.m_count == 1);
+
+    ik->reset_latencies();
+    REQUIRE(ik->latencies().m_insert.m_count == 0);
+    REQUIRE(_iterator_kernel<int, deque_storage_creator<int>>::create(deque_storage_creator<int>())->latencies().m_append.m_count == 0);
+}
+
+
+TEST_CASE("vector storage", "[storage]") {
+    using snapshot_container::vector_storage_creator;
+    using vector_kernel = _iterator_kernel<int, vector_storage_creator<int>>;
+    std::vector<int> test_values(1024);
+    std::iota(test_values.begin(), test_values.end(), 0);
+
+    vector_storage_creator<int> storage_creator(64);
+    auto storage = storage_creator();
+    REQUIRE(storage->size() == 0);
+    storage->append(1);
+    auto impl = virtual_iter::std_iter_impl_creator::create(test_values);
+    virtual_iter::rand_iter<int, 48> itr (impl, test_values.begin());
+    virtual_iter::rand_iter<int, 48> end_itr (impl, test_values.end());
+    storage->append(itr, end_itr);
+    storage->insert(1, itr + 10, itr + 20);
+    REQUIRE(storage->size() == 1 + 10 + test_values.size());
+    REQUIRE((*storage)[0] == 1);
+    REQUIRE(std::equal(test_values.begin() + 10, test_values.begin() + 20, storage->iterator(1)));
+    REQUIRE(std::equal(test_values.begin(), test_values.end(), storage->iterator(11)));
+
+    auto storage_copy = storage->copy(11);
+    REQUIRE(storage_copy->size() == test_values.size());
+    REQUIRE(std::equal(test_values.begin(), test_values.end(), storage_copy->begin()));
+    REQUIRE(storage_copy->id() != storage->id());
+
+    auto ik = vector_kernel::create(storage_creator, test_values.begin(), test_values.end());
+    auto ik2 = vector_kernel::create(ik);
+    std::vector<int> expected(test_values);
+    for (size_t i = 0; i < 32; ++i)
+    {
+        auto index = (i * 131) % expected.size();
+        ik->insert(ik->slice_index(index), itr + i, itr + 2 * i);
+        expected.insert(expected.begin() + index, test_values.begin() + i, test_values.begin() + 2 * i);
+        ik->remove(ik->slice_index(index / 3));
+        expected.erase(expected.begin() + index / 3);
+        (*ik)[index] = -1;
+        expected[index] = -1;
+    }
+
+    REQUIRE(ik->integrity_check());
+    REQUIRE(std::equal(vector_kernel::iterator(ik, 0), vector_kernel::iterator(ik, ik->size()), expected.begin(), expected.end()));
+    REQUIRE(std::equal(vector_kernel::const_iterator(ik2, 0), vector_kernel::const_iterator(ik2, ik2->size()),
+        test_values.begin(), test_values.end()));
+}
+
+
+// Storage creator exposing storage only through the type erased storage_base interface.
+struct erased_storage_creator
+{
+    typedef snapshot_container::deque_storage<int>::shared_base_t shared_base_t;
+
+    shared_base_t operator() ()
+    {
+        return snapshot_container::deque_storage<int>::create();
+    }
+
+    template <typename IterType>
+    shared_base_t operator() (IterType start_pos, IterType end_pos)
+    {
+        return snapshot_container::deque_storage<int>::create(start_pos, end_pos);
+    }
+};
+
+
+TEST_CASE("type erased storage", "[storage]") {
+    using erased_kernel = _iterator_kernel<int, erased_storage_creator>;
+    static_assert(std::is_same<_iterator_kernel<int, deque_storage_creator<int>>::storage_t,
+        snapshot_container::deque_storage<int>>::value, "");
+    static_assert(std::is_same<erased_kernel::storage_t, erased_kernel::slice_t::storage_base_t>::value, "");
+
+    std::vector<int> test_values(2048);
+    std::iota(test_values.begin(), test_values.end(), 0);
+    auto ik = erased_kernel::create(erased_storage_creator(), test_values.begin(), test_values.end());
+    auto ik2 = erased_kernel::create(ik);
+    std::vector<int> expected(test_values);
+
+    for (size_t i = 0; i < 16; ++i)
+    {
+        auto index = (i * 257) % expected.size();
+        ik->insert(ik->slice_index(index), -1);
+        expected.insert(expected.begin() + index, -1);
+        (*ik)[index + 1] = -2;
+        expected[index + 1] = -2;
+    }
+    ik->remove(ik->slice_index(100), ik->slice_index(1500));
+    expected.erase(expected.begin() + 100, expected.begin() + 1500);
+
+    REQUIRE(ik->integrity_check());
+    REQUIRE(std::equal(erased_kernel::iterator(ik, 0), erased_kernel::iterator(ik, ik->size()), expected.begin(), expected.end()));
+    REQUIRE(std::equal(erased_kernel::const_iterator(ik2, 0), erased_kernel::const_iterator(ik2, ik2->size()),
+        test_values.begin(), test_values.end()));
+}
+
+
+TEST_CASE("insert slice and extract", "[iterator kernel]") {
+    auto [ik, test_values] = test_ik_creator(2, 512);
+    using kernel_t = _iterator_kernel<int, deque_storage_creator<int>>;
+    std::vector<int> expected(test_values);
+    std::vector<int> new_values {-1, -2, -3};
+
+    for (auto index : {0, 100, 512, 700, 1030})
+    {
+        kernel_t::slice_t new_slice(deque_storage_creator<int>()(new_values.begin(), new_values.end()), 0);
+        auto insert_point = ik->insert_slice(ik->slice_index(index), new_slice);
+        expected.insert(expected.begin() + index, new_values.begin(), new_values.end());
+        REQUIRE(ik->container_index(insert_point) == index);
+    }
+    auto insert_point = ik->insert_slice(ik->end(), kernel_t::slice_t(deque_storage_creator<int>()(new_values.begin(), new_values.end()), 0));
+    expected.insert(expected.end(), new_values.begin(), new_values.end());
+    REQUIRE(ik->container_index(insert_point) == expected.size() - new_values.size());
+    REQUIRE(ik->integrity_check());
+    REQUIRE(std::equal(kernel_t::iterator(ik, 0), kernel_t::iterator(ik, ik->size()), expected.begin(), expected.end()));
+
+    // Elements are moved out of storage held only by the extracted slice
+    using string_slice_t = snapshot_container::_slice<std::string, snapshot_container::deque_storage<std::string>>;
+    std::vector<std::string> strings {std::string(64, 'a'), std::string(64, 'b'), std::string(64, 'c')};
+    string_slice_t slice(snapshot_container::deque_storage<std::string>::create(strings.begin(), strings.end()), 1);
+    auto data = slice[0].data();
+    auto extracted = slice.extract(0, 1);
+    REQUIRE(extracted[0] == strings[1]);
+    REQUIRE(extracted[0].data() == data);
+
+    auto shared = slice;
+    auto copied = shared.extract(1);
+    REQUIRE(copied[0] == strings[2]);
+    REQUIRE(shared[1] == strings[2]);
+}
+
+
+TEST_CASE("trim dead storage", "[iterator kernel]") {
+    using kernel_t = _iterator_kernel<int, deque_storage_creator<int>>;
+    std::vector<int> test_values(1000);
+    std::iota(test_values.begin(), test_values.end(), 0);
+
+    // Three slices of one storage element, two of them overlapping, reach 300 of its elements.
+    auto storage = deque_storage_creator<int>()(test_values.begin(), test_values.end());
+    auto ik = kernel_t::create(deque_storage_creator<int>());
+    std::vector<int> expected;
+    for (auto range : {std::make_pair(300, 400), std::make_pair(0, 100), std::make_pair(350, 500)}) {
+        ik->append_slice(kernel_t::slice_t(storage, range.first, range.second));
+        expected.insert(expected.end(), test_values.begin() + range.first, test_values.begin() + range.second);
+    }
+    REQUIRE(ik->trim_dead_storage(1.0) == 0);
+
+    storage.reset();
+    REQUIRE(ik->memory_usage().m_dead_bytes == 700 * sizeof(int));
+    REQUIRE(ik->trim_dead_storage(0.2) == 0);
+    REQUIRE(ik->trim_dead_storage(0.3) == 700 * sizeof(int));
+    REQUIRE(ik->memory_usage().m_total_bytes == 300 * sizeof(int));
+    REQUIRE(ik->num_slices() == 3);
+    REQUIRE(ik->integrity_check());
+    REQUIRE(std::equal(kernel_t::const_iterator(ik, 0), kernel_t::const_iterator(ik, ik->size()), expected.begin(), expected.end()));
+}
+
+
+TEST_CASE("visit blocks", "[storage]") {
+    using snapshot_container::vector_storage_creator;
+    std::vector<int> test_values(5000);
+    std::iota(test_values.begin(), test_values.end(), 0);
+    std::deque<int> deque_values(test_values.begin(), test_values.end());
+
+    auto collect = [](auto itr, const auto& end_itr, size_t& num_blocks) {
+        std::vector<int> result;
+        num_blocks = 0;
+        itr.visit_blocks(end_itr, [&](const int* block, size_t count) {
+            result.insert(result.end(), block, block + count);
+            ++num_blocks;
+            return true;
+        });
+        return result;
+    };
+
+    size_t num_blocks = 0;
+    auto vector_impl = virtual_iter::std_iter_impl_creator::create(test_values);
+    virtual_iter::rand_iter<int, 48> vector_itr (vector_impl, test_values.begin());
+    virtual_iter::rand_iter<int, 48> vector_end_itr (vector_impl, test_values.end());
+    REQUIRE(collect(vector_itr, vector_end_itr, num_blocks) == test_values);
+    REQUIRE(num_blocks == 1);
+    int copied = -1;
+    REQUIRE(vector_itr.copy(&copied, 0, vector_end_itr) == 0);
+    REQUIRE(copied == -1);
+
+    auto deque_impl = virtual_iter::std_iter_impl_creator::create(deque_values);
+    virtual_iter::rand_iter<int, 48> deque_itr (deque_impl, deque_values.begin());
+    virtual_iter::rand_iter<int, 48> deque_end_itr (deque_impl, deque_values.end());
+    REQUIRE(collect(deque_itr, deque_end_itr, num_blocks) == test_values);
+    REQUIRE(num_blocks > 1);
+    REQUIRE(num_blocks < test_values.size() / 16);
+
+    // Returning false stops the visit and leaves the iterator after the last block visited.
+    auto stop_itr = deque_itr;
+    size_t visited = 0;
+    stop_itr.visit_blocks(deque_end_itr, [&visited](const int*, size_t count) {
+        visited += count;
+        return false;
+    });
+    REQUIRE(visited > 0);
+    REQUIRE(*stop_itr == test_values[visited]);
+
+    // Inserts into the middle of deque storage from a segmented source.
+    auto storage = deque_storage_creator<int>()();
+    storage->append(vector_itr, vector_itr + 10);
+    storage->insert(5, deque_itr, deque_end_itr);
+    storage->insert(storage->size(), deque_itr, deque_itr + 3);
+    std::vector<int> expected(test_values.begin(), test_values.begin() + 5);
+    expected.insert(expected.end(), test_values.begin(), test_values.end());
+    expected.insert(expected.end(), test_values.begin() + 5, test_values.begin() + 10);
+    expected.insert(expected.end(), test_values.begin(), test_values.begin() + 3);
+    REQUIRE(storage->size() == expected.size());
+    REQUIRE(std::equal(expected.begin(), expected.end(), storage->begin()));
+
+    // Vector storage of a type which is not bulk copyable.
+    std::deque<std::string> strings;
+    for (size_t i = 0; i < 1000; ++i)
+        strings.push_back(std::to_string(i));
+    auto strings_impl = virtual_iter::std_fwd_iter_impl_creator::create(strings);
+    virtual_iter::fwd_iter<std::string, 48> strings_itr (strings_impl, strings.begin());
+    virtual_iter::fwd_iter<std::string, 48> strings_end_itr (strings_impl, strings.end());
+    auto string_storage = vector_storage_creator<std::string>()();
+    string_storage->append(strings_itr, strings_end_itr);
+    string_storage->insert(1, strings_itr, strings_end_itr);
+    REQUIRE(string_storage->size() == 2 * strings.size());
+    REQUIRE((*string_storage)[0] == "0");
+    REQUIRE(std::equal(strings.begin(), strings.end(), string_storage->iterator(1)));
+    REQUIRE((*string_storage)[strings.size() + 1] == "1");
+    REQUIRE((*string_storage)[string_storage->size() - 1] == "999");
+}
+
+
+TEST_CASE("mmap storage", "[storage]") {
+    using snapshot_container::mmap_storage;
+    using snapshot_container::mmap_storage_creator;
+    using mmap_kernel = _iterator_kernel<int, mmap_storage_creator<int>>;
+    char directory_template[] = "/tmp/snapshot_mmap_test_XXXXXX";
+    std::string directory = mkdtemp(directory_template);
+
+    std::vector<int> test_values(10000);
+    std::iota(test_values.begin(), test_values.end(), 0);
+    mmap_storage_creator<int> storage_creator(directory);
+    auto ik = mmap_kernel::create(storage_creator, test_values.begin(), test_values.end());
+    auto ik2 = mmap_kernel::create(ik);
+    std::vector<int> expected(test_values);
+
+    auto impl = virtual_iter::std_iter_impl_creator::create(test_values);
+    virtual_iter::rand_iter<int, 48> itr (impl, test_values.begin());
+    for (size_t i = 0; i < 32; ++i)
+    {
+        auto index = (i * 997) % expected.size();
+        ik->insert(ik->slice_index(index), itr + i, itr + 3 * i);
+        expected.insert(expected.begin() + index, test_values.begin() + i, test_values.begin() + 3 * i);
+        ik->remove(ik->slice_index(index / 2));
+        expected.erase(expected.begin() + index / 2);
+        (*ik)[index] = -1;
+        expected[index] = -1;
+        ik->push_back(int(i));
+        expected.push_back(int(i));
+    }
+
+    REQUIRE(ik->integrity_check());
+    REQUIRE(std::equal(mmap_kernel::iterator(ik, 0), mmap_kernel::iterator(ik, ik->size()), expected.begin(), expected.end()));
+    REQUIRE(std::equal(mmap_kernel::const_iterator(ik2, 0), mmap_kernel::const_iterator(ik2, ik2->size()),
+        test_values.begin(), test_values.end()));
+
+    // Persistent storage can be mapped again after it is destroyed.
+    std::string path;
+    {
+        auto storage = mmap_storage<int>::create(directory, true);
+        storage->append(itr, itr + test_values.size());
+        storage->insert(0, -1);
+        storage->remove(1, 11);
+        REQUIRE(storage->capacity() >= storage->size());
+        storage->sync();
+        path = storage->path();
+    }
+
+    auto storage = mmap_storage<int>::open(path);
+    REQUIRE(storage->persistent());
+    REQUIRE(storage->size() == test_values.size() - 9);
+    REQUIRE((*storage)[0] == -1);
+    REQUIRE(std::equal(test_values.begin() + 10, test_values.end(), storage->iterator(1)));
+    REQUIRE_THROWS(mmap_storage<double>::open(path));
+    REQUIRE_THROWS(mmap_storage<int>::open(directory + "/missing"));
+
+    storage.reset();
+    ik.reset();
+    ik2.reset();
+    unlink(path.c_str());
+    REQUIRE(rmdir(directory.c_str()) == 0);
+}
@@ -11,6 +11,7 @@
 #include <functional>
 #include <memory>
 #include <set>
+#include <utility>
 #include <sys/types.h>
 #include <vector>
 
@@ -49,6 +50,7 @@ namespace virtual_iter
         virtual size_t copy(T* resultPtr, size_t maxItems, void* iter, void* endItr) const = 0;
 
         virtual void visit(void* iter, void* end_iter, std::function<bool(const T&)>&) = 0;
+        virtual void visit_blocks(void* iter, void* end_iter, std::function<bool(const T*, size_t)>&) = 0;
 
         void* mem(const iterator_type& arg) const
         {
@@ -148,7 +150,18 @@ namespace virtual_iter
         void visit(const iterator_type& endItr, std::function<bool(const value_type&)>& f)
         {
             m_impl->visit (m_iter_mem, endItr.m_iter_mem, f);
-        }        
+        }
+
+        // Batched form of visit. f is called as f(const value_type* block, size_t count) for each run of elements
+        // that are contiguous in memory (a single run when wrapping a std::vector) and returns false to stop.
+        // f is type erased once per call rather than invoked indirectly per element so loops over each block run
+        // at the speed of a native loop.
+        template <typename Function>
+        void visit_blocks(const iterator_type& endItr, Function&& f)
+        {
+            std::function<bool(const value_type*, size_t)> block_function(std::forward<Function>(f));
+            m_impl->visit_blocks (m_iter_mem, endItr.m_iter_mem, block_function);
+        }
         
     protected:
         void* mem() const
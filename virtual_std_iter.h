@@ -9,22 +9,34 @@
 
 #include "virtual_iter.h"
 #include "virtual_std_iter_detail.h"
+#include <cstring>
+#include <iterator>
+#include <memory>
 #include <type_traits>
+#include <vector>
 
 namespace virtual_iter
 {
-    template <typename ConstIterType, size_t IterMemSize, typename IterType=fwd_iter<typename ConstIterType::value_type, IterMemSize> >
-    class std_fwd_iter_impl_base: virtual public _fwd_iter_impl_base<typename ConstIterType::value_type, IterMemSize, IterType>
+    // Iterators known to address contiguous memory. Copies from these are done with memcpy for trivially copyable
+    // value types.
+    template <typename ConstIterType, typename T = typename std::iterator_traits<ConstIterType>::value_type>
+    struct _is_contiguous : std::integral_constant<bool,
+        (std::is_same<ConstIterType, typename std::vector<T>::const_iterator>::value ||
+         std::is_same<ConstIterType, const T*>::value) && !std::is_same<T, bool>::value>
+    {};
+
+    template <typename ConstIterType, size_t IterMemSize, typename IterType=fwd_iter<typename std::iterator_traits<ConstIterType>::value_type, IterMemSize> >
+    class std_fwd_iter_impl_base: virtual public _fwd_iter_impl_base<typename std::iterator_traits<ConstIterType>::value_type, IterMemSize, IterType>
     {
     public:        
 
         // It would be great if std::vector<T>::iterator could somehow be mapped to std::vector<T>::const_iterator
         // but I don't know a convenient way to move between these types. The static assert is defensive but not very
         // user friendly. There are some helper creators to work around this awkwardness as a partial solution.
-        static_assert(std::is_const<typename std::remove_pointer<typename ConstIterType::pointer>::type>::value,
+        static_assert(std::is_const<typename std::remove_pointer<typename std::iterator_traits<ConstIterType>::pointer>::type>::value,
                       "virtual_iter::std_fwd_iter_impl must be constructed based on a const_iterator type");
 
-        typedef typename ConstIterType::value_type value_type;
+        typedef typename std::iterator_traits<ConstIterType>::value_type value_type;
         typedef _fwd_iter_impl_base<value_type, IterMemSize, IterType> impl_base_t;
         typedef std::shared_ptr<impl_base_t> shared_base_t;
         typedef IterType iterator_type;
@@ -73,13 +85,13 @@ namespace virtual_iter
         const value_type* pointer(const iterator_type& arg) const override
         {
             auto iter_store = reinterpret_cast<_IterStore*>(impl_base_t::mem (arg));
-            return (iter_store->m_itr).operator-> ();
+            return std::addressof(*iter_store->m_itr);
         }
 
         const value_type& reference(const iterator_type& arg) const override
         {
             auto iter_store = reinterpret_cast<_IterStore*>(impl_base_t::mem (arg));
-            return (iter_store->m_itr).operator* ();
+            return *iter_store->m_itr;
         }
 
 
@@ -91,12 +103,19 @@ namespace virtual_iter
             auto rhs_iter = reinterpret_cast<_IterStore*>(end_iter);
             ssize_t distance_to_end = rhs_iter->m_itr - lhs_iter->m_itr;
 
-            if (distance_to_end <= 0)
+            if (distance_to_end <= 0 || max_items == 0)
                 return 0;
 
             if (distance_to_end < max_items)
                 max_items = (size_t) distance_to_end;
 
+            if constexpr(_is_contiguous<ConstIterType>::value && std::is_trivially_copyable<value_type>::value)
+            {
+                std::memcpy(result_ptr, &*lhs_iter->m_itr, max_items * sizeof(value_type));
+                lhs_iter->m_itr += max_items;
+                return max_items;
+            }
+
             size_t copy_count = 0;
             while (copy_count < max_items)
             {
@@ -121,16 +140,59 @@ namespace virtual_iter
                 ++lhs_iter->m_itr;
             }
         }
+
+        void visit_blocks(void* iter, void* end_iter, std::function<bool(const value_type*, size_t)>& f) override
+        {
+            auto lhs_iter = reinterpret_cast<_IterStore*>(iter);
+            auto rhs_iter = reinterpret_cast<_IterStore*>(end_iter);
+
+            if constexpr(_is_contiguous<ConstIterType>::value)
+            {
+                ssize_t count = rhs_iter->m_itr - lhs_iter->m_itr;
+                if (count <= 0)
+                    return;
+
+                const value_type* block = &*lhs_iter->m_itr;
+                lhs_iter->m_itr += count;
+                f(block, count);
+            }
+            else if constexpr(std::is_reference<decltype(*lhs_iter->m_itr)>::value)
+            {
+                // Group elements at consecutive addresses (e.g. within one block of a std::deque) into a single call.
+                while (lhs_iter->m_itr != rhs_iter->m_itr)
+                {
+                    const value_type* block = std::addressof(*lhs_iter->m_itr);
+                    size_t count = 1;
+                    for (++lhs_iter->m_itr; lhs_iter->m_itr != rhs_iter->m_itr &&
+                                            std::addressof(*lhs_iter->m_itr) == block + count; ++lhs_iter->m_itr)
+                        ++count;
+
+                    if (!f(block, count))
+                        return;
+                }
+            }
+            else
+            {
+                // Proxy iterators don't refer to stored elements. Visit a copy of each one.
+                while (lhs_iter->m_itr != rhs_iter->m_itr)
+                {
+                    value_type value = *lhs_iter->m_itr;
+                    ++lhs_iter->m_itr;
+                    if (!f(&value, 1))
+                        return;
+                }
+            }
+        }
     };
 
 
     // Implementation of fwd_iter around standard c++ iterator types.
-    template <typename ConstIterType, size_t IterMemSize, typename IterType=fwd_iter<typename ConstIterType::value_type, IterMemSize> >
+    template <typename ConstIterType, size_t IterMemSize, typename IterType=fwd_iter<typename std::iterator_traits<ConstIterType>::value_type, IterMemSize> >
     class std_fwd_iter_impl: public std_fwd_iter_impl_base<ConstIterType, IterMemSize, IterType>
     {
     public:
 
-        typedef typename ConstIterType::value_type value_type;
+        typedef typename std::iterator_traits<ConstIterType>::value_type value_type;
         typedef _fwd_iter_impl_base<value_type, IterMemSize, IterType> impl_base_t;
         typedef std::shared_ptr<impl_base_t> shared_base_t;
         typedef IterType iterator_type;
@@ -177,14 +239,14 @@ namespace virtual_iter
     };
 
 
-    template <typename ConstIterType, size_t IterMemSize, typename IterType=rand_iter<typename ConstIterType::value_type, IterMemSize>>
+    template <typename ConstIterType, size_t IterMemSize, typename IterType=rand_iter<typename std::iterator_traits<ConstIterType>::value_type, IterMemSize>>
     class std_rand_iter_impl : public std_fwd_iter_impl_base<ConstIterType, IterMemSize, IterType>,
-                               public _rand_iter_impl_base<typename ConstIterType::value_type, IterMemSize, IterType>
+                               public _rand_iter_impl_base<typename std::iterator_traits<ConstIterType>::value_type, IterMemSize, IterType>
     {
     public:
-        typedef typename ConstIterType::value_type value_type;
+        typedef typename std::iterator_traits<ConstIterType>::value_type value_type;
         typedef std_fwd_iter_impl_base<ConstIterType, IterMemSize, IterType> fwd_impl_base_t;
-        typedef _rand_iter_impl_base<typename ConstIterType::value_type, IterMemSize, IterType> impl_base_t;
+        typedef _rand_iter_impl_base<typename std::iterator_traits<ConstIterType>::value_type, IterMemSize, IterType> impl_base_t;
         typedef std::shared_ptr<impl_base_t> shared_base_t;
         typedef IterType iterator_type;
         using difference_type = typename fwd_impl_base_t::difference_type;